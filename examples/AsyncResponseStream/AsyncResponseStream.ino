@@ -39,6 +39,24 @@ void setup() {
     request->send(response);
   });
 
+  // Shows how to stream the same content with AsyncResponseStream.
+  // The content is sent chunked as it is printed, from at most 4 blocks of 1460 bytes:
+  // the producer is called again each time blocks are sent, until it returns false.
+  //
+  // curl -v http://192.168.4.1/stream
+  //
+  server.on("/stream", HTTP_GET, [](AsyncWebServerRequest *request) {
+    std::shared_ptr<int> remaining = std::make_shared<int>(32 * 1024);
+    AsyncResponseStream *response = request->beginResponseStream("plain/text", [remaining](AsyncResponseStream &stream) {
+      while (*remaining && stream.room()) {
+        stream.write('a');
+        (*remaining)--;
+      }
+      return *remaining != 0;
+    });
+    request->send(response);
+  });
+
   server.begin();
 }
 
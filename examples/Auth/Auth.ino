@@ -86,6 +86,9 @@ void setup() {
   digestAuthHash.setRealm("MyApp");
   digestAuthHash.setAuthFailureMessage("Authentication failed");
   digestAuthHash.setAuthType(AsyncAuthType::AUTH_DIGEST);
+  // remember up to 8 verified clients for 5 minutes, also recognized by a "session" cookie (optional)
+  digestAuthHash.setCache(8, 300);
+  digestAuthHash.setSessionCookie("session");
 
   // basic authentication method
   // curl -v -u admin:admin  http://192.168.4.1/auth-basic
@@ -0,0 +1,498 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+//
+// Measures the request parser, the router, the multipart parser, the templates, the SSE messages and the WebSocket parser
+// on the board itself, through a loopback connection: no network and no load generator are needed (ESP32 only).
+//
+// Build it with the [env:benchmark] environment of platformio.ini, src_dir set to examples/Benchmark, to also get the number of allocations per operation:
+// malloc(), calloc() and realloc() are then wrapped to be counted. The counts include the allocations of lwIP and of the
+// loopback client, which are the same from one run to the next: compare the results of two builds, not their absolute values.
+//
+
+#include <Arduino.h>
+#if defined(ESP32) || defined(LIBRETINY)
+#include <AsyncTCP.h>
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <ESPAsyncTCP.h>
+#elif defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
+#include <RPAsyncTCP.h>
+#include <WiFi.h>
+#endif
+
+#include <ESPAsyncWebServer.h>
+
+#ifdef ESP32
+
+#include <atomic>
+#include <mutex>
+
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+static std::atomic<uint32_t> allocations{0};
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  allocations++;
+  return __real_malloc(size);
+}
+void *__wrap_calloc(size_t n, size_t size) {
+  allocations++;
+  return __real_calloc(n, size);
+}
+void *__wrap_realloc(void *ptr, size_t size) {
+  allocations++;
+  return __real_realloc(ptr, size);
+}
+}
+#endif
+
+static uint32_t allocationCount() {
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+  return allocations;
+#else
+  return 0;
+#endif
+}
+
+#define ROUTES       64
+#define REQUESTS     500
+#define EVENTS       1000
+#define WS_MESSAGES  1000
+#define UPLOAD_SIZE  (16 * 1024)
+#define BENCH_TIMEOUT 20000
+
+static AsyncWebServer server(80);
+static AsyncEventSource events("/events");
+static AsyncWebSocket ws("/ws");
+
+static const char templateContent[] PROGMEM = R"(
+<!DOCTYPE html>
+<html>
+<body>
+    <h1>Hello, %USER%</h1>
+    <p>Uptime: %UPTIME% ms, free heap: %HEAP% bytes</p>
+    <p>Lorem ipsum dolor sit amet, consectetur adipiscing elit. Proin euismod, purus a euismod rhoncus, urna ipsum cursus massa,
+    eu dictum tellus justo ac justo. Quisque ullamcorper arcu nec tortor ullamcorper, vel fermentum justo fermentum. %USER%</p>
+    <p>Lorem ipsum dolor sit amet, consectetur adipiscing elit. Proin euismod, purus a euismod rhoncus, urna ipsum cursus massa,
+    eu dictum tellus justo ac justo. Quisque ullamcorper arcu nec tortor ullamcorper, vel fermentum justo fermentum. %UPTIME%</p>
+    <p>Lorem ipsum dolor sit amet, consectetur adipiscing elit. Proin euismod, purus a euismod rhoncus, urna ipsum cursus massa,
+    eu dictum tellus justo ac justo. Quisque ullamcorper arcu nec tortor ullamcorper, vel fermentum justo fermentum. 100%%</p>
+</body>
+</html>
+)";
+static const size_t templateContentLength = strlen_P(templateContent);
+
+// headers as sent by a browser
+static const char *browserHeaders = "Host: 127.0.0.1\r\n"
+                                    "Connection: keep-alive\r\n"
+                                    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0.0.0 Safari/537.36\r\n"
+                                    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+                                    "Accept-Language: en-US,en;q=0.9,fr;q=0.8\r\n"
+                                    "Cache-Control: max-age=0\r\n"
+                                    "Cookie: session=3f2a9c0d1e4b5a6978877665544332211; theme=dark; lang=en\r\n"
+                                    "Referer: http://127.0.0.1/index.html\r\n"
+                                    "Sec-Fetch-Dest: document\r\n"
+                                    "Sec-Fetch-Mode: navigate\r\n"
+                                    "Sec-Fetch-Site: same-origin\r\n"
+                                    "Upgrade-Insecure-Requests: 1\r\n";
+
+static const char *boundary = "----BenchmarkBoundary7MA4YWxkTrZu0gW";
+
+/*
+ * Loopback client: sends the same request again as soon as the response to the previous one is received
+ */
+
+static AsyncClient *client = nullptr;
+static std::mutex clientLock;
+static std::atomic<bool> connected{false};
+static std::atomic<bool> done{false};
+static std::atomic<uint32_t> responses{0};
+
+static const char *requestData = nullptr;  // request being sent
+static size_t requestLen = 0;
+static size_t requestSent = 0;
+static uint32_t requestsLeft = 0;
+
+static uint8_t wsFrame[2 + 4 + 125];  // masked text frame
+static uint32_t wsFramesLeft = 0;
+static std::atomic<uint32_t> wsMessages{0};
+
+// response parser, without any allocation
+static char line[160];
+static size_t lineLen = 0;
+static bool inHeaders = true;
+static bool chunked = false;
+static size_t bodyLeft = 0;
+static uint64_t lastBytes = 0;
+static bool discard = false;  // upgraded connection: the data received is not parsed
+
+static void pump() {
+  std::lock_guard<std::mutex> lock(clientLock);
+  if (!client) {
+    return;
+  }
+  while (requestSent < requestLen && client->space()) {
+    const size_t n = client->add(requestData + requestSent, requestLen - requestSent);
+    if (!n) {
+      break;
+    }
+    requestSent += n;
+  }
+  while (requestSent == requestLen && wsFramesLeft && client->space() >= sizeof(wsFrame)) {
+    client->add((const char *)wsFrame, sizeof(wsFrame));
+    wsFramesLeft--;
+  }
+  client->send();
+}
+
+static void sendRequest() {
+  {
+    std::lock_guard<std::mutex> lock(clientLock);
+    requestSent = 0;
+    inHeaders = true;
+    chunked = false;
+    bodyLeft = 0;
+    lineLen = 0;
+    lastBytes = 0;
+  }
+  pump();
+}
+
+static void responseReceived() {
+  responses++;
+  if (requestsLeft && --requestsLeft) {
+    sendRequest();
+  } else {
+    done = true;
+  }
+}
+
+static void parseHeaderLine() {
+  while (lineLen && (line[lineLen - 1] == '\r' || line[lineLen - 1] == '\n')) {
+    lineLen--;
+  }
+  line[lineLen] = 0;
+  if (!lineLen) {
+    inHeaders = false;
+    return;
+  }
+  if (strncasecmp(line, "Content-Length:", 15) == 0) {
+    bodyLeft = strtoul(line + 15, nullptr, 10);
+  } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked")) {
+    chunked = true;
+  }
+}
+
+static void onData(const uint8_t *data, size_t len) {
+  if (discard) {
+    return;
+  }
+  for (size_t i = 0; i < len; i++) {
+    if (inHeaders) {
+      if (lineLen < sizeof(line) - 1) {
+        line[lineLen++] = data[i];
+      }
+      if (data[i] == '\n') {
+        parseHeaderLine();
+        lineLen = 0;
+        if (!inHeaders && !chunked && !bodyLeft) {
+          responseReceived();
+        }
+      }
+    } else if (chunked) {
+      // the last chunk, of length 0, is followed by an empty line: the content has no "\r\n"
+      lastBytes = (lastBytes << 8) | data[i];
+      if ((lastBytes & 0xffffffffffULL) == 0x300d0a0d0aULL) {
+        responseReceived();
+      }
+    } else if (bodyLeft && !--bodyLeft) {
+      responseReceived();
+    }
+  }
+}
+
+static bool openLoopback() {
+  connected = false;
+  AsyncClient *c = new AsyncClient();
+  c->onConnect([](void *, AsyncClient *) {
+    connected = true;
+  });
+  c->onDisconnect([](void *, AsyncClient *c) {
+    {
+      std::lock_guard<std::mutex> lock(clientLock);
+      if (client == c) {
+        client = nullptr;
+      }
+    }
+    connected = false;
+    delete c;
+  });
+  c->onAck([](void *, AsyncClient *, size_t, uint32_t) {
+    pump();
+  });
+  c->onData([](void *, AsyncClient *, void *data, size_t len) {
+    onData((const uint8_t *)data, len);
+  });
+  {
+    std::lock_guard<std::mutex> lock(clientLock);
+    client = c;
+    discard = false;
+  }
+  if (!c->connect(IPAddress(127, 0, 0, 1), 80)) {
+    return false;
+  }
+  const uint32_t start = millis();
+  while (!connected && millis() - start < BENCH_TIMEOUT) {
+    delay(1);
+  }
+  return connected;
+}
+
+static void closeLoopback() {
+  std::lock_guard<std::mutex> lock(clientLock);
+  if (client) {
+    client->close();
+  }
+}
+
+static bool waitFor(std::atomic<bool> &flag) {
+  const uint32_t start = millis();
+  while (!flag && millis() - start < BENCH_TIMEOUT) {
+    delay(1);
+  }
+  return flag;
+}
+
+static void report(const char *name, uint32_t ops, size_t bytesPerOp, uint32_t us, uint32_t allocs) {
+  if (!us) {
+    us = 1;
+  }
+  Serial.printf(
+    "%-10s %6lu ops %9.1f ops/s %9.1f KB/s %7.1f allocs/op\n", name, (unsigned long)ops, ops * 1000000.0 / us, ops * bytesPerOp * 1000000.0 / 1024 / us,
+    (double)allocs / ops
+  );
+}
+
+// sends count times the request on the loopback connection, one after the other
+static void benchRequests(const char *name, const String &req, uint32_t count, size_t bytesPerOp) {
+  if (!openLoopback()) {
+    Serial.printf("%-10s unable to connect\n", name);
+    return;
+  }
+  requestData = req.c_str();
+  requestLen = req.length();
+  requestsLeft = count;
+  responses = 0;
+  done = false;
+  const uint32_t allocs = allocationCount();
+  const uint32_t start = micros();
+  sendRequest();
+  if (!waitFor(done)) {
+    Serial.printf("%-10s timeout after %lu responses\n", name, (unsigned long)responses);
+  } else {
+    report(name, count, bytesPerOp, micros() - start, allocationCount() - allocs);
+  }
+  closeLoopback();
+  delay(100);
+}
+
+static void benchEvents() {
+  static const char *sseRequest = "GET /events HTTP/1.1\r\nHost: 127.0.0.1\r\nAccept: text/event-stream\r\n\r\n";
+  if (!openLoopback()) {
+    Serial.printf("%-10s unable to connect\n", "sse");
+    return;
+  }
+  requestData = sseRequest;
+  requestLen = strlen(sseRequest);
+  requestsLeft = 0;
+  done = false;
+  sendRequest();
+  if (!waitFor(done)) {
+    Serial.printf("%-10s no event stream\n", "sse");
+    closeLoopback();
+    return;
+  }
+  discard = true;
+  delay(100);
+
+  static const char *payload = "{\"temperature\":21.5,\"humidity\":48.2,\"pressure\":1013.2,\"lines\":\"first\\nsecond\\nthird\"}";
+  const uint32_t allocs = allocationCount();
+  const uint32_t start = micros();
+  for (uint32_t i = 0; i < EVENTS; i++) {
+    // the events are sent at the pace of the connection
+    while (events.avgPacketsWaiting() >= 8) {
+      delay(1);
+    }
+    events.send(payload, "telemetry", i + 1);
+  }
+  while (events.avgPacketsWaiting()) {
+    delay(1);
+  }
+  report("sse", EVENTS, strlen(payload), micros() - start, allocationCount() - allocs);
+  closeLoopback();
+  delay(100);
+}
+
+static void benchWebSocket() {
+  static const char *wsRequest = "GET /ws HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+  if (!openLoopback()) {
+    Serial.printf("%-10s unable to connect\n", "ws");
+    return;
+  }
+  requestData = wsRequest;
+  requestLen = strlen(wsRequest);
+  requestsLeft = 0;
+  done = false;
+  sendRequest();
+  if (!waitFor(done)) {
+    Serial.printf("%-10s no upgrade\n", "ws");
+    closeLoopback();
+    return;
+  }
+  discard = true;
+  delay(100);
+
+  static const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+  wsFrame[0] = 0x81;  // FIN, text
+  wsFrame[1] = 0x80 | 125;
+  memcpy(wsFrame + 2, mask, 4);
+  for (size_t i = 0; i < 125; i++) {
+    wsFrame[6 + i] = ('a' + i % 26) ^ mask[i % 4];
+  }
+  wsMessages = 0;
+  {
+    std::lock_guard<std::mutex> lock(clientLock);
+    wsFramesLeft = WS_MESSAGES;
+  }
+  const uint32_t allocs = allocationCount();
+  const uint32_t start = micros();
+  pump();
+  const uint32_t timeout = millis();
+  while (wsMessages < WS_MESSAGES && millis() - timeout < BENCH_TIMEOUT) {
+    delay(1);
+  }
+  if (wsMessages < WS_MESSAGES) {
+    Serial.printf("%-10s timeout after %lu messages\n", "ws", (unsigned long)wsMessages);
+  } else {
+    report("ws", WS_MESSAGES, 125, micros() - start, allocationCount() - allocs);
+  }
+  closeLoopback();
+  delay(100);
+}
+
+void setup() {
+  Serial.begin(115200);
+
+#if SOC_WIFI_SUPPORTED || CONFIG_ESP_WIFI_REMOTE_ENABLED || LT_ARD_HAS_WIFI
+  // only to start the network stack: the benchmark does not use WiFi
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP("esp-benchmark");
+#endif
+
+  // unlimited requests per connection
+  server.setKeepAlive(true, BENCH_TIMEOUT / 1000, 0);
+
+  server.on("/hello", HTTP_GET, [](AsyncWebServerRequest *request) {
+    request->send(200, "text/plain", "Hello");
+  });
+
+  // the benchmark requests the last one
+  for (size_t i = 0; i < ROUTES; i++) {
+    server.on((String("/api/route") + i).c_str(), HTTP_GET, [](AsyncWebServerRequest *request) {
+      request->send(200, "application/json", "{}");
+    });
+  }
+
+  server.on(
+    "/upload", HTTP_POST,
+    [](AsyncWebServerRequest *request) {
+      request->send(200, "text/plain", "OK");
+    },
+    [](AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) {
+      // the data is dropped: only the parser is measured
+      (void)request;
+      (void)filename;
+      (void)index;
+      (void)data;
+      (void)len;
+      (void)final;
+    }
+  );
+
+  server.on("/template", HTTP_GET, [](AsyncWebServerRequest *request) {
+    request->send(200, "text/html", (const uint8_t *)templateContent, templateContentLength, [](const String &var) -> String {
+      if (var == "USER") {
+        return "benchmark";
+      }
+      if (var == "UPTIME") {
+        return String(millis());
+      }
+      if (var == "HEAP") {
+        return String(ESP.getFreeHeap());
+      }
+      return emptyString;
+    });
+  });
+
+  ws.onEvent([](AsyncWebSocket *wsServer, AsyncWebSocketClient *wsClient, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+    (void)wsServer;
+    (void)wsClient;
+    (void)data;
+    if (type == WS_EVT_DATA) {
+      AwsFrameInfo *info = (AwsFrameInfo *)arg;
+      if (info->final && info->index + len == info->len) {
+        wsMessages++;
+      }
+    }
+  });
+
+  server.addHandler(&events);
+  server.addHandler(&ws);
+  server.begin();
+
+  // the requests are built before the measures
+  static String hello = String("GET /hello HTTP/1.1\r\n") + browserHeaders + "\r\n";
+  static String route = String("GET /api/route") + (ROUTES - 1) + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  static String tpl = "GET /template HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  static String upload;
+  String part = String("--") + boundary + "\r\nContent-Disposition: form-data; name=\"file\"; filename=\"firmware.bin\"\r\n"
+                + "Content-Type: application/octet-stream\r\n\r\n";
+  String end = String("\r\n--") + boundary + "--\r\n";
+  upload.reserve(256 + part.length() + UPLOAD_SIZE + end.length());
+  upload = String("POST /upload HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Type: multipart/form-data; boundary=") + boundary
+           + "\r\nContent-Length: " + (part.length() + UPLOAD_SIZE + end.length()) + "\r\n\r\n" + part;
+  for (size_t i = 0; i < UPLOAD_SIZE; i++) {
+    upload.concat((char)('0' + i % 64));
+  }
+  upload.concat(end);
+
+  delay(1000);
+  Serial.println("Benchmark: operations per second, content throughput and allocations per operation");
+  benchRequests("parser", hello, REQUESTS, hello.length());
+  benchRequests("router", route, REQUESTS, route.length());
+  benchRequests("multipart", upload, REQUESTS / 10, UPLOAD_SIZE);
+  benchRequests("template", tpl, REQUESTS, templateContentLength);
+  benchEvents();
+  benchWebSocket();
+  Serial.println("Done");
+}
+
+#else
+
+void setup() {
+  Serial.begin(115200);
+  Serial.println("The benchmark needs an ESP32");
+}
+
+#endif
+
+void loop() {
+  delay(100);
+}
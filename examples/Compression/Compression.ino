@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+//
+// Compress dynamic responses on the fly, when the client accepts gzip or deflate
+//
+
+#include <Arduino.h>
+#if defined(ESP32) || defined(LIBRETINY)
+#include <AsyncTCP.h>
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <ESPAsyncTCP.h>
+#elif defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
+#include <RPAsyncTCP.h>
+#include <WiFi.h>
+#endif
+
+#include <ESPAsyncWebServer.h>
+
+static AsyncWebServer server(80);
+
+void setup() {
+  Serial.begin(115200);
+
+#if SOC_WIFI_SUPPORTED || CONFIG_ESP_WIFI_REMOTE_ENABLED || LT_ARD_HAS_WIFI
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP("esp-captive");
+#endif
+
+  // CSV export of about 40KB, sent gzip-encoded to the clients accepting it:
+  //
+  // curl -v --compressed http://192.168.4.1/log.csv
+  //
+  server.on("/log.csv", HTTP_GET, [](AsyncWebServerRequest *request) {
+    AsyncResponseStream *response = request->beginResponseStream("text/csv");
+    response->print("time,sensor,value\n");
+    for (int i = 0; i < 2000; i++) {
+      response->printf("%d,temperature,%d.%d\n", i * 60, 20 + (i % 7), i % 10);
+    }
+    response->setCompression(true);
+    request->send(response);
+  });
+
+  // chunked content compressed while it is produced
+  //
+  // curl -v --compressed http://192.168.4.1/chunked
+  //
+  server.on("/chunked", HTTP_GET, [](AsyncWebServerRequest *request) {
+    AsyncWebServerResponse *response = request->beginChunkedResponse("text/plain", [](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      // 100 lines of 32 characters
+      if (index >= 3200) {
+        return 0;
+      }
+      return snprintf((char *)buffer, maxLen, "line %04u of the chunked reply.\n", (unsigned)(index / 32));
+    });
+    response->setCompression(true);
+    request->send(response);
+  });
+
+  server.begin();
+}
+
+// not needed
+void loop() {
+  delay(100);
+}
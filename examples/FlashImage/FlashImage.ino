@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+//
+// Shows how to serve a web UI from a read-only image written to a flash partition, instead of LittleFS:
+// the files are sent from the mapped flash without copies, with ETags computed when the image is built.
+//
+
+#include <Arduino.h>
+#if defined(ESP32) || defined(LIBRETINY)
+#include <AsyncTCP.h>
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <ESPAsyncTCP.h>
+#elif defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
+#include <RPAsyncTCP.h>
+#include <WiFi.h>
+#endif
+
+#include <ESPAsyncWebServer.h>
+
+#ifndef ESP32
+// this example is only for the ESP32
+void setup() {}
+void loop() {}
+#else
+
+static AsyncWebServer server(80);
+
+void setup() {
+  Serial.begin(115200);
+
+#if SOC_WIFI_SUPPORTED || CONFIG_ESP_WIFI_REMOTE_ENABLED || LT_ARD_HAS_WIFI
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP("esp-captive");
+#endif
+
+  // To build the image from the data directory of the project, compressing the text files, and write it to the
+  // "spiffs" partition of partitions-4MB.csv (at 3776K), run:
+  // > python3 examples/FlashImage/flash_image.py --gzip html,css,js,json,svg --size 0x40000 data webui.bin
+  // > pio pkg exec -- esptool.py write_flash 0x3b0000 webui.bin
+  //
+  // curl -v http://192.168.4.1/
+  // curl -v -H 'If-None-Match: "<ETag of the previous response>"' http://192.168.4.1/
+  // curl -v -r 0-99 http://192.168.4.1/README.md
+  //
+  AsyncFlashWebHandler &handler = server.serveFlash("/", "spiffs", "max-age=600");
+  Serial.printf("Flash image: %u files\n", (unsigned)handler.count());
+
+  server.begin();
+}
+
+void loop() {
+  delay(100);
+}
+
+#endif
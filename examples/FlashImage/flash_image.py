@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+# Packs the files of a directory into a flash image served by AsyncFlashWebHandler (see WebHandlerImpl.h).
+#
+# usage: flash_image.py [--gzip html,css,js] [--size 0x40000] <directory> <image>
+#
+# A file "x.gz" is served as the gzip-compressed content of "x", in place of "x" if both exist.
+# With --gzip, the files with these extensions are compressed when they get smaller.
+
+import argparse
+import gzip
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = b"AWFI"
+VERSION = 1
+HEADER = 12
+ENTRY = 24
+FLAG_GZIP = 1
+
+
+def collect(directory, extensions):
+    files = {}
+    for root, _, names in os.walk(directory):
+        for name in names:
+            full = os.path.join(root, name)
+            path = "/" + os.path.relpath(full, directory).replace(os.sep, "/")
+            with open(full, "rb") as f:
+                content = f.read()
+            flags = 0
+            if path.endswith(".gz"):
+                path = path[:-3]
+                flags = FLAG_GZIP
+            elif os.path.splitext(path)[1][1:].lower() in extensions:
+                compressed = gzip.compress(content, 9, mtime=0)
+                if len(compressed) < len(content):
+                    content = compressed
+                    flags = FLAG_GZIP
+            if path in files and files[path][1] & FLAG_GZIP and not flags & FLAG_GZIP:
+                continue
+            files[path] = (content, flags)
+    return files
+
+
+def pack(files):
+    paths = sorted(files, key=lambda path: path.encode("utf-8"))
+    offset = HEADER + ENTRY * len(paths)
+    entries = b""
+    names = b""
+    for path in paths:
+        encoded = path.encode("utf-8")
+        entries += struct.pack("<II", offset + len(names), len(encoded))
+        names += encoded
+    offset += len(names)
+
+    contents = b""
+    table = b""
+    for i, path in enumerate(paths):
+        content, flags = files[path]
+        # the contents start on words
+        contents += b"\0" * (-(offset + len(contents)) % 4)
+        start = offset + len(contents)
+        table += entries[i * 8 : i * 8 + 8] + struct.pack("<IIII", start, len(content), zlib.crc32(content), flags)
+        contents += content
+
+    return MAGIC + struct.pack("<II", VERSION, len(paths)) + table + names + contents
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Packs a directory into a flash image for AsyncFlashWebHandler")
+    parser.add_argument("--gzip", default="", help="comma separated extensions of the files to compress, e.g. html,css,js")
+    parser.add_argument("--size", type=lambda value: int(value, 0), help="size of the partition, to check that the image fits")
+    parser.add_argument("directory")
+    parser.add_argument("image")
+    args = parser.parse_args()
+
+    extensions = {extension.strip().lower() for extension in args.gzip.split(",") if extension.strip()}
+    files = collect(args.directory, extensions)
+    image = pack(files)
+    if args.size is not None and len(image) > args.size:
+        sys.exit("the image is %d bytes, larger than the partition (%d bytes)" % (len(image), args.size))
+    with open(args.image, "wb") as f:
+        f.write(image)
+    print("%d files, %d bytes" % (len(files), len(image)))
+
+
+if __name__ == "__main__":
+    main()
@@ -60,6 +60,22 @@ void setup() {
     request->send(response);
   });
 
+  //
+  // curl -v http://192.168.4.1/api
+  //
+  // Headers sent with every response of an API are serialized once and copied as is into each response
+  static AsyncHeaderBlockPtr apiHeaders = AsyncHeaderBlock::create({
+    AsyncWebHeader("Cache-Control", "no-store"),
+    AsyncWebHeader("X-Content-Type-Options", "nosniff"),
+    AsyncWebHeader("X-Frame-Options", "DENY"),
+    AsyncWebHeader("Referrer-Policy", "no-referrer"),
+  });
+  server.on("/api", HTTP_GET, [](AsyncWebServerRequest *request) {
+    AsyncWebServerResponse *response = request->beginResponse(200, "application/json", "{\"status\":\"ok\"}");
+    response->addHeaders(apiHeaders);
+    request->send(response);
+  });
+
   server.begin();
 }
 
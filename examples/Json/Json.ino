@@ -49,6 +49,8 @@ void setup() {
     AsyncJsonResponse *response = new AsyncJsonResponse();
     JsonObject root = response->getRoot().to<JsonObject>();
     root["hello"] = "world";
+    // serialize large documents only once instead of once per chunk
+    response->setBuffered(true);
     response->setLength();
     request->send(response);
   });
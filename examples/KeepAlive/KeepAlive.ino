@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+//
+// Shows how to enable HTTP/1.1 persistent connections (keep-alive)
+//
+
+#include <Arduino.h>
+#if defined(ESP32) || defined(LIBRETINY)
+#include <AsyncTCP.h>
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <ESPAsyncTCP.h>
+#elif defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
+#include <RPAsyncTCP.h>
+#include <WiFi.h>
+#endif
+
+#include <ESPAsyncWebServer.h>
+
+static AsyncWebServer server(80);
+
+void setup() {
+  Serial.begin(115200);
+
+#if SOC_WIFI_SUPPORTED || CONFIG_ESP_WIFI_REMOTE_ENABLED || LT_ARD_HAS_WIFI
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP("esp-captive");
+#endif
+
+  // Keep the connections open between requests:
+  // - a connection idle for more than 10 seconds is closed
+  // - a connection is closed after having served 50 requests
+  server.setKeepAlive(true, 10, 50);
+
+  // curl -v http://192.168.4.1/ http://192.168.4.1/ http://192.168.4.1/
+  // => "Re-using existing connection" is displayed by curl for the second and third requests
+  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    request->send(200, "text/plain", request->keepAlive() ? "Hello, world! (keep-alive)" : "Hello, world! (close)");
+  });
+
+  // curl -v -H "Connection: close" http://192.168.4.1/ http://192.168.4.1/
+  // => the client asked to close the connection: a new connection is opened for the second request
+
+  server.begin();
+}
+
+// not needed
+void loop() {
+  delay(100);
+}
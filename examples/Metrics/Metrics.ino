@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+//
+// Export the request lifecycle metrics and the counters of the server.
+// The library must be built with: -D ASYNCWEBSERVER_METRICS=1
+//
+
+#include <Arduino.h>
+#if defined(ESP32) || defined(LIBRETINY)
+#include <AsyncTCP.h>
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <ESPAsyncTCP.h>
+#elif defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
+#include <RPAsyncTCP.h>
+#include <WiFi.h>
+#endif
+
+#include <ESPAsyncWebServer.h>
+
+static AsyncWebServer server(80);
+
+void setup() {
+  Serial.begin(115200);
+
+#if SOC_WIFI_SUPPORTED || CONFIG_ESP_WIFI_REMOTE_ENABLED || LT_ARD_HAS_WIFI
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP("esp-captive");
+#endif
+
+  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    request->send(200, "text/plain", "Hello, world!");
+  });
+
+#if ASYNCWEBSERVER_METRICS
+  // Prometheus text format:
+  //
+  // curl -v http://192.168.4.1/metrics
+  //
+  // JSON:
+  //
+  // curl -v http://192.168.4.1/metrics?format=json
+  //
+  server.addHandler(new AsyncMetricsHandler("/metrics"));
+#else
+  Serial.println("Metrics are disabled: build with -D ASYNCWEBSERVER_METRICS=1");
+#endif
+
+  server.begin();
+}
+
+// not needed
+void loop() {
+  delay(100);
+}
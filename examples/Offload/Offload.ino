@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+//
+// Shows how to run a slow handler on the worker tasks of the server instead of the AsyncTCP task (ESP32 only)
+//
+
+#include <DNSServer.h>
+#if defined(ESP32) || defined(LIBRETINY)
+#include <AsyncTCP.h>
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <ESPAsyncTCP.h>
+#elif defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
+#include <RPAsyncTCP.h>
+#include <WiFi.h>
+#endif
+
+#include <ESPAsyncWebServer.h>
+
+static AsyncWebServer server(80);
+
+void setup() {
+  Serial.begin(115200);
+
+#if SOC_WIFI_SUPPORTED || CONFIG_ESP_WIFI_REMOTE_ENABLED || LT_ARD_HAS_WIFI
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP("esp-captive");
+#endif
+
+  // Runs inline, on the AsyncTCP task
+  //
+  // curl -v http://192.168.4.1/
+  //
+  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    request->send(200, "text/plain", "Hello");
+  });
+
+#ifdef ESP32
+  // Blocks for 2 seconds on a worker task: the other connections are still served meanwhile.
+  // When all the workers are busy and ASYNCWEBSERVER_WORKER_QUEUE_SIZE requests are waiting, the server answers 503.
+  //
+  // curl -v http://192.168.4.1/slow
+  // for i in $(seq 1 20); do curl -s -o /dev/null -w "%{http_code}\n" http://192.168.4.1/slow & done
+  //
+  server
+    .on(
+      "/slow", HTTP_GET,
+      [](AsyncWebServerRequest *request) {
+        delay(2000);
+        request->send(200, "text/plain", "Done on core " + String(xPortGetCoreID()));
+      }
+    )
+    .offload();
+#endif
+
+  server.begin();
+}
+
+void loop() {
+  delay(100);
+}
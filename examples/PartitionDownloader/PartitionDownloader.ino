@@ -98,24 +98,30 @@ void setup() {
       return;
     }
 
-    AsyncWebServerResponse *response =
-      request->beginChunkedResponse("application/octet-stream", [partition, raw](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+    // The download can be resumed with a Range request:
+    // curl -C - -o spiffs.bin "http://192.168.4.1/partition?label=spiffs"
+    //
+    // The unencrypted content is sent from the mapped partition, without copies
+    AsyncWebServerResponse *response;
+    if (!raw) {
+      response = new AsyncFlashResponse(partition, "application/octet-stream");
+    } else {
+      // the raw content is read at the index given to the callback
+      response = request->beginResponse("application/octet-stream", partition->size, [partition](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
         const size_t remaining = partition->size - index;
         if (!remaining) {
           return 0;
         }
         const size_t len = std::min(maxLen, remaining);
-        if (raw && esp_partition_read_raw(partition, index, buffer, len) == ESP_OK) {
-          return len;
-        }
-        if (!raw && esp_partition_read(partition, index, buffer, len) == ESP_OK) {
+        if (esp_partition_read_raw(partition, index, buffer, len) == ESP_OK) {
           return len;
         }
         return 0;
       });
+    }
 
     response->addHeader("Content-Disposition", "attachment; filename=" + String(partition->label) + ".bin");
-    response->setContentLength(partition->size);
+    response->addHeader(asyncsrv::T_Accept_Ranges, asyncsrv::T_bytes);
 
     request->send(response);
   });
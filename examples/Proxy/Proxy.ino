@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+//
+// Shows how to serve the web servers of several devices behind a single gateway with AsyncProxyHandler.
+// The responses of the devices are relayed while they are received, at the pace of the browser.
+//
+
+#include <Arduino.h>
+#if defined(ESP32) || defined(LIBRETINY)
+#include <AsyncTCP.h>
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <ESPAsyncTCP.h>
+#elif defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
+#include <RPAsyncTCP.h>
+#include <WiFi.h>
+#endif
+
+#include <ESPAsyncWebServer.h>
+
+#define WIFI_SSID     "IoT"
+#define WIFI_PASSWORD ""
+
+static AsyncWebServer server(80);
+
+void setup() {
+  Serial.begin(115200);
+
+#if SOC_WIFI_SUPPORTED || CONFIG_ESP_WIFI_REMOTE_ENABLED || LT_ARD_HAS_WIFI
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+  }
+  Serial.println(WiFi.localIP());
+#endif
+
+  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    request->send(200, "text/html", "<a href=\"/sensor/\">Sensor</a> <a href=\"/relay/\">Relay</a>");
+  });
+
+  // curl -v http://<gateway>/sensor/status => http://192.168.1.50/status
+  server.addHandler(new AsyncProxyHandler("/sensor", "192.168.1.50"));
+
+  // curl -v -X POST -d '{"on":true}' -H 'Content-Type: application/json' http://<gateway>/relay/set => http://192.168.1.51:8080/api/set
+  AsyncProxyHandler *relay = new AsyncProxyHandler("/relay", "192.168.1.51", 8080, "/api");
+  relay->setTimeout(5);
+  server.addHandler(relay);
+
+  server.begin();
+}
+
+void loop() {
+  delay(100);
+}
@@ -21,6 +21,7 @@
 
 static AsyncWebServer server(80);
 static AsyncRateLimitMiddleware rateLimit;
+static AsyncClientRateLimitMiddleware clientRateLimit;
 
 void setup() {
   Serial.begin(115200);
@@ -34,6 +35,13 @@ void setup() {
   rateLimit.setMaxRequests(5);
   rateLimit.setWindowSize(10);
 
+  // each client (remote IP): bursts of 20 requests, then 20 requests per 10 seconds
+  // one client exceeding its rate does not delay the others
+  clientRateLimit.setMaxRequests(20);
+  clientRateLimit.setWindowSize(10);
+  clientRateLimit.setMaxClients(16);
+  server.addMiddleware(&clientRateLimit);
+
   // run quickly several times:
   //
   // curl -v http://192.168.4.1/
@@ -21,6 +21,8 @@
 
 static AsyncWebServer server(80);
 
+static uint8_t data[4096];
+
 void setup() {
   Serial.begin(115200);
 
@@ -53,6 +55,32 @@ void setup() {
     }
   });
 
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = 'A' + i % 26;
+  }
+
+  // File, PROGMEM and static file responses support ranges natively
+  /*
+    ❯ curl -i -r 10-19 http://192.168.4.1/data
+    HTTP/1.1 206 Partial Content
+    Connection: close
+    Accept-Ranges: bytes
+    Content-Range: bytes 10-19/4096
+    Content-Length: 10
+    Content-Type: application/octet-stream
+
+    KLMNOPQRST
+
+    ❯ curl -i -r 0-1,-2 http://192.168.4.1/data
+    => multipart/byteranges response with 2 parts
+
+    ❯ curl -i -r 5000- http://192.168.4.1/data
+    HTTP/1.1 416 Requested Range Not Satisfiable
+  */
+  server.on("/data", HTTP_GET, [](AsyncWebServerRequest *request) {
+    request->send(200, "application/octet-stream", data, sizeof(data));
+  });
+
   server.begin();
 }
 
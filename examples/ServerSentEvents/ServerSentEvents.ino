@@ -73,6 +73,9 @@ void setup() {
   events.onConnect([](AsyncEventSourceClient *client) {
     Serial.printf("SSE Client connected! ID: %" PRIu32 "\n", client->lastId());
     client->send("hello!", NULL, millis(), 1000);
+    // a preformatted message in a constant buffer is queued without any copy
+    static const char welcome[] = "event: welcome\ndata: {\"version\":1}\n\n";
+    client->writeStatic(welcome, sizeof(welcome) - 1);
   });
 
   events.onDisconnect([](AsyncEventSourceClient *client) {
@@ -88,6 +91,7 @@ static uint32_t lastSSE = 0;
 static uint32_t deltaSSE = 3000;
 
 static uint32_t lastHeap = 0;
+static uint32_t lastSample = 0;
 
 void loop() {
   uint32_t now = millis();
@@ -96,6 +100,12 @@ void loop() {
     lastSSE = millis();
   }
 
+  // telemetry: a slow client only gets the latest sample instead of a queue of outdated ones
+  if (now - lastSample >= 100) {
+    events.publish("uptime", String(now).c_str(), "uptime");
+    lastSample = now;
+  }
+
 #ifdef ESP32
   if (now - lastHeap >= 2000) {
     Serial.printf("Free heap: %" PRIu32 "\n", ESP.getFreeHeap());
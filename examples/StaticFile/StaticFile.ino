@@ -169,6 +169,15 @@ void setup() {
   // curl -v http://192.168.4.1/base/b.txt => serves b.txt
   server.serveStatic("/base", LittleFS, "/files").setDefaultFile("a.txt");
 
+  // Example to serve a directory from a cache: the files are only searched once
+  // and the content of the files smaller than 1KB is kept in memory (4KB at most)
+  // curl -v http://192.168.4.1/cached/a.txt
+  server.serveStatic("/cached", LittleFS, "/files").enableCache(4096, 1024);
+
+  // Example to serve the brotli (.br) or gzip (.gz) variant of a file when the client accepts it
+  // curl -v -H "Accept-Encoding: br" http://192.168.4.1/encoded/index2.html
+  server.serveStatic("/encoded", LittleFS, "/").setEncodings("br, gzip");
+
   server.begin();
 }
 
@@ -162,6 +162,31 @@ void setup() {
     }
   );
 
+  //
+  // Upload a raw body into a file, written by whole flash pages:
+  // curl -v -T file.mp3 -H "Content-Type: application/octet-stream" http://192.168.4.1/upload/raw
+  //
+  server.on(
+    "/upload/raw", HTTP_PUT,
+    [](AsyncWebServerRequest *request) {
+      AsyncFileBodySink *sink = request->bodySink();
+      if (!sink) {
+        return request->send(400, "text/plain", "Nothing uploaded");
+      }
+      if (sink->failed()) {
+        return request->send(500, "text/plain", "Write failed");
+      }
+      Serial.printf("Raw upload: %u bytes written\n", sink->written());
+      request->send(201, "text/plain", "Created");
+    },
+    nullptr,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+      if (!index) {
+        request->sinkBody(LittleFS.open("/my_raw_file.bin", "w"));
+      }
+    }
+  );
+
   server.begin();
 }
 
@@ -2,7 +2,7 @@
 // Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
 
 //
-// WebSocket example using the easy to use AsyncWebSocketMessageHandler handler that only supports unfragmented messages
+// WebSocket example using the easy to use AsyncWebSocketMessageHandler handler, which reassembles the fragmented messages
 //
 
 #include <Arduino.h>
@@ -99,9 +99,11 @@ void setup() {
     Serial.printf("Client %" PRIu32 " data: %s\n", client->id(), (const char *)data);
   });
 
-  wsHandler.onFragment([](AsyncWebSocket *server, AsyncWebSocketClient *client, const AwsFrameInfo *frameInfo, const uint8_t *data, size_t len) {
-    Serial.printf("Client %" PRIu32 " fragment %" PRIu32 ": %s\n", client->id(), frameInfo->num, (const char *)data);
-  });
+  // messages received in several pieces are reassembled before being passed to onMessage, up to 8 KB each and 16 KB for all
+  // the clients: a client sending a longer message is disconnected with the close code 1009.
+  // Setting wsHandler.onFragment() passes the pieces as they are received instead.
+  wsHandler.setMaxMessageSize(8 * 1024);
+  wsHandler.setPoolSize(16 * 1024);
 
   server.addHandler(&ws);
   server.begin();
@@ -8,89 +8,97 @@
 
 using namespace asyncsrv;
 
-static String generateEventMessage(const char *message, const char *event, uint32_t id, uint32_t reconnect) {
-  String str;
-  size_t len{0};
-  if (message) {
-    len += strlen(message);
+static size_t decimalLength(uint32_t value) {
+  size_t len = 1;
+  while (value >= 10) {
+    value /= 10;
+    len++;
   }
+  return len;
+}
+
+static inline bool isLineBreak(char c) {
+  return c == '\r' || c == '\n';
+}
 
+// Formats an SSE message into a single allocation, exactly sized by a first scan of the message
+static AsyncEvent_SharedData_t generateEventMessage(const char *message, const char *event, uint32_t id, uint32_t reconnect) {
+  size_t len = 0;
+  if (reconnect) {
+    len += strlen(T_retry_) + decimalLength(reconnect) + 1;
+  }
+  if (id) {
+    len += strlen(T_id__) + decimalLength(id) + 1;
+  }
   if (event) {
-    len += strlen(event);
+    len += strlen(T_event_) + strlen(event) + 1;
   }
 
-  len += 42;  // give it some overhead
+  // each line of the message is sent in its own data field, lines being separated by \r\n, \n or \r
+  size_t messageLen = 0;
+  if (message) {
+    size_t lines = 0;
+    size_t breaks = 0;  // bytes of the line breaks
+    for (; message[messageLen]; messageLen++) {
+      if (isLineBreak(message[messageLen])) {
+        lines++;
+        breaks++;
+        if (message[messageLen] == '\r' && message[messageLen + 1] == '\n') {
+          breaks++;
+          messageLen++;
+        }
+      }
+    }
+    // last line without line break (or empty message)
+    if (!messageLen || !isLineBreak(message[messageLen - 1])) {
+      lines++;
+    }
+    len += lines * (strlen(T_data_) + 1) + messageLen - breaks + 1;
+  }
 
-  if (!str.reserve(len)) {
+  AsyncEvent_SharedData_t str = std::make_shared<String>();
+  if (!str || !str->reserve(len)) {
     async_ws_log_e("Failed to allocate");
-    return emptyString;
+    async_ws_metric_inc(allocFailures);
+    return nullptr;
   }
 
   if (reconnect) {
-    str += T_retry_;
-    str += reconnect;
-    str += ASYNC_SSE_NEW_LINE_CHAR;  // '\n'
+    str->concat(T_retry_);
+    str->concat(reconnect);
+    str->concat(ASYNC_SSE_NEW_LINE_CHAR);  // '\n'
   }
 
   if (id) {
-    str += T_id__;
-    str += id;
-    str += ASYNC_SSE_NEW_LINE_CHAR;  // '\n'
+    str->concat(T_id__);
+    str->concat(id);
+    str->concat(ASYNC_SSE_NEW_LINE_CHAR);  // '\n'
   }
 
   if (event != NULL) {
-    str += T_event_;
-    str += event;
-    str += ASYNC_SSE_NEW_LINE_CHAR;  // '\n'
+    str->concat(T_event_);
+    str->concat(event);
+    str->concat(ASYNC_SSE_NEW_LINE_CHAR);  // '\n'
   }
 
   if (!message) {
     return str;
   }
 
-  size_t messageLen = strlen(message);
-  char *lineStart = (char *)message;
-  char *lineEnd;
+  size_t lineStart = 0;
   do {
-    char *nextN = strchr(lineStart, '\n');
-    char *nextR = strchr(lineStart, '\r');
-    if (nextN == NULL && nextR == NULL) {
-      // a message is a single-line string
-      str += T_data_;
-      str += message;
-      str += T_nn;
-      return str;
-    }
-
-    // a message is a multi-line string
-    char *nextLine = NULL;
-    if (nextN != NULL && nextR != NULL) {  // windows line-ending \r\n
-      if (nextR + 1 == nextN) {
-        // normal \r\n sequence
-        lineEnd = nextR;
-        nextLine = nextN + 1;
-      } else {
-        // some abnormal \n \r mixed sequence
-        lineEnd = std::min(nextR, nextN);
-        nextLine = lineEnd + 1;
-      }
-    } else if (nextN != NULL) {  // Unix/Mac OS X LF
-      lineEnd = nextN;
-      nextLine = nextN + 1;
-    } else {  // some ancient garbage
-      lineEnd = nextR;
-      nextLine = nextR + 1;
+    size_t lineEnd = lineStart;
+    while (lineEnd < messageLen && !isLineBreak(message[lineEnd])) {
+      lineEnd++;
     }
-
-    str += T_data_;
-    str.concat(lineStart, lineEnd - lineStart);
-    str += ASYNC_SSE_NEW_LINE_CHAR;  // \n
-
-    lineStart = nextLine;
-  } while (lineStart < ((char *)message + messageLen));
+    str->concat(T_data_);
+    str->concat(message + lineStart, lineEnd - lineStart);
+    str->concat(ASYNC_SSE_NEW_LINE_CHAR);  // '\n'
+    lineStart = lineEnd + (message[lineEnd] == '\r' && message[lineEnd + 1] == '\n' ? 2 : 1);
+  } while (lineStart < messageLen);
 
   // append another \n to terminate message
-  str += ASYNC_SSE_NEW_LINE_CHAR;  // '\n'
+  str->concat(ASYNC_SSE_NEW_LINE_CHAR);  // '\n'
 
   return str;
 }
@@ -99,10 +107,10 @@ static String generateEventMessage(const char *message, const char *event, uint3
 
 size_t AsyncEventSourceMessage::ack(size_t len, __attribute__((unused)) uint32_t time) {
   // If the whole message is now acked...
-  if (_acked + len > _data->length()) {
+  if (_acked + len > _len) {
     // Return the number of extra bytes acked (they will be carried on to the next message)
-    const size_t extra = _acked + len - _data->length();
-    _acked = _data->length();
+    const size_t extra = _acked + len - _len;
+    _acked = _len;
     return extra;
   }
   // Return that no extra bytes left.
@@ -115,11 +123,11 @@ size_t AsyncEventSourceMessage::write(AsyncClient *client) {
     return 0;
   }
 
-  if (_sent >= _data->length() || !client->canSend()) {
+  if (_sent >= _len || !client->canSend()) {
     return 0;
   }
 
-  size_t len = std::min(_data->length() - _sent, client->space());
+  size_t len = std::min(_len - _sent, client->space());
   /*
     add() would call lwip's tcp_write() under the AsyncTCP hood with apiflags argument.
     By default apiflags=ASYNC_WRITE_FLAG_COPY
@@ -131,7 +139,7 @@ size_t AsyncEventSourceMessage::write(AsyncClient *client) {
 
     So let's just keep it enforced ASYNC_WRITE_FLAG_COPY and keep in mind that there is no zero-copy
   */
-  size_t written = client->add(_data->c_str() + _sent, len, ASYNC_WRITE_FLAG_COPY);  //  ASYNC_WRITE_FLAG_MORE
+  size_t written = client->add(_buf + _sent, len, ASYNC_WRITE_FLAG_COPY);  //  ASYNC_WRITE_FLAG_MORE
   _sent += written;
   return written;
 }
@@ -141,6 +149,12 @@ size_t AsyncEventSourceMessage::send(AsyncClient *client) {
   return sent && client->send() ? sent : 0;
 }
 
+size_t AsyncEventSourceMessage::advance(size_t len) {
+  const size_t n = std::min(len, _len - _sent);
+  _sent += n;
+  return len - n;
+}
+
 // Client
 
 AsyncEventSourceClient::AsyncEventSourceClient(AsyncWebServerRequest *request, AsyncEventSource *server) : _client(request->client()), _server(server) {
@@ -187,99 +201,127 @@ AsyncEventSourceClient::AsyncEventSourceClient(AsyncWebServerRequest *request, A
 }
 
 AsyncEventSourceClient::~AsyncEventSourceClient() {
-#ifdef ESP32
-  std::lock_guard<std::recursive_mutex> lock(_lockmq);
-#endif
-  _messageQueue.clear();
   close();
 }
 
 bool AsyncEventSourceClient::_queueMessage(const char *message, size_t len) {
-  if (_messageQueue.size() >= SSE_MAX_QUEUED_MESSAGES) {
-    async_ws_log_e("Event message queue overflow: discard message");
-    return false;
-  }
-
-#ifdef ESP32
-  // length() is not thread-safe, thus acquiring the lock before this call..
-  std::lock_guard<std::recursive_mutex> lock(_lockmq);
-#endif
-
-  _messageQueue.emplace_back(message, len);
-
-  /*
-    throttle queue run
-    if Q is filled for >25% then network/CPU is congested, since there is no zero-copy mode for socket buff
-    forcing Q run will only eat more heap ram and blow the buffer, let's just keep data in our own queue
-    the queue will be processed at least on each onAck()/onPoll() call from AsyncTCP
-  */
-  if (_messageQueue.size() < SSE_MAX_QUEUED_MESSAGES >> 2 && _client->canSend()) {
-    _runQueue();
-  }
-
-  return true;
+  return _queueMessage(AsyncEventSourceMessage(message, len));
 }
 
-bool AsyncEventSourceClient::_queueMessage(AsyncEvent_SharedData_t &&msg) {
-  if (_messageQueue.size() >= SSE_MAX_QUEUED_MESSAGES) {
-    async_ws_log_e("Event message queue overflow: discard message");
+bool AsyncEventSourceClient::_queueMessage(AsyncEvent_SharedData_t &&msg, uint16_t channel) {
+  if (!msg) {
     return false;
   }
+  return _queueMessage(AsyncEventSourceMessage(std::move(msg)), channel);
+}
 
+bool AsyncEventSourceClient::_queueMessage(AsyncEventSourceMessage &&msg, uint16_t channel) {
+  if (channel && _replaceMessage(msg, channel)) {
+    _events.fetch_add(1, std::memory_order_release);
+    // the drain may have stopped at the message while it was replaced
+    if (_client && _client->canSend()) {
+      _drain();
+    }
+    return true;
+  }
+  {
 #ifdef ESP32
-  // length() is not thread-safe, thus acquiring the lock before this call..
-  std::lock_guard<std::recursive_mutex> lock(_lockmq);
+    // producers only wait for each other, never for the drain
+    std::lock_guard<std::mutex> lock(_lockmq);
 #endif
-
-  _messageQueue.emplace_back(std::move(msg));
+    const uint32_t tail = _tail.load(std::memory_order_relaxed);
+    const size_t maxBytes = _maxQueuedBytes.load(std::memory_order_relaxed);
+    const size_t queued = _queuedBytes.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) >= SSE_MAX_QUEUED_MESSAGES || (maxBytes && queued && queued + msg.length() > maxBytes)) {
+      async_ws_log_e("Event message queue overflow: discard message");
+      async_ws_metric_inc(sseDropped);
+      return false;
+    }
+    _queuedBytes.fetch_add(msg.length(), std::memory_order_relaxed);
+    // this slot is not used by the drain until the new tail is published
+    const uint32_t slot = tail % SSE_MAX_QUEUED_MESSAGES;
+    _ring[slot] = std::move(msg);
+    _channels[slot] = channel;
+    _claims[slot].store(0, std::memory_order_relaxed);
+    _tail.store(tail + 1, std::memory_order_release);
+  }
+  _events.fetch_add(1, std::memory_order_release);
 
   /*
     throttle queue run
     if Q is filled for >25% then network/CPU is congested, since there is no zero-copy mode for socket buff
     forcing Q run will only eat more heap ram and blow the buffer, let's just keep data in our own queue
     the queue will be processed at least on each onAck()/onPoll() call from AsyncTCP
+    in coalescing mode, a message queued behind others waits for the next ack, to be packed with them
   */
-  if (_messageQueue.size() < SSE_MAX_QUEUED_MESSAGES >> 2 && _client->canSend()) {
-    _runQueue();
+  const size_t waiting = packetsWaiting();
+  if ((coalescing() ? waiting == 1 : waiting < SSE_MAX_QUEUED_MESSAGES >> 2) && _client && _client->canSend()) {
+    _drain();
   }
   return true;
 }
 
-void AsyncEventSourceClient::_onAck(size_t len __attribute__((unused)), uint32_t time __attribute__((unused))) {
+// Replaces the last message of the channel if the drain did not claim it yet
+bool AsyncEventSourceClient::_replaceMessage(AsyncEventSourceMessage &msg, uint16_t channel) {
 #ifdef ESP32
-  // Same here, acquiring the lock early
-  std::lock_guard<std::recursive_mutex> lock(_lockmq);
+  std::lock_guard<std::mutex> lock(_lockmq);
 #endif
+  const uint32_t tail = _tail.load(std::memory_order_relaxed);
+  const uint32_t head = _head.load(std::memory_order_acquire);
+  for (uint32_t i = tail; i != head;) {
+    --i;
+    const uint32_t slot = i % SSE_MAX_QUEUED_MESSAGES;
+    if (_channels[slot] != channel) {
+      continue;
+    }
+    uint8_t state = 0;
+    if (!_claims[slot].compare_exchange_strong(state, 2, std::memory_order_acquire)) {
+      // being sent: the new value is queued after it
+      return false;
+    }
+    AsyncEventSourceMessage &message = _ring[slot];
+    _queuedBytes.fetch_sub(message.length(), std::memory_order_relaxed);
+    _queuedBytes.fetch_add(msg.length(), std::memory_order_relaxed);
+    message = std::move(msg);
+    _claims[slot].store(0, std::memory_order_release);
+    return true;
+  }
+  return false;
+}
 
-  // adjust in-flight len
-  if (len < _inflight) {
-    _inflight -= len;
-  } else {
-    _inflight = 0;
+// Runs with _draining set: a message of a channel must be claimed before being used
+bool AsyncEventSourceClient::_claim(uint32_t i) {
+  const uint32_t slot = i % SSE_MAX_QUEUED_MESSAGES;
+  if (!_channels[slot]) {
+    return true;
   }
+  uint8_t state = 0;
+  return _claims[slot].compare_exchange_strong(state, 1, std::memory_order_acquire) || state == 1;
+}
 
-  // acknowledge as much messages's data as we got confirmed len from a AsyncTCP
-  while (len && _messageQueue.size()) {
-    len = _messageQueue.front().ack(len);
-    if (_messageQueue.front().finished()) {
-      // now we could release full ack'ed messages, we were keeping it unless send confirmed from AsyncTCP
-      _messageQueue.pop_front();
+void AsyncEventSourceClient::_drain() {
+  uint32_t events;
+  do {
+    if (_draining.exchange(1, std::memory_order_acquire)) {
+      // the running drain will see the new events
+      return;
     }
-  }
-
-  // try to send another batch of data
-  if (_messageQueue.size()) {
+    events = _events.load(std::memory_order_acquire);
     _runQueue();
-  }
+    _draining.store(0, std::memory_order_release);
+    // a message queued or an ack received after the drain looked for them, while another task was leaving its work to it
+  } while (_events.load(std::memory_order_acquire) != events);
+}
+
+void AsyncEventSourceClient::_onAck(size_t len, uint32_t time __attribute__((unused))) {
+  _acks.fetch_add(len, std::memory_order_relaxed);
+  _events.fetch_add(1, std::memory_order_release);
+  _drain();
 }
 
 void AsyncEventSourceClient::_onPoll() {
-  if (_messageQueue.size()) {
-#ifdef ESP32
-    // Same here, acquiring the lock early
-    std::lock_guard<std::recursive_mutex> lock(_lockmq);
-#endif
-    _runQueue();
+  if (packetsWaiting()) {
+    _drain();
   }
 }
 
@@ -293,6 +335,12 @@ void AsyncEventSourceClient::_onDisconnect() {
   if (!_client) {
     return;
   }
+#ifdef ESP32
+  // wait for a drain running in a producer task, and prevent any new one: the AsyncClient is deleted after this call
+  while (_draining.exchange(1, std::memory_order_acquire)) {
+    delay(1);
+  }
+#endif
   _client = nullptr;
   _server->_handleDisconnect(this);
 }
@@ -307,25 +355,86 @@ bool AsyncEventSourceClient::send(const char *message, const char *event, uint32
   if (!connected()) {
     return false;
   }
-  return _queueMessage(std::make_shared<String>(generateEventMessage(message, event, id, reconnect)));
+  return _queueMessage(generateEventMessage(message, event, id, reconnect));
+}
+
+bool AsyncEventSourceClient::publish(const char *channel, const char *message, const char *event, uint32_t id) {
+  if (!connected()) {
+    return false;
+  }
+  return _queueMessage(generateEventMessage(message, event, id, 0), _server->_getChannelId(channel));
 }
 
+// Runs with _draining set: the only place where the messages between _head and _tail are used
 void AsyncEventSourceClient::_runQueue() {
+  // adjust in-flight len
+  size_t len = _acks.exchange(0, std::memory_order_relaxed);
+  if (len < _inflight) {
+    _inflight -= len;
+  } else {
+    _inflight = 0;
+  }
+
+  // acknowledge as much messages's data as we got confirmed len from a AsyncTCP
+  const uint32_t tail = _tail.load(std::memory_order_acquire);
+  uint32_t head = _head.load(std::memory_order_relaxed);
+  while (head != tail) {
+    const uint32_t slot = head % SSE_MAX_QUEUED_MESSAGES;
+    if (_channels[slot] && _claims[slot].load(std::memory_order_acquire) != 1) {
+      // not claimed, hence not sent yet, and may be being replaced
+      break;
+    }
+    AsyncEventSourceMessage &message = _ring[slot];
+    len = message.ack(len);
+    if (!message.finished()) {
+      break;
+    }
+    // now we could release full ack'ed messages, we were keeping it unless send confirmed from AsyncTCP
+    _queuedBytes.fetch_sub(message.length(), std::memory_order_relaxed);
+    message = AsyncEventSourceMessage();
+    ++head;
+  }
+  _head.store(head, std::memory_order_release);
+  if ((int32_t)(head - _next) > 0) {
+    // empty messages are acked without being sent
+    _next = head;
+  }
+
   if (!_client) {
     return;
   }
 
-  // there is no need to lock the mutex here, 'cause all the calls to this method must be already lock'ed
+  if (!_packBuf && coalescing()) {
+    _packSize = _client->getMss();
+    _packBuf.reset(new (std::nothrow) char[_packSize]);
+    if (!_packBuf) {
+      async_ws_log_e("Failed to allocate");
+      async_ws_metric_inc(allocFailures);
+      // the messages are written one by one
+      _packSize = 0;
+    }
+  }
+  const bool packing = _packBuf && coalescing();
+
   size_t total_bytes_written = 0;
-  for (auto i = _messageQueue.begin(); i != _messageQueue.end(); ++i) {
-    if (!i->sent()) {
-      const size_t bytes_written = i->write(_client);
-      total_bytes_written += bytes_written;
-      _inflight += bytes_written;
-      if (bytes_written == 0 || _inflight > _max_inflight) {
-        // Serial.print("_");
+  while (_next != tail) {
+    size_t bytes_written = packing ? _writePacked(tail) : 0;
+    if (!bytes_written) {
+      if (!_claim(_next)) {
+        // being replaced: the producer runs the drain again
         break;
       }
+      AsyncEventSourceMessage &message = _ring[_next % SSE_MAX_QUEUED_MESSAGES];
+      bytes_written = message.write(_client);
+      if (message.sent()) {
+        ++_next;
+      }
+    }
+    total_bytes_written += bytes_written;
+    _inflight += bytes_written;
+    if (bytes_written == 0 || _inflight > _max_inflight) {
+      // Serial.print("_");
+      break;
     }
   }
 
@@ -335,6 +444,48 @@ void AsyncEventSourceClient::_runQueue() {
   }
 }
 
+// Writes the consecutive messages fitting whole in one segment with a single add(), returns 0 if less than two of them fit
+size_t AsyncEventSourceClient::_writePacked(uint32_t tail) {
+  const size_t room = std::min(_client->space(), _packSize);
+  size_t packed = 0;
+  uint32_t end = _next;
+  for (; end != tail; ++end) {
+    if (!_claim(end)) {
+      break;
+    }
+    const size_t len = _ring[end % SSE_MAX_QUEUED_MESSAGES].remaining();
+    if (len > room - packed) {
+      break;
+    }
+    packed += len;
+  }
+  if (end - _next < 2 || !packed || !_client->canSend()) {
+    return 0;
+  }
+
+  packed = 0;
+  for (uint32_t i = _next; i != end; ++i) {
+    const AsyncEventSourceMessage &message = _ring[i % SSE_MAX_QUEUED_MESSAGES];
+    memcpy(_packBuf.get() + packed, message.pending(), message.remaining());
+    packed += message.remaining();
+  }
+
+  const size_t written = _client->add(_packBuf.get(), packed, ASYNC_WRITE_FLAG_COPY);
+  size_t left = written;
+  for (; _next != end; ++_next) {
+    AsyncEventSourceMessage &message = _ring[_next % SSE_MAX_QUEUED_MESSAGES];
+    left = message.advance(left);
+    if (!message.sent()) {
+      break;
+    }
+  }
+  return written;
+}
+
+void AsyncEventSourceClient::setCoalescing(size_t maxQueuedBytes) {
+  _maxQueuedBytes.store(maxQueuedBytes, std::memory_order_relaxed);
+}
+
 void AsyncEventSourceClient::set_max_inflight_bytes(size_t value) {
   if (value >= SSE_MIN_INFLIGH && value <= SSE_MAX_INFLIGH) {
     _max_inflight = value;
@@ -357,6 +508,9 @@ void AsyncEventSource::_addClient(AsyncEventSourceClient *client) {
   std::lock_guard<std::recursive_mutex> lock(_client_queue_lock);
 #endif
   _clients.emplace_back(client);
+  if (_maxQueuedBytes) {
+    client->setCoalescing(_maxQueuedBytes);
+  }
   if (_connectcb) {
     _connectcb(client);
   }
@@ -399,6 +553,36 @@ void AsyncEventSource::close() {
   }
 }
 
+uint16_t AsyncEventSource::_getChannelId(const char *channel) {
+  if (!channel || !*channel) {
+    return 0;
+  }
+#ifdef ESP32
+  std::lock_guard<std::recursive_mutex> lock(_client_queue_lock);
+#endif
+  for (size_t i = 0; i < _channels.size(); i++) {
+    if (_channels[i] == channel) {
+      return i + 1;
+    }
+  }
+  if (_channels.size() >= ASYNCWEBSERVER_MAX_CHANNELS) {
+    async_ws_log_w("Too many channels: the message is not conflated");
+    return 0;
+  }
+  _channels.emplace_back(channel);
+  return _channels.size();
+}
+
+void AsyncEventSource::setCoalescing(size_t maxQueuedBytes) {
+#ifdef ESP32
+  std::lock_guard<std::recursive_mutex> lock(_client_queue_lock);
+#endif
+  _maxQueuedBytes = maxQueuedBytes;
+  for (const auto &c : _clients) {
+    c->setCoalescing(maxQueuedBytes);
+  }
+}
+
 // pmb fix
 size_t AsyncEventSource::avgPacketsWaiting() const {
   size_t aql = 0;
@@ -420,7 +604,13 @@ size_t AsyncEventSource::avgPacketsWaiting() const {
 }
 
 AsyncEventSource::SendStatus AsyncEventSource::send(const char *message, const char *event, uint32_t id, uint32_t reconnect) {
-  AsyncEvent_SharedData_t shared_msg = std::make_shared<String>(generateEventMessage(message, event, id, reconnect));
+  return write(generateEventMessage(message, event, id, reconnect));
+}
+
+AsyncEventSource::SendStatus AsyncEventSource::write(AsyncEvent_SharedData_t shared_msg) {
+  if (!shared_msg) {
+    return DISCARDED;
+  }
 #ifdef ESP32
   std::lock_guard<std::recursive_mutex> lock(_client_queue_lock);
 #endif
@@ -436,6 +626,43 @@ AsyncEventSource::SendStatus AsyncEventSource::send(const char *message, const c
   return hits == 0 ? DISCARDED : (miss == 0 ? ENQUEUED : PARTIALLY_ENQUEUED);
 }
 
+AsyncEventSource::SendStatus AsyncEventSource::writeStatic(const char *message, size_t len) {
+#ifdef ESP32
+  std::lock_guard<std::recursive_mutex> lock(_client_queue_lock);
+#endif
+  size_t hits = 0;
+  size_t miss = 0;
+  for (const auto &c : _clients) {
+    if (c->writeStatic(message, len)) {
+      ++hits;
+    } else {
+      ++miss;
+    }
+  }
+  return hits == 0 ? DISCARDED : (miss == 0 ? ENQUEUED : PARTIALLY_ENQUEUED);
+}
+
+AsyncEventSource::SendStatus AsyncEventSource::publish(const char *channel, const char *message, const char *event, uint32_t id) {
+  AsyncEvent_SharedData_t shared_msg = generateEventMessage(message, event, id, 0);
+  if (!shared_msg) {
+    return DISCARDED;
+  }
+  const uint16_t channelId = _getChannelId(channel);
+#ifdef ESP32
+  std::lock_guard<std::recursive_mutex> lock(_client_queue_lock);
+#endif
+  size_t hits = 0;
+  size_t miss = 0;
+  for (const auto &c : _clients) {
+    if (c->connected() && c->_queueMessage(AsyncEvent_SharedData_t(shared_msg), channelId)) {
+      ++hits;
+    } else {
+      ++miss;
+    }
+  }
+  return hits == 0 ? DISCARDED : (miss == 0 ? ENQUEUED : PARTIALLY_ENQUEUED);
+}
+
 size_t AsyncEventSource::count() const {
 #ifdef ESP32
   std::lock_guard<std::recursive_mutex> lock(_client_queue_lock);
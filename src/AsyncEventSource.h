@@ -17,6 +17,9 @@
 #ifndef SSE_MAX_QUEUED_MESSAGES
 #define SSE_MAX_QUEUED_MESSAGES 32
 #endif
+#ifndef SSE_MAX_QUEUED_BYTES
+#define SSE_MAX_QUEUED_BYTES 16384
+#endif
 #define SSE_MIN_INFLIGH 2 * 1460   // allow 2 MSS packets
 #define SSE_MAX_INFLIGH 16 * 1024  // but no more than 16k, no need to blow it, since same data is kept in local Q
 #elif defined(ESP8266)
@@ -24,6 +27,9 @@
 #ifndef SSE_MAX_QUEUED_MESSAGES
 #define SSE_MAX_QUEUED_MESSAGES 8
 #endif
+#ifndef SSE_MAX_QUEUED_BYTES
+#define SSE_MAX_QUEUED_BYTES 4096
+#endif
 #define SSE_MIN_INFLIGH 2 * 1460  // allow 2 MSS packets
 #define SSE_MAX_INFLIGH 8 * 1024  // but no more than 8k, no need to blow it, since same data is kept in local Q
 #elif defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
@@ -31,12 +37,17 @@
 #ifndef SSE_MAX_QUEUED_MESSAGES
 #define SSE_MAX_QUEUED_MESSAGES 32
 #endif
+#ifndef SSE_MAX_QUEUED_BYTES
+#define SSE_MAX_QUEUED_BYTES 16384
+#endif
 #define SSE_MIN_INFLIGH 2 * 1460   // allow 2 MSS packets
 #define SSE_MAX_INFLIGH 16 * 1024  // but no more than 16k, no need to blow it, since same data is kept in local Q
 #endif
 
 #include <ESPAsyncWebServer.h>
 
+#include <atomic>
+
 #ifdef ESP8266
 #include <Hash.h>
 #ifdef CRYPTO_HASH_h  // include Hash.h from espressif framework if the first include was from the crypto library
@@ -52,6 +63,51 @@ using ArAuthorizeConnectHandler = ArAuthorizeFunction;
 // shared message object container
 using AsyncEvent_SharedData_t = std::shared_ptr<String>;
 
+#ifdef ESP32
+template <typename T> using AsyncEventSourceAtomic = std::atomic<T>;
+#else
+/**
+ * @brief Plain value providing the part of the std::atomic interface used by the clients,
+ * the clients being only accessed from a single task on these platforms
+ */
+template <typename T> class AsyncEventSourceAtomic {
+private:
+  T _value;
+
+public:
+  AsyncEventSourceAtomic(T value = T()) : _value(value) {}
+  T load(std::memory_order = std::memory_order_seq_cst) const {
+    return _value;
+  }
+  void store(T value, std::memory_order = std::memory_order_seq_cst) {
+    _value = value;
+  }
+  T exchange(T value, std::memory_order = std::memory_order_seq_cst) {
+    T old = _value;
+    _value = value;
+    return old;
+  }
+  T fetch_add(T value, std::memory_order = std::memory_order_seq_cst) {
+    T old = _value;
+    _value += value;
+    return old;
+  }
+  T fetch_sub(T value, std::memory_order = std::memory_order_seq_cst) {
+    T old = _value;
+    _value -= value;
+    return old;
+  }
+  bool compare_exchange_strong(T &expected, T desired, std::memory_order = std::memory_order_seq_cst) {
+    if (_value != expected) {
+      expected = _value;
+      return false;
+    }
+    _value = desired;
+    return true;
+  }
+};
+#endif
+
 /**
  * @brief Async Event Message container with shared message content data
  *
@@ -59,26 +115,35 @@ using AsyncEvent_SharedData_t = std::shared_ptr<String>;
 class AsyncEventSourceMessage {
 
 private:
-  const AsyncEvent_SharedData_t _data;
+  AsyncEvent_SharedData_t _data;  // empty for a static message
+  const char *_buf{nullptr};
+  size_t _len{0};
   size_t _sent{0};   // num of bytes already sent
   size_t _acked{0};  // num of bytes acked
 
 public:
-  AsyncEventSourceMessage(AsyncEvent_SharedData_t data) : _data(data){};
+  // tag of the constructor queuing a static buffer without copying it
+  struct StaticData {};
+
+  AsyncEventSourceMessage() = default;
+  AsyncEventSourceMessage(AsyncEvent_SharedData_t data) : _data(data), _buf(data ? data->c_str() : nullptr), _len(data ? data->length() : 0){};
 #if defined(ESP32)
-  AsyncEventSourceMessage(const char *data, size_t len) : _data(std::make_shared<String>(data, len)){};
-#elif defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
+  AsyncEventSourceMessage(const char *data, size_t len) : AsyncEventSourceMessage(std::make_shared<String>(data, len)){};
+#else
+  // esp8266's String does not have constructor with data/length arguments. Use a concat method here
   AsyncEventSourceMessage(const char *data, size_t len) : _data(std::make_shared<String>()) {
     if (data && len > 0) {
       _data->concat(data, len);
     }
-  };
-#else
-  // esp8266's String does not have constructor with data/length arguments. Use a concat method here
-  AsyncEventSourceMessage(const char *data, size_t len) {
-    _data->concat(data, len);
+    _buf = _data->c_str();
+    _len = _data->length();
   };
 #endif
+  /**
+     * @brief message referring to a buffer which is not copied: the buffer must stay valid and unchanged until the message is delivered
+     * @note on ESP8266, the buffer must be in RAM (not PROGMEM)
+     */
+  AsyncEventSourceMessage(StaticData, const char *data, size_t len) : _buf(data), _len(data ? len : 0){};
 
   /**
      * @brief acknowledge sending len bytes of data
@@ -107,9 +172,28 @@ public:
      */
   size_t send(AsyncClient *client);
 
+  /**
+     * @brief records len bytes of the message written to the client's buffer by someone else, from pending()
+     *
+     * @param len bytes written
+     * @return size_t number of bytes exceeding the rest of the message, carried over to the next one
+     */
+  size_t advance(size_t len);
+
+  // data not sent yet
+  const char *pending() const {
+    return _buf + _sent;
+  }
+  size_t remaining() const {
+    return _len - _sent;
+  }
+  size_t length() const {
+    return _len;
+  }
+
   // returns true if full message's length were acked
   bool finished() {
-    return _acked == _data->length();
+    return _acked == _len;
   }
 
   /**
@@ -117,13 +201,20 @@ public:
      *
      */
   bool sent() {
-    return _sent == _data->length();
+    return _sent == _len;
   }
 };
 
 /**
  * @brief class holds a sse messages queue for a particular client's connection
  *
+ * The queue is a ring of messages: producers (the application tasks) append messages at its tail,
+ * the drain sends them from the next unsent one and releases them from the head when they are acked.
+ * The drain is run by the AsyncTCP task (on ack and poll) or by a producer finding the connection idle, one at a time:
+ * a task finding the drain busy leaves its work to the running one instead of waiting for it.
+ * Producers therefore never wait for the network, and the AsyncTCP task never waits for the producers.
+ *
+ * A message of a conflating channel can be replaced by a producer until the drain claims it, just before writing it.
  */
 class AsyncEventSourceClient {
 private:
@@ -132,13 +223,32 @@ private:
   uint32_t _lastId{0};
   size_t _inflight{0};                    // num of unacknowledged bytes that has been written to socket buffer
   size_t _max_inflight{SSE_MAX_INFLIGH};  // max num of unacknowledged bytes that could be written to socket buffer
-  std::list<AsyncEventSourceMessage> _messageQueue;
+  AsyncEventSourceMessage _ring[SSE_MAX_QUEUED_MESSAGES];
+  AsyncEventSourceAtomic<uint32_t> _head{0};      // oldest message not acked yet, written by the drain
+  AsyncEventSourceAtomic<uint32_t> _tail{0};      // next message to queue, written by the producers
+  uint32_t _next{0};                              // next message to send, owned by the drain
+  AsyncEventSourceAtomic<size_t> _acks{0};        // bytes acked by AsyncTCP, not handled by the drain yet
+  AsyncEventSourceAtomic<uint32_t> _events{0};    // incremented on each new message or ack, so that the drain notices them
+  AsyncEventSourceAtomic<uint32_t> _draining{0};  // a drain is running
+  AsyncEventSourceAtomic<size_t> _queuedBytes{0};
+  AsyncEventSourceAtomic<size_t> _maxQueuedBytes{0};  // non-zero in coalescing mode
+  std::unique_ptr<char[]> _packBuf;                    // segment packing the small messages, owned by the drain
+  size_t _packSize{0};
+  uint16_t _channels[SSE_MAX_QUEUED_MESSAGES]{};                   // conflating channel of each message, 0 for none
+  AsyncEventSourceAtomic<uint8_t> _claims[SSE_MAX_QUEUED_MESSAGES]{};  // for the channel messages: 0 waiting, 1 claimed by the drain, 2 being replaced
 #ifdef ESP32
-  mutable std::recursive_mutex _lockmq;
+  std::mutex _lockmq;  // between producers only
 #endif
   bool _queueMessage(const char *message, size_t len);
-  bool _queueMessage(AsyncEvent_SharedData_t &&msg);
+  bool _queueMessage(AsyncEvent_SharedData_t &&msg, uint16_t channel = 0);
+  bool _queueMessage(AsyncEventSourceMessage &&msg, uint16_t channel = 0);
+  bool _replaceMessage(AsyncEventSourceMessage &msg, uint16_t channel);
+  bool _claim(uint32_t slot);
+  void _drain();
   void _runQueue();
+  size_t _writePacked(uint32_t tail);
+
+  friend class AsyncEventSource;
 
 public:
   AsyncEventSourceClient(AsyncWebServerRequest *request, AsyncEventSource *server);
@@ -163,6 +273,22 @@ public:
     return send(message.c_str(), event, id, reconnect);
   }
 
+  /**
+     * @brief Send the latest value of a conflating channel, such as "temperature"
+     * the message replaces the value of the same channel still waiting in the queue, if any,
+     * so that a slow client gets the latest state without filling its queue with outdated values.
+     * A value already being sent is not replaced: the new one is queued after it.
+     * Beyond ASYNCWEBSERVER_MAX_CHANNELS names, the messages of a new channel are queued like send() ones.
+     *
+     * @param channel name of the channel
+     * @param message body string, see send()
+     * @param event body string, a single line string
+     * @param id sequence id
+     * @return true if message was placed in a queue or replaced the waiting one
+     * @return false if queue is full
+     */
+  bool publish(const char *channel, const char *message, const char *event = NULL, uint32_t id = 0);
+
   /**
      * @brief place supplied preformatted SSE message to the message queue
      * @note message must a properly formatted SSE string according to https://developer.mozilla.org/en-US/docs/Web/API/Server-sent_events/Using_server-sent_events
@@ -175,6 +301,19 @@ public:
     return connected() && _queueMessage(std::move(message));
   };
 
+  /**
+     * @brief place a preformatted SSE message to the message queue without copying it
+     * @note the message must stay valid and unchanged until delivered: string literal, const array... (in RAM on ESP8266)
+     *
+     * @param message data
+     * @param len length of the message
+     * @return true on success
+     * @return false on queue overflow or no client connected
+     */
+  bool writeStatic(const char *message, size_t len) {
+    return connected() && _queueMessage(AsyncEventSourceMessage(AsyncEventSourceMessage::StaticData(), message, len));
+  };
+
   [[deprecated("Use _write(AsyncEvent_SharedData_t message) instead to share same data with multiple SSE clients")]]
   bool write(const char *message, size_t len) {
     return connected() && _queueMessage(message, len);
@@ -195,7 +334,8 @@ public:
     return _lastId;
   }
   size_t packetsWaiting() const {
-    return _messageQueue.size();
+    const uint32_t head = _head.load(std::memory_order_acquire);
+    return _tail.load(std::memory_order_acquire) - head;
   };
 
   /**
@@ -216,6 +356,23 @@ public:
     return _max_inflight;
   }
 
+  /**
+     * @brief Coalescing mode: consecutive small messages are packed in a single segment of up to the MSS, written with one add(),
+     * a message queued while others are in flight waits for the next ack to be sent with them,
+     * and the queue is limited by the bytes it holds instead of its number of messages.
+     * The queue cannot hold more than SSE_MAX_QUEUED_MESSAGES messages in any case.
+     *
+     * @param maxQueuedBytes limit of the queue in bytes, 0 to disable (default)
+     */
+  void setCoalescing(size_t maxQueuedBytes = SSE_MAX_QUEUED_BYTES);
+  bool coalescing() const {
+    return _maxQueuedBytes.load(std::memory_order_relaxed) != 0;
+  }
+  // bytes of the messages waiting in the queue, sent or not, until they are acked
+  size_t bytesWaiting() const {
+    return _queuedBytes.load(std::memory_order_relaxed);
+  }
+
   // system callbacks (do not call if from user code!)
   void _onAck(size_t len, uint32_t time);
   void _onPoll();
@@ -239,6 +396,8 @@ private:
 #endif
   ArEventHandlerFunction _connectcb = nullptr;
   ArEventHandlerFunction _disconnectcb = nullptr;
+  size_t _maxQueuedBytes = 0;
+  std::vector<String> _channels;  // names of the conflating channels, their id being their index + 1
 
   // this method manipulates in-fligh data size for connected client depending on number of active connections
   void _adjust_inflight_window();
@@ -290,6 +449,34 @@ public:
     return send(message.c_str(), event, id, reconnect);
   }
 
+  /**
+     * @brief place supplied preformatted SSE message to all connected client's message queues, sharing the same data
+     * @note message must a properly formatted SSE string, see AsyncEventSourceClient::write()
+     *
+     * @param message data
+     * @return SendStatus if message was placed in any/all/part of the client's queues
+     */
+  SendStatus write(AsyncEvent_SharedData_t message);
+  /**
+     * @brief place a preformatted SSE message to all connected client's message queues without copying it, see AsyncEventSourceClient::writeStatic()
+     *
+     * @param message data, which must stay valid and unchanged until delivered
+     * @param len length of the message
+     * @return SendStatus if message was placed in any/all/part of the client's queues
+     */
+  SendStatus writeStatic(const char *message, size_t len);
+
+  /**
+     * @brief send the latest value of a conflating channel to all connected clients, see AsyncEventSourceClient::publish()
+     *
+     * @param channel name of the channel
+     * @param message body string
+     * @param event body string, a single line string
+     * @param id sequence id
+     * @return SendStatus if message was placed in any/all/part of the client's queues
+     */
+  SendStatus publish(const char *channel, const char *message, const char *event = NULL, uint32_t id = 0);
+
   // The client pointer sent to the callback is only for reference purposes. DO NOT CALL ANY METHOD ON IT !
   void onDisconnect(ArEventHandlerFunction cb) {
     _disconnectcb = cb;
@@ -302,10 +489,21 @@ public:
   // returns average number of messages pending in all client's queues
   size_t avgPacketsWaiting() const;
 
+  /**
+     * @brief put the connected and next clients in coalescing mode, see AsyncEventSourceClient::setCoalescing()
+     *
+     * @param maxQueuedBytes limit of each client's queue in bytes, 0 to disable
+     */
+  void setCoalescing(size_t maxQueuedBytes = SSE_MAX_QUEUED_BYTES);
+
   // system callbacks (do not call from user code!)
   void _addClient(AsyncEventSourceClient *client);
   void _handleDisconnect(AsyncEventSourceClient *client);
+  uint16_t _getChannelId(const char *channel);
   bool canHandle(AsyncWebServerRequest *request) const override final;
+  const String &routeUri() const override final {
+    return _url;
+  }
   void handleRequest(AsyncWebServerRequest *request) override final;
 };
 
@@ -27,7 +27,7 @@ AsyncJsonResponse::AsyncJsonResponse(bool isArray, size_t maxJsonBufferSize) : _
   }
 }
 #else
-AsyncJsonResponse::AsyncJsonResponse(bool isArray) : _isValid{false} {
+AsyncJsonResponse::AsyncJsonResponse(bool isArray) : _jsonBuffer(asyncsrv::JsonAllocator::instance()), _isValid{false} {
   _code = 200;
   _contentType = asyncsrv::T_application_json;
   if (isArray) {
@@ -50,13 +50,32 @@ size_t AsyncJsonResponse::setLength() {
   return _contentLength;
 }
 
-size_t AsyncJsonResponse::_fillBuffer(uint8_t *data, size_t len) {
-  ChunkPrint dest(data, _sentLength, len);
+void AsyncJsonResponse::_serialize(Print &dest) {
 #if ARDUINOJSON_VERSION_MAJOR == 5
   _root.printTo(dest);
 #else
   serializeJson(_root, dest);
 #endif
+}
+
+size_t AsyncJsonResponse::_fillBuffer(uint8_t *data, size_t len) {
+  if (!_sentLength && len < _contentLength && _buffered && !_buffer) {
+    // serialize the whole document once, the chunks are then copied from the buffer
+    _buffer = (uint8_t *)asyncsrv::allocateBuffer(AsyncMemoryUse::JSON, _contentLength);
+    if (_buffer) {
+      ChunkPrint dest(_buffer, 0, _contentLength);
+      _serialize(dest);
+    } else {
+      async_ws_log_w("Failed to allocate: serializing for each chunk");
+    }
+  }
+  if (_buffer) {
+    const size_t n = std::min(len, _contentLength - _sentLength);
+    memcpy(data, _buffer + _sentLength, n);
+    return n;
+  }
+  ChunkPrint dest(data, _sentLength, len);
+  _serialize(dest);
   return len;
 }
 
@@ -78,14 +97,12 @@ size_t PrettyAsyncJsonResponse::setLength() {
   return _contentLength;
 }
 
-size_t PrettyAsyncJsonResponse::_fillBuffer(uint8_t *data, size_t len) {
-  ChunkPrint dest(data, _sentLength, len);
+void PrettyAsyncJsonResponse::_serialize(Print &dest) {
 #if ARDUINOJSON_VERSION_MAJOR == 5
   _root.prettyPrintTo(dest);
 #else
   serializeJsonPretty(_root, dest);
 #endif
-  return len;
 }
 
 #if ARDUINOJSON_VERSION_MAJOR == 6
@@ -145,7 +162,7 @@ void AsyncCallbackJsonWebHandler::handleRequest(AsyncWebServerRequest *request)
     if (!error) {
       JsonVariant json = jsonBuffer.as<JsonVariant>();
 #else
-    JsonDocument jsonBuffer;
+    JsonDocument jsonBuffer(asyncsrv::JsonAllocator::instance());
     DeserializationError error = deserializeJson(jsonBuffer, (const char *)request->_tempObject);
     if (!error) {
       JsonVariant json = jsonBuffer.as<JsonVariant>();
@@ -169,12 +186,14 @@ void AsyncCallbackJsonWebHandler::handleBody(AsyncWebServerRequest *request, uin
     if (index == 0) {
       // this check allows request->_tempObject to be initialized from a middleware
       if (request->_tempObject == NULL) {
-        request->_tempObject = calloc(total + 1, sizeof(uint8_t));  // null-terminated string
+        request->_tempObject = asyncsrv::allocateBuffer(AsyncMemoryUse::BODY, total + 1);
         if (request->_tempObject == NULL) {
           async_ws_log_e("Failed to allocate");
+          async_ws_metric_inc(allocFailures);
           request->abort();
           return;
         }
+        memset(request->_tempObject, 0, total + 1);  // null-terminated string
       }
     }
 
@@ -16,6 +16,7 @@
 #if ASYNC_JSON_SUPPORT == 1
 #include <ESPAsyncWebServer.h>
 
+#include "AsyncJsonAllocator.h"
 #include "ChunkPrint.h"
 
 #if ARDUINOJSON_VERSION_MAJOR == 6
@@ -36,6 +37,10 @@ protected:
 
   JsonVariant _root;
   bool _isValid;
+  bool _buffered = false;
+  uint8_t *_buffer = nullptr;
+
+  virtual void _serialize(Print &dest);
 
 public:
 #if ARDUINOJSON_VERSION_MAJOR == 6
@@ -43,9 +48,17 @@ public:
 #else
   AsyncJsonResponse(bool isArray = false);
 #endif
+  virtual ~AsyncJsonResponse() {
+    free(_buffer);
+  }
   JsonVariant &getRoot() {
     return _root;
   }
+  // Serialize the document only once, into a buffer of the response length, instead of serializing it again for each chunk.
+  // This costs a heap allocation of the response length: the document is serialized for each chunk if this allocation fails.
+  void setBuffered(bool buffered) {
+    _buffered = buffered;
+  }
   bool _sourceValid() const {
     return _isValid;
   }
@@ -69,7 +82,9 @@ public:
   PrettyAsyncJsonResponse(bool isArray = false);
 #endif
   size_t setLength();
-  size_t _fillBuffer(uint8_t *data, size_t len);
+
+protected:
+  void _serialize(Print &dest) override;
 };
 
 typedef std::function<void(AsyncWebServerRequest *request, JsonVariant &json)> ArJsonRequestHandlerFunction;
@@ -102,6 +117,9 @@ public:
   }
 
   bool canHandle(AsyncWebServerRequest *request) const override final;
+  const String &routeUri() const override final {
+    return _uri;
+  }
   void handleRequest(AsyncWebServerRequest *request) override final;
   void handleUpload(
     __unused AsyncWebServerRequest *request, __unused const String &filename, __unused size_t index, __unused uint8_t *data, __unused size_t len,
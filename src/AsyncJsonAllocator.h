@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+#pragma once
+
+#include <ArduinoJson.h>
+
+#include "AsyncWebServerMemory.h"
+
+#if ARDUINOJSON_VERSION_MAJOR >= 7
+
+namespace asyncsrv {
+
+/**
+ * @brief Allocator of the JSON and MessagePack documents of the handlers and responses, placed as AsyncMemoryUse::JSON:
+ * the pools of the documents can go to PSRAM while their small strings stay in the default heap
+ */
+class JsonAllocator : public ArduinoJson::Allocator {
+public:
+  void *allocate(size_t size) override {
+    return allocateBuffer(AsyncMemoryUse::JSON, size);
+  }
+  void deallocate(void *ptr) override {
+    free(ptr);
+  }
+  void *reallocate(void *ptr, size_t size) override {
+    return reallocateBuffer(AsyncMemoryUse::JSON, ptr, size);
+  }
+
+  static ArduinoJson::Allocator *instance() {
+    static JsonAllocator allocator;
+    return &allocator;
+  }
+};
+
+}  // namespace asyncsrv
+
+#endif  // ARDUINOJSON_VERSION_MAJOR >= 7
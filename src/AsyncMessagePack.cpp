@@ -17,7 +17,7 @@ AsyncMessagePackResponse::AsyncMessagePackResponse(bool isArray, size_t maxJsonB
   }
 }
 #else
-AsyncMessagePackResponse::AsyncMessagePackResponse(bool isArray) : _isValid{false} {
+AsyncMessagePackResponse::AsyncMessagePackResponse(bool isArray) : _jsonBuffer(asyncsrv::JsonAllocator::instance()), _isValid{false} {
   _code = 200;
   _contentType = asyncsrv::T_application_msgpack;
   if (isArray) {
@@ -37,6 +37,21 @@ size_t AsyncMessagePackResponse::setLength() {
 }
 
 size_t AsyncMessagePackResponse::_fillBuffer(uint8_t *data, size_t len) {
+  if (!_sentLength && len < _contentLength && _buffered && !_buffer) {
+    // serialize the whole document once, the chunks are then copied from the buffer
+    _buffer = (uint8_t *)asyncsrv::allocateBuffer(AsyncMemoryUse::JSON, _contentLength);
+    if (_buffer) {
+      ChunkPrint dest(_buffer, 0, _contentLength);
+      serializeMsgPack(_root, dest);
+    } else {
+      async_ws_log_w("Failed to allocate: serializing for each chunk");
+    }
+  }
+  if (_buffer) {
+    const size_t n = std::min(len, _contentLength - _sentLength);
+    memcpy(data, _buffer + _sentLength, n);
+    return n;
+  }
   ChunkPrint dest(data, _sentLength, len);
   serializeMsgPack(_root, dest);
   return len;
@@ -82,7 +97,7 @@ void AsyncCallbackMessagePackWebHandler::handleRequest(AsyncWebServerRequest *re
       if (!error) {
         JsonVariant json = jsonBuffer.as<JsonVariant>();
 #else
-      JsonDocument jsonBuffer;
+      JsonDocument jsonBuffer(asyncsrv::JsonAllocator::instance());
       DeserializationError error = deserializeMsgPack(jsonBuffer, (uint8_t *)(request->_tempObject));
       if (!error) {
         JsonVariant json = jsonBuffer.as<JsonVariant>();
@@ -102,9 +117,10 @@ void AsyncCallbackMessagePackWebHandler::handleBody(AsyncWebServerRequest *reque
   if (_onRequest) {
     _contentLength = total;
     if (total > 0 && request->_tempObject == NULL && total < _maxContentLength) {
-      request->_tempObject = malloc(total);
+      request->_tempObject = asyncsrv::allocateBuffer(AsyncMemoryUse::BODY, total);
       if (request->_tempObject == NULL) {
         async_ws_log_e("Failed to allocate");
+        async_ws_metric_inc(allocFailures);
         request->abort();
         return;
       }
@@ -36,6 +36,7 @@
 #if ASYNC_MSG_PACK_SUPPORT == 1
 #include <ESPAsyncWebServer.h>
 
+#include "AsyncJsonAllocator.h"
 #include "ChunkPrint.h"
 
 #if ARDUINOJSON_VERSION_MAJOR == 6
@@ -54,6 +55,8 @@ protected:
 
   JsonVariant _root;
   bool _isValid;
+  bool _buffered = false;
+  uint8_t *_buffer = nullptr;
 
 public:
 #if ARDUINOJSON_VERSION_MAJOR == 6
@@ -61,9 +64,17 @@ public:
 #else
   AsyncMessagePackResponse(bool isArray = false);
 #endif
+  ~AsyncMessagePackResponse() {
+    free(_buffer);
+  }
   JsonVariant &getRoot() {
     return _root;
   }
+  // Serialize the document only once, into a buffer of the response length, instead of serializing it again for each chunk.
+  // This costs a heap allocation of the response length: the document is serialized for each chunk if this allocation fails.
+  void setBuffered(bool buffered) {
+    _buffered = buffered;
+  }
   bool _sourceValid() const {
     return _isValid;
   }
@@ -112,6 +123,9 @@ public:
   }
 
   bool canHandle(AsyncWebServerRequest *request) const override final;
+  const String &routeUri() const override final {
+    return _uri;
+  }
   void handleRequest(AsyncWebServerRequest *request) override final;
   void handleUpload(
     __unused AsyncWebServerRequest *request, __unused const String &filename, __unused size_t index, __unused uint8_t *data, __unused size_t len,
@@ -32,3 +32,19 @@ const AsyncWebHeader AsyncWebHeader::parse(const char *data) {
   name.concat(data, colon - data);
   return AsyncWebHeader(name, String(startOfValue));
 }
+
+AsyncHeaderBlock::AsyncHeaderBlock(std::initializer_list<AsyncWebHeader> headers) {
+  size_t len = 0;
+  for (const AsyncWebHeader &header : headers) {
+    len += header.name().length() + header.value().length() + 4;
+  }
+  _data.reserve(len);
+  for (const AsyncWebHeader &header : headers) {
+    if (header) {
+      _data.concat(header.name());
+      _data.concat(": ");
+      _data.concat(header.value());
+      _data.concat(asyncsrv::T_rn);
+    }
+  }
+}
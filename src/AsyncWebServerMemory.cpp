@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+#include "ESPAsyncWebServer.h"
+
+#include <stdlib.h>
+
+#ifdef ESP32
+#include <esp_heap_caps.h>
+#if ESP_IDF_VERSION_MAJOR < 5
+#include <soc/soc_memory_layout.h>
+#else
+#include <esp_memory_utils.h>
+#endif
+#endif
+
+namespace asyncsrv {
+
+static size_t psramThresholds[(size_t)AsyncMemoryUse::COUNT] = {
+  ASYNCWEBSERVER_PSRAM_THRESHOLD, ASYNCWEBSERVER_PSRAM_THRESHOLD, ASYNCWEBSERVER_PSRAM_THRESHOLD,
+  ASYNCWEBSERVER_PSRAM_THRESHOLD, ASYNCWEBSERVER_PSRAM_THRESHOLD, ASYNCWEBSERVER_PSRAM_THRESHOLD,
+  ASYNCWEBSERVER_PSRAM_THRESHOLD,
+};
+static_assert((size_t)AsyncMemoryUse::COUNT == 7, "psramThresholds must have a value for each use");
+
+void setPsramThreshold(AsyncMemoryUse use, size_t threshold) {
+  if (use < AsyncMemoryUse::COUNT) {
+    psramThresholds[(size_t)use] = threshold;
+  }
+}
+
+size_t psramThreshold(AsyncMemoryUse use) {
+  return use < AsyncMemoryUse::COUNT ? psramThresholds[(size_t)use] : SIZE_MAX;
+}
+
+void *allocateBuffer(AsyncMemoryUse use, size_t size) {
+#ifdef ESP32
+  if (size >= psramThreshold(use)) {
+    void *ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (ptr) {
+      return ptr;
+    }
+  }
+#else
+  (void)use;
+#endif
+  return malloc(size);
+}
+
+void *reallocateBuffer(AsyncMemoryUse use, void *ptr, size_t size) {
+#ifdef ESP32
+  if (size >= psramThreshold(use) || (ptr && esp_ptr_external_ram(ptr))) {
+    void *resized = heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (resized) {
+      return resized;
+    }
+  }
+#else
+  (void)use;
+#endif
+  return realloc(ptr, size);
+}
+
+}  // namespace asyncsrv
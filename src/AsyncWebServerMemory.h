@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdlib.h>
+
+// Smallest size of the large buffers allocated in PSRAM (ESP32 with PSRAM only), the smaller ones keeping the default heap,
+// which leaves the internal RAM to Wi-Fi and lwIP. SIZE_MAX keeps all of them in the default heap.
+// The threshold of each use can be changed at runtime with AsyncWebServer::setPsramThreshold().
+#ifndef ASYNCWEBSERVER_PSRAM_THRESHOLD
+#if defined(ESP32) && (defined(BOARD_HAS_PSRAM) || defined(CONFIG_SPIRAM))
+#define ASYNCWEBSERVER_PSRAM_THRESHOLD 1024
+#else
+#define ASYNCWEBSERVER_PSRAM_THRESHOLD SIZE_MAX
+#endif
+#endif
+
+/**
+ * @brief Uses of the large buffers, each with its own PSRAM threshold
+ */
+enum class AsyncMemoryUse : uint8_t {
+  RESPONSE,  // send buffer of the responses
+  STREAM,    // content of AsyncResponseStream
+  BODY,      // request bodies kept whole by the JSON, MessagePack and proxy handlers
+  UPLOAD,    // buffer of the multipart uploads
+  JSON,      // JSON and MessagePack documents, and their serialized content
+  CACHE,     // file contents cached by AsyncStaticWebHandler
+  MESSAGE,   // WebSocket messages reassembled by AsyncWebSocketMessageHandler
+  COUNT
+};
+
+namespace asyncsrv {
+
+void setPsramThreshold(AsyncMemoryUse use, size_t threshold);
+size_t psramThreshold(AsyncMemoryUse use);
+
+// Allocates size bytes for this use, in PSRAM if size reaches the threshold of the use and some is free, in the default heap
+// otherwise: the memory is released with free()
+void *allocateBuffer(AsyncMemoryUse use, size_t size);
+// Resizes memory returned by allocateBuffer(), in PSRAM if it already is or if size reaches the threshold: nullptr if it failed,
+// ptr being left as is
+void *reallocateBuffer(AsyncMemoryUse use, void *ptr, size_t size);
+
+// Releases the memory returned by allocateBuffer(), for std::unique_ptr
+struct BufferDeleter {
+  void operator()(void *ptr) const {
+    free(ptr);
+  }
+};
+
+}  // namespace asyncsrv
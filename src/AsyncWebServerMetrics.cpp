@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+#include "AsyncWebServerMetrics.h"
+
+#if ASYNCWEBSERVER_METRICS
+
+namespace asyncsrv {
+
+const uint32_t MetricHistogram::bounds[MetricHistogram::BUCKETS - 1] = {1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000, 5000000};
+
+void MetricHistogram::observe(uint32_t us) {
+  size_t i = 0;
+  while (i < BUCKETS - 1 && us > bounds[i]) {
+    i++;
+  }
+  buckets[i].add(1);
+  count.add(1);
+  sum.add(us);
+}
+
+Metrics metrics;
+
+}  // namespace asyncsrv
+
+#endif  // ASYNCWEBSERVER_METRICS
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Instrumentation of the request lifecycle and of the queues (0 compiles it out, without any cost).
+// The values are exported by AsyncMetricsHandler.
+#ifndef ASYNCWEBSERVER_METRICS
+#define ASYNCWEBSERVER_METRICS 0
+#endif
+
+#if ASYNCWEBSERVER_METRICS
+
+#ifdef ESP32
+#include <atomic>
+#endif
+
+namespace asyncsrv {
+
+/**
+ * @brief Counter updated from any task: relaxed atomic on ESP32, plain value on the single task platforms
+ */
+template <typename T> class MetricCounter {
+private:
+#ifdef ESP32
+  std::atomic<T> _value{0};
+#else
+  T _value{0};
+#endif
+
+public:
+  void add(T n = 1) {
+#ifdef ESP32
+    _value.fetch_add(n, std::memory_order_relaxed);
+#else
+    _value += n;
+#endif
+  }
+  T value() const {
+#ifdef ESP32
+    return _value.load(std::memory_order_relaxed);
+#else
+    return _value;
+#endif
+  }
+};
+
+/**
+ * @brief Histogram of durations in microseconds, over fixed buckets from 1 ms to 5 s
+ * The buckets are not cumulative: each observation is only counted in the first bucket holding it.
+ */
+class MetricHistogram {
+public:
+  static constexpr size_t BUCKETS = 13;
+  // upper bounds of the buckets in microseconds, the last bucket (+Inf) having no bound
+  static const uint32_t bounds[BUCKETS - 1];
+
+  MetricCounter<uint32_t> buckets[BUCKETS];
+  MetricCounter<uint32_t> count;
+  MetricCounter<uint64_t> sum;
+
+  void observe(uint32_t us);
+};
+
+struct Metrics {
+  // request lifecycle
+  MetricHistogram headers;    // first byte of the request received -> headers parsed
+  MetricHistogram dispatch;   // headers parsed -> handler dispatched (includes receiving the body)
+  MetricHistogram firstByte;  // handler dispatched -> first byte of the response written
+  MetricHistogram response;   // first byte of the response written -> last byte acked
+
+  MetricCounter<uint32_t> connections;  // accepted connections, each allocating a request
+  MetricCounter<uint32_t> requests;     // requests parsed, several per persistent connection
+  MetricCounter<uint32_t> responses;    // allocated responses
+  MetricCounter<uint32_t> allocFailures;
+  MetricCounter<uint64_t> bytesReceived;
+  MetricCounter<uint64_t> bytesSent;  // acked by the clients
+
+  MetricCounter<uint32_t> wsDropped;  // queue-full drops
+  MetricCounter<uint32_t> sseDropped;
+  MetricCounter<uint32_t> rateLimited;      // requests rejected by AsyncRateLimitMiddleware
+  MetricCounter<uint32_t> offloadRejected;  // offloaded requests rejected while the worker queue was full
+};
+
+extern Metrics metrics;
+
+}  // namespace asyncsrv
+
+#define async_ws_metric_add(counter, n)       asyncsrv::metrics.counter.add(n)
+#define async_ws_metric_inc(counter)          asyncsrv::metrics.counter.add(1)
+#define async_ws_metric_observe(histogram, us) asyncsrv::metrics.histogram.observe(us)
+
+#else
+
+#define async_ws_metric_add(counter, n)
+#define async_ws_metric_inc(counter)
+#define async_ws_metric_observe(histogram, us)
+
+#endif  // ASYNCWEBSERVER_METRICS
@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+#include "ESPAsyncWebServer.h"
+#include "AsyncWebServerWorkers.h"
+#include "AsyncWebServerLogging.h"
+
+#ifdef ESP32
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+namespace asyncsrv {
+
+typedef std::function<void()> WorkerJob;
+
+static QueueHandle_t workerQueue = nullptr;
+
+static void workerTask(void *arg) {
+  (void)arg;
+  WorkerJob *job;
+  while (true) {
+    if (xQueueReceive(workerQueue, &job, portMAX_DELAY) == pdTRUE) {
+      (*job)();
+      delete job;
+    }
+  }
+}
+
+static bool startWorkers() {
+  if (workerQueue) {
+    return true;
+  }
+  workerQueue = xQueueCreate(ASYNCWEBSERVER_WORKER_QUEUE_SIZE, sizeof(WorkerJob *));
+  if (!workerQueue) {
+    return false;
+  }
+  for (size_t i = 0; i < ASYNCWEBSERVER_WORKER_TASKS; i++) {
+    if (xTaskCreatePinnedToCore(workerTask, "async_ws_worker", ASYNCWEBSERVER_WORKER_STACK_SIZE, nullptr, ASYNCWEBSERVER_WORKER_PRIORITY, nullptr, ASYNCWEBSERVER_WORKER_CORE)
+        != pdPASS) {
+      async_ws_log_e("Unable to start the worker tasks");
+      if (i == 0) {
+        vQueueDelete(workerQueue);
+        workerQueue = nullptr;
+        return false;
+      }
+      // the workers already started serve the queue
+      break;
+    }
+  }
+  return true;
+}
+
+bool runOnWorker(WorkerJob &&job) {
+  {
+    std::lock_guard<std::recursive_mutex> guard(workerLock());
+    if (!startWorkers()) {
+      return false;
+    }
+  }
+  WorkerJob *queued = new (std::nothrow) WorkerJob(std::move(job));
+  if (!queued) {
+    async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
+    return false;
+  }
+  if (xQueueSend(workerQueue, &queued, 0) != pdTRUE) {
+    delete queued;
+    return false;
+  }
+  return true;
+}
+
+std::recursive_mutex &workerLock() {
+  static std::recursive_mutex lock;
+  return lock;
+}
+
+}  // namespace asyncsrv
+
+#endif
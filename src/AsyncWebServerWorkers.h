@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+#pragma once
+
+#ifdef ESP32
+
+#include <functional>
+#include <mutex>
+
+namespace asyncsrv {
+
+// Queues job for the worker tasks, started on the first call: returns false if the queue is full or the workers could not be started
+bool runOnWorker(std::function<void()> &&job);
+
+// Serializes the hand-over of the offloaded requests, between their worker and the AsyncTCP task
+std::recursive_mutex &workerLock();
+
+}  // namespace asyncsrv
+
+#endif
@@ -34,7 +34,38 @@ size_t webSocketSendFrameWindow(AsyncClient *client) {
   return space - 8;
 }
 
-size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool mask, uint8_t *data, size_t len) {
+// XOR the data with the 4 bytes mask, the first byte being at the given position in the mask.
+// The aligned part of the data is processed 32 bits at a time.
+void webSocketMask(uint8_t *data, size_t len, const uint8_t *mask, size_t offset) {
+  typedef uint32_t __attribute__((__may_alias__)) word_t;
+  uint8_t m[4];
+  for (size_t i = 0; i < 4; i++) {
+    m[i] = mask[(offset + i) & 3];
+  }
+  size_t i = 0;
+  // unaligned head
+  while (i < len && ((uintptr_t)(data + i) & 3)) {
+    data[i] ^= m[i & 3];
+    i++;
+  }
+  if (len - i >= 4) {
+    // mask rotated to begin at data + i, in memory order whatever the endianness
+    const uint8_t wm[4] = {m[i & 3], m[(i + 1) & 3], m[(i + 2) & 3], m[(i + 3) & 3]};
+    word_t word;
+    memcpy(&word, wm, 4);
+    word_t *w = (word_t *)(data + i);
+    for (; i + 4 <= len; i += 4) {
+      *w++ ^= word;
+    }
+  }
+  // tail
+  while (i < len) {
+    data[i] ^= m[i & 3];
+    i++;
+  }
+}
+
+size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool mask, uint8_t *data, size_t len, bool flush = true) {
   if (!client || !client->canSend()) {
     // Serial.println("SF 1");
     return 0;
@@ -66,13 +97,7 @@ size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool
     len = space;
   }
 
-  uint8_t *buf = (uint8_t *)malloc(headLen);
-  if (buf == NULL) {
-    async_ws_log_e("Failed to allocate");
-    client->abort();
-    return 0;
-  }
-
+  uint8_t buf[8];
   buf[0] = opcode & 0x0F;
   if (final) {
     buf[0] |= 0x80;
@@ -90,18 +115,13 @@ size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool
   }
   if (client->add((const char *)buf, headLen) != headLen) {
     // os_printf("error adding %lu header bytes\n", headLen);
-    free(buf);
     // Serial.println("SF 4");
     return 0;
   }
-  free(buf);
 
   if (len) {
     if (len && mask) {
-      size_t i;
-      for (i = 0; i < len; i++) {
-        data[i] = data[i] ^ mbuf[i % 4];
-      }
+      webSocketMask(data, len, mbuf, 0);
     }
     if (client->add((const char *)data, len) != len) {
       // os_printf("error adding %lu data bytes\n", len);
@@ -109,7 +129,7 @@ size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool
       return 0;
     }
   }
-  if (!client->send()) {
+  if (flush && !client->send()) {
     // os_printf("error sending frame: %lu\n", headLen+len);
     //  Serial.println("SF 6");
     return 0;
@@ -153,19 +173,36 @@ bool AsyncWebSocketMessageBuffer::reserve(size_t size) {
  * AsyncWebSocketMessage Message
  */
 
-AsyncWebSocketMessage::AsyncWebSocketMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, bool mask)
-  : _WSbuffer{buffer}, _opcode(opcode & 0x07), _mask{mask}, _status{_WSbuffer ? WS_MSG_SENDING : WS_MSG_ERROR} {}
+AsyncWebSocketMessage::AsyncWebSocketMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, bool mask, bool encoded, uint16_t channel)
+  : _WSbuffer{buffer}, _opcode(opcode & 0x07), _mask{mask}, _encoded{encoded}, _channel{channel}, _status{_WSbuffer ? WS_MSG_SENDING : WS_MSG_ERROR} {}
+
+bool AsyncWebSocketMessage::replace(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, bool encoded) {
+  if (_status != WS_MSG_SENDING || _sent || _ack) {
+    return false;
+  }
+  _WSbuffer = buffer;
+  _opcode = opcode & 0x07;
+  _encoded = encoded;
+  return true;
+}
 
-void AsyncWebSocketMessage::ack(size_t len, uint32_t time) {
+size_t AsyncWebSocketMessage::ack(size_t len, uint32_t time) {
   (void)time;
+  size_t extra = 0;
+  if (_acked + len > _ack) {
+    // the rest belongs to the messages written after this one
+    extra = _acked + len - _ack;
+    len -= extra;
+  }
   _acked += len;
   if (_sent >= _WSbuffer->size() && _acked >= _ack) {
     _status = WS_MSG_SENT;
   }
   // ets_printf("A: %u\n", len);
+  return extra;
 }
 
-size_t AsyncWebSocketMessage::send(AsyncClient *client) {
+size_t AsyncWebSocketMessage::send(AsyncClient *client, bool flush) {
   if (!client) {
     return 0;
   }
@@ -188,6 +225,25 @@ size_t AsyncWebSocketMessage::send(AsyncClient *client) {
     return 0;
   }
 
+  if (_encoded) {
+    // the frame can be shared with other clients: its bytes are sent as they are, by reference, the message keeping the
+    // frame until they are acked (the connection is only ever aborted, which releases them at once).
+    // The lwIP of ESP-IDF still copies them, as it is built with LWIP_NETIF_TX_SINGLE_PBUF: see AsyncEventSourceMessage::write()
+    if (!client->canSend()) {
+      return 0;
+    }
+    size_t added = client->add((const char *)_WSbuffer->data() + _sent, std::min(_WSbuffer->size() - _sent, client->space()), 0);
+    if (!added) {
+      return 0;
+    }
+    if (flush) {
+      client->send();
+    }
+    _sent += added;
+    _ack += added;
+    return added;
+  }
+
   size_t toSend = _WSbuffer->size() - _sent;
   size_t window = webSocketSendFrameWindow(client);
 
@@ -204,7 +260,7 @@ size_t AsyncWebSocketMessage::send(AsyncClient *client) {
   uint8_t *dPtr = (uint8_t *)(_WSbuffer->data() + (_sent - toSend));
   uint8_t opCode = (toSend && _sent == toSend) ? _opcode : (uint8_t)WS_CONTINUATION;
 
-  size_t sent = webSocketSendFrame(client, final, opCode, _mask, dPtr, toSend);
+  size_t sent = webSocketSendFrame(client, final, opCode, _mask, dPtr, toSend, flush);
   _status = WS_MSG_SENDING;
   if (toSend && sent != toSend) {
     // ets_printf("E: %u != %u\n", toSend, sent);
@@ -289,6 +345,7 @@ AsyncWebSocketClient::~AsyncWebSocketClient() {
 
 void AsyncWebSocketClient::_clearQueue() {
   while (!_messageQueue.empty() && _messageQueue.front().finished()) {
+    _queuedBytes -= _messageQueue.front().length();
     _messageQueue.pop_front();
   }
 }
@@ -324,8 +381,14 @@ void AsyncWebSocketClient::_onAck(size_t len, uint32_t time) {
     }
   }
 
-  if (len && !_messageQueue.empty()) {
-    _messageQueue.front().ack(len, time);
+  // several messages are in flight in coalescing mode: the acked bytes are spread over them in order
+  for (auto &message : _messageQueue) {
+    if (!len) {
+      break;
+    }
+    if (!message.finished()) {
+      len = message.ack(len, time);
+    }
   }
 
   _clearQueue();
@@ -362,16 +425,65 @@ void AsyncWebSocketClient::_runQueue() {
   if (!_controlQueue.empty() && (_messageQueue.empty() || _messageQueue.front().betweenFrames())
       && webSocketSendFrameWindow(_client) > (size_t)(_controlQueue.front().len() - 1)) {
     _controlQueue.front().send(_client);
-  } else if (!_messageQueue.empty() && _messageQueue.front().betweenFrames() && webSocketSendFrameWindow(_client)) {
+  } else if (_maxQueuedBytes && !_messageQueue.empty() && webSocketSendFrameWindow(_client)) {
+    _runBatch();
+  } else if (!_messageQueue.empty() && _messageQueue.front().acked() && webSocketSendFrameWindow(_client)) {
     _messageQueue.front().send(_client);
   }
 }
 
+void AsyncWebSocketClient::_runBatch() {
+  // the messages are written one after the other while they fit in the window, and sent together at the end
+  size_t window = webSocketSendFrameWindow(_client);
+  bool inFlight = false;
+  size_t added = 0;
+  for (auto &message : _messageQueue) {
+    if (message.finished()) {
+      continue;
+    }
+    if (message.sent()) {
+      // waiting for its ack
+      inFlight = true;
+      continue;
+    }
+    // a message needing several frames is sent alone, as without coalescing
+    if (!message.acked() || (inFlight && !message.fits(window))) {
+      break;
+    }
+    added += message.send(_client, false);
+    if (!message.sent()) {
+      break;
+    }
+    inFlight = true;
+    window = webSocketSendFrameWindow(_client);
+    if (!window) {
+      break;
+    }
+  }
+  if (added) {
+    _client->send();
+  }
+}
+
+bool AsyncWebSocketClient::_queueFull(size_t len) const {
+  if (_maxQueuedBytes) {
+    return !_messageQueue.empty() && _queuedBytes + len > _maxQueuedBytes;
+  }
+  return _messageQueue.size() >= WS_MAX_QUEUED_MESSAGES;
+}
+
+void AsyncWebSocketClient::setCoalescing(size_t maxQueuedBytes) {
+#ifdef ESP32
+  std::lock_guard<std::recursive_mutex> lock(_lock);
+#endif
+  _maxQueuedBytes = maxQueuedBytes;
+}
+
 bool AsyncWebSocketClient::queueIsFull() const {
 #ifdef ESP32
   std::lock_guard<std::recursive_mutex> lock(_lock);
 #endif
-  return (_messageQueue.size() >= WS_MAX_QUEUED_MESSAGES) || (_status != WS_CONNECTED);
+  return _queueFull(1) || (_status != WS_CONNECTED);
 }
 
 size_t AsyncWebSocketClient::queueLen() const {
@@ -385,7 +497,7 @@ bool AsyncWebSocketClient::canSend() const {
 #ifdef ESP32
   std::lock_guard<std::recursive_mutex> lock(_lock);
 #endif
-  return _messageQueue.size() < WS_MAX_QUEUED_MESSAGES;
+  return !_queueFull(1);
 }
 
 bool AsyncWebSocketClient::_queueControl(uint8_t opcode, const uint8_t *data, size_t len, bool mask) {
@@ -406,7 +518,7 @@ bool AsyncWebSocketClient::_queueControl(uint8_t opcode, const uint8_t *data, si
   return true;
 }
 
-bool AsyncWebSocketClient::_queueMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, bool mask) {
+bool AsyncWebSocketClient::_queueMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, bool mask, bool encoded, uint16_t channel) {
   if (!_client || buffer->size() == 0 || _status != WS_CONNECTED) {
     return false;
   }
@@ -415,7 +527,22 @@ bool AsyncWebSocketClient::_queueMessage(AsyncWebSocketSharedBuffer buffer, uint
   std::unique_lock<std::recursive_mutex> lock(_lock);
 #endif
 
-  if (_messageQueue.size() >= WS_MAX_QUEUED_MESSAGES) {
+  if (channel) {
+    // only the last value of the channel can still be waiting
+    for (auto i = _messageQueue.rbegin(); i != _messageQueue.rend(); ++i) {
+      if (i->channel() == channel) {
+        const size_t len = i->length();
+        if (i->replace(buffer, opcode, encoded)) {
+          _queuedBytes = _queuedBytes - len + buffer->size();
+          return true;
+        }
+        break;
+      }
+    }
+  }
+
+  if (_queueFull(buffer->size())) {
+    async_ws_metric_inc(wsDropped);
     if (closeWhenFull) {
       _status = WS_DISCONNECTED;
 
@@ -440,9 +567,11 @@ bool AsyncWebSocketClient::_queueMessage(AsyncWebSocketSharedBuffer buffer, uint
     return false;
   }
 
-  _messageQueue.emplace_back(buffer, opcode, mask);
+  _messageQueue.emplace_back(buffer, opcode, mask, encoded, channel);
+  _queuedBytes += buffer->size();
 
-  if (_client && _client->canSend()) {
+  // in coalescing mode, a message queued behind others waits for the next ack, to be sent with them
+  if (_client && _client->canSend() && (!_maxQueuedBytes || _messageQueue.size() == 1)) {
     _runQueue();
   }
 
@@ -477,6 +606,7 @@ void AsyncWebSocketClient::close(uint16_t code, const char *message) {
       return;
     } else {
       async_ws_log_e("Failed to allocate");
+      async_ws_metric_inc(allocFailures);
       _client->abort();
     }
   }
@@ -544,27 +674,26 @@ void AsyncWebSocketClient::_onData(void *pbuf, size_t plen) {
         data += 4;
         plen -= 4;
       }
+
+      // first frame of a message: control frames can come between the frames of a fragmented message
+      if (_pinfo.opcode == WS_TEXT || _pinfo.opcode == WS_BINARY) {
+        _pinfo.message_opcode = _pinfo.opcode;
+        _pinfo.num = 0;
+      }
     }
 
     const size_t datalen = std::min((size_t)(_pinfo.len - _pinfo.index), plen);
     const auto datalast = data[datalen];
 
     if (_pinfo.masked) {
-      for (size_t i = 0; i < datalen; i++) {
-        data[i] ^= _pinfo.mask[(_pinfo.index + i) % 4];
-      }
+      webSocketMask(data, datalen, _pinfo.mask, _pinfo.index);
     }
 
     if ((datalen + _pinfo.index) < _pinfo.len) {
       _pstate = 1;
 
-      if (_pinfo.index == 0) {
-        if (_pinfo.opcode) {
-          _pinfo.message_opcode = _pinfo.opcode;
-          _pinfo.num = 0;
-        }
-      }
-      if (datalen > 0) {
+      // the pieces of a control frame are not data: they must not be mixed with the message being received
+      if (datalen > 0 && _pinfo.opcode < WS_DISCONNECT) {
         _server->_handleEvent(this, WS_EVT_DATA, (void *)&_pinfo, data, datalen);
       }
 
@@ -680,6 +809,51 @@ AsyncWebSocketSharedBuffer makeSharedBuffer(const uint8_t *message, size_t len)
   std::memcpy(buffer->data(), message, len);
   return buffer;
 }
+
+// header of a final and unmasked frame: buf must have room for 10 bytes
+size_t webSocketEncodeHeader(uint8_t *buf, uint8_t opcode, size_t len) {
+  buf[0] = 0x80 | (opcode & 0x0F);
+  if (len < 126) {
+    buf[1] = len;
+    return 2;
+  }
+  if (len <= 0xFFFF) {
+    buf[1] = 126;
+    buf[2] = (uint8_t)((len >> 8) & 0xFF);
+    buf[3] = (uint8_t)(len & 0xFF);
+    return 4;
+  }
+  buf[1] = 127;
+  uint64_t len64 = len;
+  for (size_t i = 0; i < 8; i++) {
+    buf[2 + i] = (uint8_t)((len64 >> (8 * (7 - i))) & 0xFF);
+  }
+  return 10;
+}
+
+AsyncWebSocketSharedBuffer makeSharedFrame(uint8_t opcode, const uint8_t *message, size_t len) {
+  uint8_t head[10];
+  size_t headLen = webSocketEncodeHeader(head, opcode, len);
+  auto frame = std::make_shared<std::vector<uint8_t>>(headLen + len);
+  std::memcpy(frame->data(), head, headLen);
+  std::memcpy(frame->data() + headLen, message, len);
+  return frame;
+}
+
+// turns the payload into a frame, in place when nobody else can see the buffer, else in a new buffer
+bool encodeSharedBuffer(AsyncWebSocketSharedBuffer &buffer, uint8_t opcode) {
+  if (!buffer || !buffer->size()) {
+    return false;
+  }
+  if (buffer.use_count() != 1) {
+    buffer = makeSharedFrame(opcode, buffer->data(), buffer->size());
+    return true;
+  }
+  uint8_t head[10];
+  size_t headLen = webSocketEncodeHeader(head, opcode, buffer->size());
+  buffer->insert(buffer->begin(), head, head + headLen);
+  return true;
+}
 }  // namespace
 
 bool AsyncWebSocketClient::text(AsyncWebSocketMessageBuffer *buffer) {
@@ -711,6 +885,18 @@ bool AsyncWebSocketClient::text(const String &message) {
   return text(message.c_str(), message.length());
 }
 
+bool AsyncWebSocketClient::publish(const char *channel, AsyncWebSocketSharedBuffer buffer, uint8_t opcode) {
+  return buffer && _queueMessage(buffer, opcode, false, false, _server->_getChannelId(channel));
+}
+
+bool AsyncWebSocketClient::publish(const char *channel, const uint8_t *message, size_t len, uint8_t opcode) {
+  return publish(channel, makeSharedBuffer(message, len), opcode);
+}
+
+bool AsyncWebSocketClient::publish(const char *channel, const String &message) {
+  return publish(channel, (const uint8_t *)message.c_str(), message.length());
+}
+
 #ifdef ESP8266
 bool AsyncWebSocketClient::text(const __FlashStringHelper *data) {
   PGM_P p = reinterpret_cast<PGM_P>(data);
@@ -806,6 +992,7 @@ void AsyncWebSocket::_handleEvent(AsyncWebSocketClient *client, AwsEventType typ
 
 AsyncWebSocketClient *AsyncWebSocket::_newClient(AsyncWebServerRequest *request) {
   _clients.emplace_back(request, this);
+  _clients.back()._maxQueuedBytes = _maxQueuedBytes;
   _handleEvent(&_clients.back(), WS_EVT_CONNECT, request, NULL, 0);
   return &_clients.back();
 }
@@ -820,6 +1007,13 @@ void AsyncWebSocket::_handleDisconnect(AsyncWebSocketClient *client) {
   }
 }
 
+void AsyncWebSocket::setCoalescing(size_t maxQueuedBytes) {
+  _maxQueuedBytes = maxQueuedBytes;
+  for (auto &c : _clients) {
+    c.setCoalescing(maxQueuedBytes);
+  }
+}
+
 bool AsyncWebSocket::availableForWriteAll() {
   return std::none_of(std::begin(_clients), std::end(_clients), [](const AsyncWebSocketClient &c) {
     return c.queueIsFull();
@@ -949,8 +1143,55 @@ bool AsyncWebSocket::text(uint32_t id, AsyncWebSocketSharedBuffer buffer) {
   return c && c->text(buffer);
 }
 
+AsyncWebSocket::SendStatus AsyncWebSocket::_sendFrameAll(AsyncWebSocketSharedBuffer frame, uint16_t channel) {
+  size_t hit = 0;
+  size_t miss = 0;
+  for (auto &c : _clients) {
+    if (c.status() == WS_CONNECTED && c._queueMessage(frame, frame->front() & 0x0F, false, true, channel)) {
+      hit++;
+    } else {
+      miss++;
+    }
+  }
+  return hit == 0 ? DISCARDED : (miss == 0 ? ENQUEUED : PARTIALLY_ENQUEUED);
+}
+
+uint16_t AsyncWebSocket::_getChannelId(const char *channel) {
+  if (!channel || !*channel) {
+    return 0;
+  }
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_lock);
+#endif
+  for (size_t i = 0; i < _channels.size(); i++) {
+    if (_channels[i] == channel) {
+      return i + 1;
+    }
+  }
+  if (_channels.size() >= ASYNCWEBSERVER_MAX_CHANNELS) {
+    async_ws_log_w("Too many channels: the message is not conflated");
+    return 0;
+  }
+  _channels.emplace_back(channel);
+  return _channels.size();
+}
+
+AsyncWebSocket::SendStatus AsyncWebSocket::publishAll(const char *channel, const uint8_t *message, size_t len, uint8_t opcode) {
+  if (!len) {
+    return DISCARDED;
+  }
+  return _sendFrameAll(makeSharedFrame(opcode, message, len), _getChannelId(channel));
+}
+
+AsyncWebSocket::SendStatus AsyncWebSocket::publishAll(const char *channel, const String &message) {
+  return publishAll(channel, (const uint8_t *)message.c_str(), message.length());
+}
+
 AsyncWebSocket::SendStatus AsyncWebSocket::textAll(const uint8_t *message, size_t len) {
-  return textAll(makeSharedBuffer(message, len));
+  if (!len) {
+    return DISCARDED;
+  }
+  return _sendFrameAll(makeSharedFrame(WS_TEXT, message, len));
 }
 AsyncWebSocket::SendStatus AsyncWebSocket::textAll(const char *message, size_t len) {
   return textAll((const uint8_t *)message, len);
@@ -994,6 +1235,9 @@ AsyncWebSocket::SendStatus AsyncWebSocket::textAll(AsyncWebSocketMessageBuffer *
 }
 
 AsyncWebSocket::SendStatus AsyncWebSocket::textAll(AsyncWebSocketSharedBuffer buffer) {
+  if (encodeSharedBuffer(buffer, WS_TEXT)) {
+    return _sendFrameAll(std::move(buffer));
+  }
   size_t hit = 0;
   size_t miss = 0;
   for (auto &c : _clients) {
@@ -1048,7 +1292,10 @@ bool AsyncWebSocket::binary(uint32_t id, AsyncWebSocketSharedBuffer buffer) {
 }
 
 AsyncWebSocket::SendStatus AsyncWebSocket::binaryAll(const uint8_t *message, size_t len) {
-  return binaryAll(makeSharedBuffer(message, len));
+  if (!len) {
+    return DISCARDED;
+  }
+  return _sendFrameAll(makeSharedFrame(WS_BINARY, message, len));
 }
 AsyncWebSocket::SendStatus AsyncWebSocket::binaryAll(const char *message, size_t len) {
   return binaryAll((const uint8_t *)message, len);
@@ -1083,6 +1330,9 @@ AsyncWebSocket::SendStatus AsyncWebSocket::binaryAll(AsyncWebSocketMessageBuffer
   return status;
 }
 AsyncWebSocket::SendStatus AsyncWebSocket::binaryAll(AsyncWebSocketSharedBuffer buffer) {
+  if (encodeSharedBuffer(buffer, WS_BINARY)) {
+    return _sendFrameAll(std::move(buffer));
+  }
   size_t hit = 0;
   size_t miss = 0;
   for (auto &c : _clients) {
@@ -1219,6 +1469,7 @@ void AsyncWebSocket::handleRequest(AsyncWebServerRequest *request) {
   AsyncWebServerResponse *response = new AsyncWebSocketResponse(key->value(), this);
   if (response == NULL) {
     async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
     request->abort();
     return;
   }
@@ -1257,6 +1508,7 @@ AsyncWebSocketResponse::AsyncWebSocketResponse(const String &key, AsyncWebSocket
   String k;
   if (!k.reserve(key.length() + WS_STR_UUID_LEN)) {
     async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
     return;
   }
   k.concat(key);
@@ -1305,3 +1557,147 @@ size_t AsyncWebSocketResponse::_ack(AsyncWebServerRequest *request, size_t len,
 
   return 0;
 }
+
+/*
+ * Message handler - reassembles the messages received in several pieces
+ */
+
+void AsyncWebSocketMessageHandler::_onData(AsyncWebSocket *server, AsyncWebSocketClient *client, const AwsFrameInfo *info, const uint8_t *data, size_t len) {
+  const uint32_t id = client->id();
+  Assembly *assembly = nullptr;
+  for (Assembly &a : _assemblies) {
+    if (a.clientId == id) {
+      assembly = &a;
+      break;
+    }
+  }
+  const bool first = info->num == 0 && info->index == 0;
+  if (!assembly) {
+    if (!first) {
+      // rest of a message whose beginning was not received
+      return;
+    }
+    _assemblies.push_back({id, Buffer(), 0, false});
+    assembly = &_assemblies.back();
+  } else if (assembly->rejected) {
+    return;
+  } else if (first) {
+    // the previous message was never completed
+    assembly->len = 0;
+  }
+
+  if (info->index == 0) {
+    // start of a frame: its length is known, the buffer is grown for all of it (and the null terminator) at once
+    if (assembly->len > _maxMessageSize || info->len > _maxMessageSize - assembly->len) {
+      _reject(client, *assembly, 1009);
+      return;
+    }
+    if (!_reserve(assembly->buffer, assembly->len + info->len + 1)) {
+      _reject(client, *assembly, 1013);
+      return;
+    }
+  }
+  if (assembly->len + len + 1 > assembly->buffer.capacity) {
+    // more than the frame announced: grown as well, the message staying whole or being rejected
+    if (assembly->len + len > _maxMessageSize) {
+      _reject(client, *assembly, 1009);
+      return;
+    }
+    if (!_reserve(assembly->buffer, assembly->len + len + 1)) {
+      _reject(client, *assembly, 1013);
+      return;
+    }
+  }
+  memcpy(assembly->buffer.data.get() + assembly->len, data, len);
+  assembly->len += len;
+
+  if (info->final && info->index + len == info->len) {
+    // the buffer is taken from the assembly before the callback, which can disconnect the client
+    Buffer buffer = std::move(assembly->buffer);
+    const size_t messageLen = assembly->len;
+    _forget(id);
+    buffer.data.get()[messageLen] = 0;  // null-terminated, for the text messages
+    _onMessage(server, client, buffer.data.get(), messageLen);
+    _recycle(buffer);
+  }
+}
+
+bool AsyncWebSocketMessageHandler::_reserve(Buffer &buffer, size_t size) {
+  if (buffer.capacity >= size) {
+    return true;
+  }
+  if (!buffer.data) {
+    // smallest idle buffer large enough
+    size_t best = _idle.size();
+    for (size_t i = 0; i < _idle.size(); i++) {
+      if (_idle[i].capacity >= size && (best == _idle.size() || _idle[i].capacity < _idle[best].capacity)) {
+        best = i;
+      }
+    }
+    if (best < _idle.size()) {
+      buffer = std::move(_idle[best]);
+      _idle.erase(_idle.begin() + best);
+      return true;
+    }
+  }
+
+  // the idle buffers are freed, largest first, when the pool is full
+  while (_pooled - buffer.capacity + size > _poolSize && !_idle.empty()) {
+    size_t largest = 0;
+    for (size_t i = 1; i < _idle.size(); i++) {
+      if (_idle[i].capacity > _idle[largest].capacity) {
+        largest = i;
+      }
+    }
+    _pooled -= _idle[largest].capacity;
+    _idle.erase(_idle.begin() + largest);
+  }
+  if (_pooled - buffer.capacity + size > _poolSize) {
+    return false;
+  }
+
+  // a fragmented message grows by doubling, ahead of its next frames, when the pool has room for it
+  size_t capacity = size;
+  if (buffer.data) {
+    const size_t doubled = std::min(buffer.capacity * 2, _maxMessageSize + 1);
+    if (doubled > size && _pooled - buffer.capacity + doubled <= _poolSize) {
+      capacity = doubled;
+    }
+  }
+  uint8_t *data = (uint8_t *)reallocateBuffer(AsyncMemoryUse::MESSAGE, buffer.data.get(), capacity);
+  if (!data) {
+    async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
+    return false;
+  }
+  buffer.data.release();
+  buffer.data.reset(data);
+  _pooled += capacity - buffer.capacity;
+  buffer.capacity = capacity;
+  return true;
+}
+
+void AsyncWebSocketMessageHandler::_recycle(Buffer &buffer) {
+  if (buffer.data) {
+    _idle.push_back(std::move(buffer));
+  }
+  buffer.capacity = 0;
+}
+
+void AsyncWebSocketMessageHandler::_reject(AsyncWebSocketClient *client, Assembly &assembly, uint16_t code) {
+  async_ws_log_w("WS[%lu]: message rejected, closing with %u", (unsigned long)client->id(), (unsigned)code);
+  _recycle(assembly.buffer);
+  assembly.len = 0;
+  assembly.rejected = true;
+  client->close(code);
+}
+
+void AsyncWebSocketMessageHandler::_forget(uint32_t clientId) {
+  for (auto it = _assemblies.begin(); it != _assemblies.end(); ++it) {
+    if (it->clientId == clientId) {
+      _recycle(it->buffer);
+      _assemblies.erase(it);
+      return;
+    }
+  }
+}
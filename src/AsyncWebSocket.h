@@ -17,16 +17,25 @@
 #ifndef WS_MAX_QUEUED_MESSAGES
 #define WS_MAX_QUEUED_MESSAGES 32
 #endif
+#ifndef WS_MAX_QUEUED_BYTES
+#define WS_MAX_QUEUED_BYTES 16384
+#endif
 #elif defined(ESP8266)
 #include <ESPAsyncTCP.h>
 #ifndef WS_MAX_QUEUED_MESSAGES
 #define WS_MAX_QUEUED_MESSAGES 8
 #endif
+#ifndef WS_MAX_QUEUED_BYTES
+#define WS_MAX_QUEUED_BYTES 4096
+#endif
 #elif defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
 #include <RPAsyncTCP.h>
 #ifndef WS_MAX_QUEUED_MESSAGES
 #define WS_MAX_QUEUED_MESSAGES 32
 #endif
+#ifndef WS_MAX_QUEUED_BYTES
+#define WS_MAX_QUEUED_BYTES 16384
+#endif
 #endif
 
 #include <ESPAsyncWebServer.h>
@@ -49,6 +58,22 @@
 #endif
 #endif
 
+// Longest message reassembled by AsyncWebSocketMessageHandler, and total size of the buffers it keeps for its clients
+#ifndef WS_MAX_MESSAGE_SIZE
+#ifdef ESP8266
+#define WS_MAX_MESSAGE_SIZE 4096
+#else
+#define WS_MAX_MESSAGE_SIZE 16384
+#endif
+#endif
+#ifndef WS_MESSAGE_POOL_SIZE
+#ifdef ESP8266
+#define WS_MESSAGE_POOL_SIZE 8192
+#else
+#define WS_MESSAGE_POOL_SIZE 32768
+#endif
+#endif
+
 using AsyncWebSocketSharedBuffer = std::shared_ptr<std::vector<uint8_t>>;
 
 class AsyncWebSocket;
@@ -186,23 +211,48 @@ private:
   AsyncWebSocketSharedBuffer _WSbuffer;
   uint8_t _opcode{WS_TEXT};
   bool _mask{false};
+  bool _encoded{false};  // the buffer is a complete frame, header included
+  uint16_t _channel{0};  // conflating channel of the message, 0 for none
   AwsMessageStatus _status{WS_MSG_ERROR};
   size_t _sent{};
   size_t _ack{};
   size_t _acked{};
 
 public:
-  AsyncWebSocketMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT, bool mask = false);
+  AsyncWebSocketMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT, bool mask = false, bool encoded = false, uint16_t channel = 0);
 
   bool finished() const {
     return _status != WS_MSG_SENDING;
   }
-  bool betweenFrames() const {
+  bool acked() const {
     return _acked == _ack;
   }
+  bool betweenFrames() const {
+    // an encoded frame is sent in several parts: nothing else can be sent before its end
+    return _acked == _ack && (!_encoded || !_sent);
+  }
 
-  void ack(size_t len, uint32_t time);
-  size_t send(AsyncClient *client);
+  // whether all the message has been written and only waits for its ack
+  bool sent() const {
+    return _sent == _WSbuffer->size();
+  }
+  // whether the rest of the message can be written at once in a send window of the given size
+  bool fits(size_t window) const {
+    return _WSbuffer->size() - _sent <= window;
+  }
+  size_t length() const {
+    return _WSbuffer->size();
+  }
+  uint16_t channel() const {
+    return _channel;
+  }
+  // replaces the content of a message not started yet, returns false if it has already been (partly) written
+  bool replace(AsyncWebSocketSharedBuffer buffer, uint8_t opcode, bool encoded);
+
+  // returns the number of acked bytes exceeding what the message waits for, to carry over to the next message
+  size_t ack(size_t len, uint32_t time);
+  // flush = false leaves the added data in the socket buffer for a later client->send()
+  size_t send(AsyncClient *client, bool flush = true);
 };
 
 class AsyncWebSocketClient {
@@ -217,6 +267,8 @@ private:
   std::deque<AsyncWebSocketControl> _controlQueue;
   std::deque<AsyncWebSocketMessage> _messageQueue;
   bool closeWhenFull = true;
+  size_t _maxQueuedBytes = 0;  // non-zero in coalescing mode
+  size_t _queuedBytes = 0;
 
   uint8_t _pstate;
   AwsFrameInfo _pinfo;
@@ -225,9 +277,13 @@ private:
   uint32_t _keepAlivePeriod;
 
   bool _queueControl(uint8_t opcode, const uint8_t *data = NULL, size_t len = 0, bool mask = false);
-  bool _queueMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT, bool mask = false);
+  bool _queueMessage(AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT, bool mask = false, bool encoded = false, uint16_t channel = 0);
   void _runQueue();
+  void _runBatch();
   void _clearQueue();
+  bool _queueFull(size_t len) const;
+
+  friend class AsyncWebSocket;
 
 public:
   void *_tempObject;
@@ -283,6 +339,17 @@ public:
     return closeWhenFull;
   }
 
+  /**
+   * @brief Coalescing mode: the small messages waiting in the queue are written together, in a single send of the socket,
+   * instead of one message per ack received, and the queue is limited by the bytes it holds instead of its number of messages.
+   * A queue holding a single message accepts it whatever its length.
+   * @param maxQueuedBytes limit of the queue in bytes, 0 to go back to WS_MAX_QUEUED_MESSAGES messages (default)
+   */
+  void setCoalescing(size_t maxQueuedBytes = WS_MAX_QUEUED_BYTES);
+  bool coalescing() const {
+    return _maxQueuedBytes != 0;
+  }
+
   IPAddress remoteIP() const;
   uint16_t remotePort() const;
 
@@ -325,6 +392,22 @@ public:
   bool binary(const String &message);
   bool binary(AsyncWebSocketMessageBuffer *buffer);
 
+  /**
+   * @brief Queues the latest value of a conflating channel, such as "temperature":
+   * the message replaces the value of the same channel still waiting in the queue, if any,
+   * so that a slow client gets the latest state without filling its queue with outdated values.
+   * A value already being sent is not replaced: the new one is queued after it.
+   * Beyond ASYNCWEBSERVER_MAX_CHANNELS names, the messages of a new channel are queued like send() ones.
+   *
+   * @param channel name of the channel
+   * @param buffer payload of the message
+   * @param opcode WS_TEXT or WS_BINARY
+   * @return true if the message was queued or replaced the waiting one
+   */
+  bool publish(const char *channel, AsyncWebSocketSharedBuffer buffer, uint8_t opcode = WS_TEXT);
+  bool publish(const char *channel, const uint8_t *message, size_t len, uint8_t opcode = WS_TEXT);
+  bool publish(const char *channel, const String &message);
+
   bool canSend() const;
 
   // system callbacks (do not call)
@@ -354,6 +437,8 @@ private:
   AwsEventHandler _eventHandler;
   AwsHandshakeHandler _handshakeHandler;
   bool _enabled;
+  size_t _maxQueuedBytes = 0;
+  std::vector<String> _channels;  // names of the conflating channels, their id being their index + 1
 #ifdef ESP32
   mutable std::mutex _lock;
 #endif
@@ -365,6 +450,12 @@ public:
     PARTIALLY_ENQUEUED = 2,
   } SendStatus;
 
+private:
+  // queues the same encoded frame to all the clients
+  SendStatus _sendFrameAll(AsyncWebSocketSharedBuffer frame, uint16_t channel = 0);
+
+public:
+
   explicit AsyncWebSocket(const char *url, AwsEventHandler handler = nullptr) : _url(url), _cNextId(1), _eventHandler(handler), _enabled(true) {}
   AsyncWebSocket(const String &url, AwsEventHandler handler = nullptr) : _url(url), _cNextId(1), _eventHandler(handler), _enabled(true) {}
   ~AsyncWebSocket(){};
@@ -380,6 +471,12 @@ public:
   bool availableForWriteAll();
   bool availableForWrite(uint32_t id);
 
+  /**
+   * @brief Puts the clients in coalescing mode (see AsyncWebSocketClient::setCoalescing()), the connected ones and the next ones
+   * @param maxQueuedBytes limit of each client queue in bytes, 0 to disable
+   */
+  void setCoalescing(size_t maxQueuedBytes = WS_MAX_QUEUED_BYTES);
+
   size_t count() const;
   AsyncWebSocketClient *client(uint32_t id);
   bool hasClient(uint32_t id) {
@@ -424,6 +521,10 @@ public:
   size_t printf(uint32_t id, const char *format, ...) __attribute__((format(printf, 3, 4)));
   size_t printfAll(const char *format, ...) __attribute__((format(printf, 2, 3)));
 
+  // latest value of a conflating channel for all the clients, see AsyncWebSocketClient::publish()
+  SendStatus publishAll(const char *channel, const uint8_t *message, size_t len, uint8_t opcode = WS_TEXT);
+  SendStatus publishAll(const char *channel, const String &message);
+
 #ifdef ESP8266
   bool text(uint32_t id, const __FlashStringHelper *message);
   SendStatus textAll(const __FlashStringHelper *message);
@@ -444,10 +545,14 @@ public:
   uint32_t _getNextId() {
     return _cNextId++;
   }
+  uint16_t _getChannelId(const char *channel);
   AsyncWebSocketClient *_newClient(AsyncWebServerRequest *request);
   void _handleDisconnect(AsyncWebSocketClient *client);
   void _handleEvent(AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len);
   bool canHandle(AsyncWebServerRequest *request) const override final;
+  const String &routeUri() const override final {
+    return _url;
+  }
   void handleRequest(AsyncWebServerRequest *request) override final;
 
   //  messagebuffer functions/objects.
@@ -500,13 +605,16 @@ public:
   /**
    * Complete message callback
    * @param data pointer to the data (binary or null-terminated string). This handler expects the user to know which data type he uses.
+   * Unless onFragment() is set, the messages received in several pieces (fragmented messages, or frames split over several
+   * TCP segments) are reassembled before being passed to this callback: the data is only valid during the call.
    */
   void onMessage(std::function<void(AsyncWebSocket *server, AsyncWebSocketClient *client, const uint8_t *data, size_t len)> onMessage) {
     _onMessage = onMessage;
   }
 
   /**
-   * Fragmented message callback
+   * Fragmented message callback: when set, the pieces of the messages received in several pieces are passed to it as they
+   * are received instead of being reassembled for onMessage()
    * @param data pointer to the data (binary or null-terminated string), will be null-terminated. This handler expects the user to know which data type he uses.
    */
   // clang-format off
@@ -515,6 +623,21 @@ public:
   }
   // clang-format on
 
+  /**
+   * @brief Sets the longest message reassembled (WS_MAX_MESSAGE_SIZE by default): the clients sending a longer one are
+   * disconnected with the close code 1009 (message too big), as soon as its length exceeds this size
+   */
+  void setMaxMessageSize(size_t size) {
+    _maxMessageSize = size;
+  }
+  /**
+   * @brief Sets the total size of the reassembly buffers, in use or kept for the next messages (WS_MESSAGE_POOL_SIZE by
+   * default): a client whose message does not fit in what remains is disconnected with the close code 1013 (try again later)
+   */
+  void setPoolSize(size_t size) {
+    _poolSize = size;
+  }
+
 private:
   // clang-format off
   std::function<void(AsyncWebSocket *server, AsyncWebSocketClient *client)> _onConnect;
@@ -524,13 +647,37 @@ private:
   std::function<void(AsyncWebSocket *server, uint32_t clientId)> _onDisconnect;
   // clang-format on
 
-  // this handler is meant to only support 1-frame messages (== unfragmented messages)
+  // Reassembly of the messages received in several pieces, in buffers drawn from a pool shared by the clients: the buffers
+  // of the complete messages are kept for the next ones, within _poolSize bytes for all of them
+  struct Buffer {
+    std::unique_ptr<uint8_t, asyncsrv::BufferDeleter> data;
+    size_t capacity = 0;
+  };
+  struct Assembly {
+    uint32_t clientId;
+    Buffer buffer;
+    size_t len;
+    bool rejected;  // the client is being disconnected, the rest of its data is ignored
+  };
+  std::vector<Assembly> _assemblies;
+  std::vector<Buffer> _idle;
+  size_t _pooled = 0;  // capacity of all the buffers, in use or idle
+  size_t _maxMessageSize = WS_MAX_MESSAGE_SIZE;
+  size_t _poolSize = WS_MESSAGE_POOL_SIZE;
+
+  void _onData(AsyncWebSocket *server, AsyncWebSocketClient *client, const AwsFrameInfo *info, const uint8_t *data, size_t len);
+  bool _reserve(Buffer &buffer, size_t size);
+  void _recycle(Buffer &buffer);
+  void _reject(AsyncWebSocketClient *client, Assembly &assembly, uint16_t code);
+  void _forget(uint32_t clientId);
+
   AwsEventHandler _handler = [this](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
     if (type == WS_EVT_CONNECT) {
       if (_onConnect) {
         _onConnect(server, client);
       }
     } else if (type == WS_EVT_DISCONNECT) {
+      _forget(client->id());
       if (_onDisconnect) {
         _onDisconnect(server, client->id());
       }
@@ -540,17 +687,18 @@ private:
       }
     } else if (type == WS_EVT_DATA) {
       AwsFrameInfo *info = (AwsFrameInfo *)arg;
-      if (info->opcode == WS_TEXT) {
+      if (info->message_opcode == WS_TEXT) {
         data[len] = 0;
       }
-      if (info->final && info->index == 0 && info->len == len) {
+      if (info->final && info->num == 0 && info->index == 0 && info->len == len) {
+        // whole message at once: passed as is, without copying it
         if (_onMessage) {
           _onMessage(server, client, data, len);
         }
-      } else {
-        if (_onFragment) {
-          _onFragment(server, client, info, data, len);
-        }
+      } else if (_onFragment) {
+        _onFragment(server, client, info, data, len);
+      } else if (_onMessage) {
+        _onData(server, client, info, data, len);
       }
     }
   };
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <new>
+
+#ifdef ESP32
+#include <mutex>
+#endif
+
+// Number of AsyncWebServerRequest objects preallocated in a static pool (0 disables the pools).
+// Requests are taken from the pool when a client connects and given back on disconnect,
+// the heap is only used when all the pool slots are in use.
+#ifndef ASYNCWEBSERVER_REQUEST_POOL_SIZE
+#define ASYNCWEBSERVER_REQUEST_POOL_SIZE 0
+#endif
+
+// Number of headers, parameters and path parameters which can be stored in the pools for each pooled request
+#ifndef ASYNCWEBSERVER_REQUEST_POOL_ITEMS
+#define ASYNCWEBSERVER_REQUEST_POOL_ITEMS 16
+#endif
+
+namespace asyncsrv {
+
+/**
+ * @brief Fixed-size block allocator over a static slab.
+ * One slab exists for each block size: all the types of the same size share the same blocks.
+ * Blocks are handed out in order first, then recycled through a free list.
+ */
+template <size_t BlockSize, size_t BlockCount> class BlockPool {
+private:
+  union Block {
+    Block *next;
+    alignas(std::max_align_t) uint8_t data[BlockSize];
+  };
+
+  static Block _blocks[BlockCount];
+  static Block *_free;
+  static size_t _carved;
+#ifdef ESP32
+  static std::mutex _lock;
+#endif
+
+public:
+  /**
+   * @brief Returns a free block, or nullptr if the pool is exhausted
+   */
+  static void *allocate() {
+#ifdef ESP32
+    std::lock_guard<std::mutex> lock(_lock);
+#endif
+    if (_free) {
+      Block *block = _free;
+      _free = block->next;
+      return block;
+    }
+    if (_carved < BlockCount) {
+      return &_blocks[_carved++];
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief Gives back a block previously returned by allocate()
+   */
+  static void deallocate(void *ptr) {
+#ifdef ESP32
+    std::lock_guard<std::mutex> lock(_lock);
+#endif
+    Block *block = static_cast<Block *>(ptr);
+    block->next = _free;
+    _free = block;
+  }
+
+  /**
+   * @brief Returns true if the pointer is a block of this pool
+   */
+  static bool owns(const void *ptr) {
+    return ptr >= static_cast<const void *>(_blocks) && ptr < static_cast<const void *>(_blocks + BlockCount);
+  }
+};
+
+template <size_t BlockSize, size_t BlockCount> typename BlockPool<BlockSize, BlockCount>::Block BlockPool<BlockSize, BlockCount>::_blocks[BlockCount];
+template <size_t BlockSize, size_t BlockCount> typename BlockPool<BlockSize, BlockCount>::Block *BlockPool<BlockSize, BlockCount>::_free = nullptr;
+template <size_t BlockSize, size_t BlockCount> size_t BlockPool<BlockSize, BlockCount>::_carved = 0;
+#ifdef ESP32
+template <size_t BlockSize, size_t BlockCount> std::mutex BlockPool<BlockSize, BlockCount>::_lock;
+#endif
+
+/**
+ * @brief Allocator for node based containers (std::list) taking their nodes from a BlockPool,
+ * falling back to the heap when the pool is exhausted or for array allocations.
+ */
+template <typename T, size_t BlockCount> class PoolAllocator {
+private:
+  using Pool = BlockPool<sizeof(T), BlockCount>;
+
+public:
+  using value_type = T;
+
+  template <typename U> struct rebind {
+    using other = PoolAllocator<U, BlockCount>;
+  };
+
+  PoolAllocator() noexcept = default;
+  template <typename U> PoolAllocator(const PoolAllocator<U, BlockCount> &) noexcept {}
+
+  T *allocate(size_t n) {
+    if (n == 1) {
+      void *ptr = Pool::allocate();
+      if (ptr) {
+        return static_cast<T *>(ptr);
+      }
+    }
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n) noexcept {
+    if (n == 1 && Pool::owns(ptr)) {
+      Pool::deallocate(ptr);
+    } else {
+      ::operator delete(ptr);
+    }
+  }
+
+  template <typename U> bool operator==(const PoolAllocator<U, BlockCount> &) const noexcept {
+    return true;
+  }
+  template <typename U> bool operator!=(const PoolAllocator<U, BlockCount> &) const noexcept {
+    return false;
+  }
+};
+
+// list type used by the requests to store their headers and parameters
+#if ASYNCWEBSERVER_REQUEST_POOL_SIZE
+template <typename T> using request_list = std::list<T, PoolAllocator<T, ASYNCWEBSERVER_REQUEST_POOL_SIZE * ASYNCWEBSERVER_REQUEST_POOL_ITEMS>>;
+#else
+template <typename T> using request_list = std::list<T>;
+#endif
+
+}  // namespace asyncsrv
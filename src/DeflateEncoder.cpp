@@ -0,0 +1,259 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+#include "DeflateEncoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace asyncsrv {
+
+static constexpr size_t MIN_MATCH = 3;
+static constexpr size_t MAX_MATCH = 258;
+
+static constexpr uint8_t hashBits(size_t entries) {
+  return entries > 1 ? 1 + hashBits(entries / 2) : 0;
+}
+// one entry for each 2 bytes of history
+static constexpr uint8_t HASH_BITS = hashBits(DeflateEncoder::WINDOW / 2);
+static constexpr size_t HASH_SIZE = (size_t)1 << HASH_BITS;
+
+// worst case of the fixed Huffman codes: 9 bits per byte, plus the header or the trailer
+static constexpr size_t OUT_SIZE = DeflateEncoder::WINDOW + DeflateEncoder::WINDOW / 8 + 32;
+
+// RFC 1951 3.2.5: length codes 257 to 285, distance codes 0 to 29
+static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distanceBase[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                          193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static uint32_t hash3(const uint8_t *p) {
+  return (((uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2]) * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// CRC-32 (gzip), by nibbles to keep the table small
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len) {
+  static const uint32_t table[16] = {0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+                                     0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ table[crc & 0x0f];
+    crc = (crc >> 4) ^ table[crc & 0x0f];
+  }
+  return ~crc;
+}
+
+static uint32_t adler32(uint32_t adler, const uint8_t *data, size_t len) {
+  uint32_t a = adler & 0xffff;
+  uint32_t b = adler >> 16;
+  while (len) {
+    // 5552 bytes can be summed before b overflows
+    size_t n = len < 5552 ? len : 5552;
+    len -= n;
+    while (n--) {
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return b << 16 | a;
+}
+
+DeflateEncoder::~DeflateEncoder() {
+  free(_window);
+}
+
+bool DeflateEncoder::begin(Format format) {
+  free(_window);
+  // a single block for the window, the hash table and the output
+  _window = (uint8_t *)malloc(2 * WINDOW + HASH_SIZE * sizeof(uint16_t) + OUT_SIZE);
+  if (!_window) {
+    return false;
+  }
+  _head = (uint16_t *)(_window + 2 * WINDOW);
+  _out = (uint8_t *)(_head + HASH_SIZE);
+  memset(_head, 0, HASH_SIZE * sizeof(uint16_t));
+
+  _format = format;
+  _history = 0;
+  _outLen = 0;
+  _outPos = 0;
+  _bits = 0;
+  _bitCount = 0;
+  _finished = false;
+  _size = 0;
+
+  if (_format == Format::GZIP) {
+    // magic, deflate, no flags, no time, no extra flags, unknown OS
+    static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+    memcpy(_out, header, sizeof(header));
+    _outLen = sizeof(header);
+    _checksum = 0;
+  } else {
+    // deflate, 32K window at most, no dictionary, fastest level
+    _putByte(0x78);
+    _putByte(0x01);
+    _checksum = 1;
+  }
+  // first and last block, until finish(): not final, fixed Huffman codes
+  _putBits(0, 1);
+  _putBits(1, 2);
+  return true;
+}
+
+void DeflateEncoder::_putBits(uint32_t value, uint8_t count) {
+  _bits |= value << _bitCount;
+  _bitCount += count;
+  while (_bitCount >= 8) {
+    _putByte(_bits & 0xff);
+    _bits >>= 8;
+    _bitCount -= 8;
+  }
+}
+
+// Huffman codes are stored starting from their most significant bit
+void DeflateEncoder::_putCode(uint16_t code, uint8_t count) {
+  uint16_t reversed = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  _putBits(reversed, count);
+}
+
+// RFC 1951 3.2.6: fixed literal / length codes
+void DeflateEncoder::_putLiteral(uint16_t symbol) {
+  if (symbol < 144) {
+    _putCode(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    _putCode(0x190 + symbol - 144, 9);
+  } else if (symbol < 280) {
+    _putCode(symbol - 256, 7);
+  } else {
+    _putCode(0xc0 + symbol - 280, 8);
+  }
+}
+
+void DeflateEncoder::_putMatch(size_t length, size_t distance) {
+  size_t code = 28;
+  while (lengthBase[code] > length) {
+    code--;
+  }
+  _putLiteral(257 + code);
+  _putBits(length - lengthBase[code], lengthExtra[code]);
+
+  code = 29;
+  while (distanceBase[code] > distance) {
+    code--;
+  }
+  _putCode(code, 5);
+  _putBits(distance - distanceBase[code], distanceExtra[code]);
+}
+
+void DeflateEncoder::_flushBits() {
+  if (_bitCount) {
+    _putByte(_bits & 0xff);
+  }
+  _bits = 0;
+  _bitCount = 0;
+}
+
+void DeflateEncoder::compress(size_t len) {
+  if (!len || _finished || !_window) {
+    return;
+  }
+  if (len > WINDOW) {
+    len = WINDOW;
+  }
+  const uint8_t *data = _window + _history;
+  _checksum = _format == Format::GZIP ? crc32(_checksum, data, len) : adler32(_checksum, data, len);
+  _size += len;
+
+  // greedy matching against the last position of the same 3 bytes, the matches do not extend past this input
+  const size_t end = _history + len;
+  size_t pos = _history;
+  while (pos < end) {
+    size_t length = 0;
+    size_t distance = 0;
+    if (end - pos >= MIN_MATCH) {
+      const uint32_t h = hash3(_window + pos);
+      const size_t candidate = _head[h];
+      _head[h] = pos + 1;
+      if (candidate && pos - (candidate - 1) <= WINDOW) {
+        const uint8_t *a = _window + candidate - 1;
+        const uint8_t *b = _window + pos;
+        const size_t max = end - pos < MAX_MATCH ? end - pos : MAX_MATCH;
+        while (length < max && a[length] == b[length]) {
+          length++;
+        }
+        distance = pos - (candidate - 1);
+      }
+    }
+    if (length >= MIN_MATCH) {
+      _putMatch(length, distance);
+      // the positions inside the match can be matched by the next bytes
+      for (size_t i = 1; i < length && end - (pos + i) >= MIN_MATCH; i++) {
+        _head[hash3(_window + pos + i)] = pos + i + 1;
+      }
+      pos += length;
+    } else {
+      _putLiteral(_window[pos]);
+      pos++;
+    }
+  }
+
+  // keep the last WINDOW bytes as the history of the next input
+  _history = end;
+  if (_history > WINDOW) {
+    const size_t shift = _history - WINDOW;
+    memmove(_window, _window + shift, WINDOW);
+    for (size_t i = 0; i < HASH_SIZE; i++) {
+      _head[i] = _head[i] > shift ? _head[i] - shift : 0;
+    }
+    _history = WINDOW;
+  }
+}
+
+void DeflateEncoder::finish() {
+  if (_finished || !_window) {
+    return;
+  }
+  // end of the block, then an empty final block
+  _putLiteral(256);
+  _putBits(1, 1);
+  _putBits(1, 2);
+  _putLiteral(256);
+  _flushBits();
+
+  if (_format == Format::GZIP) {
+    for (uint8_t i = 0; i < 32; i += 8) {
+      _putByte((_checksum >> i) & 0xff);
+    }
+    for (uint8_t i = 0; i < 32; i += 8) {
+      _putByte((_size >> i) & 0xff);
+    }
+  } else {
+    for (int8_t i = 24; i >= 0; i -= 8) {
+      _putByte((_checksum >> i) & 0xff);
+    }
+  }
+  _finished = true;
+}
+
+size_t DeflateEncoder::read(uint8_t *out, size_t len) {
+  const size_t available = _outLen - _outPos;
+  if (len > available) {
+    len = available;
+  }
+  memcpy(out, _out + _outPos, len);
+  _outPos += len;
+  if (_outPos == _outLen) {
+    _outPos = 0;
+    _outLen = 0;
+  }
+  return len;
+}
+
+}  // namespace asyncsrv
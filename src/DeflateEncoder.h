@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Size of the history searched for repeated content by the on-the-fly compression of the responses.
+// Each compressed response allocates about 4 times this size while it is sent, in a single block.
+#ifndef ASYNCWEBSERVER_DEFLATE_WINDOW
+#ifdef ESP8266
+#define ASYNCWEBSERVER_DEFLATE_WINDOW 1024
+#else
+#define ASYNCWEBSERVER_DEFLATE_WINDOW 2048
+#endif
+#endif
+
+// Smallest content compressed on the fly, when its length is known: below, the gzip header and trailer outweigh the gain
+#ifndef ASYNCWEBSERVER_COMPRESS_MIN_SIZE
+#define ASYNCWEBSERVER_COMPRESS_MIN_SIZE 256
+#endif
+
+namespace asyncsrv {
+
+/**
+ * @brief Streaming gzip / zlib encoder, with a bounded memory use.
+ * The content goes through a single deflate block with the fixed Huffman codes, matched against the last
+ * ASYNCWEBSERVER_DEFLATE_WINDOW bytes: text such as JSON or CSV still compresses several times.
+ *
+ * Usage: begin(), then repeatedly read() the pending output and, once it is drained, write up to inputSpace() bytes
+ * at input() and compress() them. finish() ends the stream: finished() is true once its last bytes are read.
+ */
+class DeflateEncoder {
+public:
+  enum class Format : uint8_t {
+    GZIP,  // Content-Encoding: gzip
+    ZLIB   // Content-Encoding: deflate
+  };
+
+  static constexpr size_t WINDOW = ASYNCWEBSERVER_DEFLATE_WINDOW;
+  static_assert(WINDOW >= 256 && WINDOW <= 16384, "ASYNCWEBSERVER_DEFLATE_WINDOW must be between 256 and 16384");
+
+  DeflateEncoder() = default;
+  ~DeflateEncoder();
+  DeflateEncoder(const DeflateEncoder &) = delete;
+  DeflateEncoder &operator=(const DeflateEncoder &) = delete;
+
+  // allocates the buffers and writes the header of the stream, returns false if the allocation failed
+  bool begin(Format format);
+
+  uint8_t *input() {
+    return _window + _history;
+  }
+  // space at input(), only available once the pending output is read
+  size_t inputSpace() const {
+    return _outPos < _outLen ? 0 : WINDOW;
+  }
+  // compresses the len bytes written at input()
+  void compress(size_t len);
+  // ends the stream, once the pending output is read
+  void finish();
+
+  // moves up to len bytes of pending output to out
+  size_t read(uint8_t *out, size_t len);
+  bool finished() const {
+    return _finished && _outPos == _outLen;
+  }
+
+private:
+  uint8_t *_window = nullptr;  // history then input, 2 * WINDOW bytes
+  uint16_t *_head = nullptr;   // last position + 1 of each hash of 3 bytes in _window, 0 if none
+  uint8_t *_out = nullptr;     // output of the last input
+  size_t _history = 0;
+  size_t _outLen = 0;
+  size_t _outPos = 0;
+  uint32_t _bits = 0;
+  uint8_t _bitCount = 0;
+  Format _format = Format::GZIP;
+  bool _finished = false;
+  uint32_t _checksum = 0;  // CRC-32 for gzip, Adler-32 for zlib
+  uint32_t _size = 0;
+
+  void _putBits(uint32_t value, uint8_t count);
+  void _putCode(uint16_t code, uint8_t count);
+  void _putLiteral(uint16_t symbol);
+  void _putMatch(size_t length, size_t distance);
+  void _putByte(uint8_t byte) {
+    _out[_outLen++] = byte;
+  }
+  void _flushBits();
+};
+
+}  // namespace asyncsrv
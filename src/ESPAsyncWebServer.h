@@ -15,6 +15,10 @@
 #include <unordered_map>
 #include <vector>
 
+#ifdef ESP32
+#include <mutex>
+#endif
+
 #if defined(ESP32) || defined(LIBRETINY)
 #include <AsyncTCP.h>
 #elif defined(ESP8266)
@@ -28,6 +32,10 @@
 #endif
 
 #include "literals.h"
+#include "BlockPool.h"
+#include "AsyncWebServerMemory.h"
+#include "SmallVector.h"
+#include "AsyncWebServerMetrics.h"
 
 #include "AsyncWebServerVersion.h"
 #define ASYNCWEBSERVER_FORK_ESP32Async
@@ -44,6 +52,75 @@
 #define ASYNCWEBSERVER_USE_CHUNK_INFLIGHT 1
 #endif
 
+// HTTP/1.1 persistent connections are opt-in, see AsyncWebServer::setKeepAlive()
+// Default number of seconds a kept-alive connection can stay idle, waiting for the next request
+#ifndef ASYNCWEBSERVER_KEEPALIVE_TIMEOUT
+#define ASYNCWEBSERVER_KEEPALIVE_TIMEOUT 5
+#endif
+// Default maximum number of requests served over a single connection (0 means unlimited)
+#ifndef ASYNCWEBSERVER_KEEPALIVE_MAX_REQUESTS
+#define ASYNCWEBSERVER_KEEPALIVE_MAX_REQUESTS 100
+#endif
+// Maximum number of parent paths of a request URL having some routes (beyond that, all the handlers are tried in order)
+#ifndef ASYNCWEBSERVER_ROUTE_MAX_DEPTH
+#define ASYNCWEBSERVER_ROUTE_MAX_DEPTH 8
+#endif
+// Maximum number of bytes of pipelined requests that are buffered while the current response is being sent
+#ifndef ASYNCWEBSERVER_KEEPALIVE_PIPELINE_SIZE
+#define ASYNCWEBSERVER_KEEPALIVE_PIPELINE_SIZE 2048
+#endif
+// Maximum number of paths remembered by the file cache of each AsyncStaticWebHandler, see AsyncStaticWebHandler::enableCache()
+#ifndef ASYNCWEBSERVER_STATIC_CACHE_ENTRIES
+#define ASYNCWEBSERVER_STATIC_CACHE_ENTRIES 32
+#endif
+// Maximum number of template files and PROGMEM contents whose placeholder positions are remembered (0 disables the scan of the templates before sending them)
+#ifndef ASYNCWEBSERVER_TEMPLATE_INDEX_ENTRIES
+#define ASYNCWEBSERVER_TEMPLATE_INDEX_ENTRIES 8
+#endif
+// Maximum number of ranges of a Range request header, a request asking for more ranges receives the whole content
+#ifndef ASYNCWEBSERVER_MAX_RANGES
+#define ASYNCWEBSERVER_MAX_RANGES 8
+#endif
+// Maximum number of conflating channel names of each AsyncWebSocket and AsyncEventSource, see publish():
+// the messages of the next names are queued without conflation
+#ifndef ASYNCWEBSERVER_MAX_CHANNELS
+#define ASYNCWEBSERVER_MAX_CHANNELS 16
+#endif
+// Size of the pages written by AsyncFileBodySink, which buffers two of them per request (a multiple of the flash page size).
+// It must stay below the TCP window: the data is only acknowledged once written, and a full page waits for the next data to be written.
+#ifndef ASYNCWEBSERVER_BODY_SINK_PAGE_SIZE
+#ifdef ESP8266
+#define ASYNCWEBSERVER_BODY_SINK_PAGE_SIZE 1024
+#else
+#define ASYNCWEBSERVER_BODY_SINK_PAGE_SIZE 4096
+#endif
+#endif
+
+#ifdef ESP32
+// Worker tasks running the handlers marked with AsyncCallbackWebHandler::offload(), started by the first offloaded request
+#ifndef ASYNCWEBSERVER_WORKER_TASKS
+#define ASYNCWEBSERVER_WORKER_TASKS 1
+#endif
+// Offloaded requests waiting for a worker: the next ones are answered with a 503
+#ifndef ASYNCWEBSERVER_WORKER_QUEUE_SIZE
+#define ASYNCWEBSERVER_WORKER_QUEUE_SIZE 8
+#endif
+#ifndef ASYNCWEBSERVER_WORKER_STACK_SIZE
+#define ASYNCWEBSERVER_WORKER_STACK_SIZE 8192
+#endif
+#ifndef ASYNCWEBSERVER_WORKER_PRIORITY
+#define ASYNCWEBSERVER_WORKER_PRIORITY 2
+#endif
+// Core of the workers: the other core than the AsyncTCP task when it is pinned to one, otherwise any core
+#ifndef ASYNCWEBSERVER_WORKER_CORE
+#if !CONFIG_FREERTOS_UNICORE && defined(CONFIG_ASYNC_TCP_RUNNING_CORE) && CONFIG_ASYNC_TCP_RUNNING_CORE >= 0
+#define ASYNCWEBSERVER_WORKER_CORE (1 - CONFIG_ASYNC_TCP_RUNNING_CORE)
+#else
+#define ASYNCWEBSERVER_WORKER_CORE tskNO_AFFINITY
+#endif
+#endif
+#endif
+
 class AsyncWebServer;
 class AsyncWebServerRequest;
 class AsyncWebServerResponse;
@@ -52,6 +129,9 @@ class AsyncWebParameter;
 class AsyncWebRewrite;
 class AsyncWebHandler;
 class AsyncStaticWebHandler;
+#ifdef ESP32
+class AsyncFlashWebHandler;
+#endif
 class AsyncCallbackWebHandler;
 class AsyncResponseStream;
 class AsyncMiddlewareChain;
@@ -97,6 +177,10 @@ public:
 // if this value is returned when asked for data, packet will not be sent and you will be asked for data again
 #define RESPONSE_TRY_AGAIN          0xFFFFFFFF
 #define RESPONSE_STREAM_BUFFER_SIZE 1460
+// number of RESPONSE_STREAM_BUFFER_SIZE blocks buffered at most by a streamed AsyncResponseStream
+#ifndef RESPONSE_STREAM_BLOCKS
+#define RESPONSE_STREAM_BLOCKS 4
+#endif
 
 typedef uint16_t WebRequestMethodComposite;
 typedef std::function<void(void)> ArDisconnectHandler;
@@ -178,6 +262,37 @@ public:
   static const AsyncWebHeader parse(const char *data);
 };
 
+/**
+ * @brief Immutable set of headers serialized once, to be added as is to many responses, see AsyncWebServerResponse::addHeaders()
+ *
+ * Suited to the headers sent with every response of an API: CORS, Cache-Control, security headers...
+ * The headers of a block are not seen by getHeader() and are not deduplicated with the other headers of the response:
+ * a block must not contain the headers managed by the response itself (Connection, Content-Length, Content-Type, Transfer-Encoding...).
+ */
+class AsyncHeaderBlock {
+private:
+  String _data;  // "name: value\r\n" lines
+
+public:
+  AsyncHeaderBlock(std::initializer_list<AsyncWebHeader> headers);
+
+  /**
+   * @brief Creates a block to be shared by the responses
+   */
+  static std::shared_ptr<const AsyncHeaderBlock> create(std::initializer_list<AsyncWebHeader> headers) {
+    return std::make_shared<const AsyncHeaderBlock>(headers);
+  }
+
+  const String &data() const {
+    return _data;
+  }
+  size_t length() const {
+    return _data.length();
+  }
+};
+
+using AsyncHeaderBlockPtr = std::shared_ptr<const AsyncHeaderBlock>;
+
 /*
  * REQUEST :: Each incoming Client is wrapped inside a Request and both live together until disconnect
  * */
@@ -203,15 +318,65 @@ typedef enum {
 
 typedef std::function<size_t(uint8_t *, size_t, size_t)> AwsResponseFiller;
 typedef std::function<String(const String &)> AwsTemplateProcessor;
+// Writes the next part of a streamed content, up to stream.room() bytes, and returns false once the content is complete
+typedef std::function<bool(AsyncResponseStream &stream)> AwsResponseStreamProducer;
 
 using AsyncWebServerRequestPtr = std::weak_ptr<AsyncWebServerRequest>;
 
+/**
+ * @brief Writes the body of a request into a file, see AsyncWebServerRequest::sinkBody()
+ *
+ * The body is written by whole pages of ASYNCWEBSERVER_BODY_SINK_PAGE_SIZE bytes, instead of the small and unaligned pieces received from the network.
+ * Two pages are buffered: a full page is written when the next data is received or when the connection is polled, the next page being filled meanwhile.
+ * The data received is only acknowledged to the client once it is written, so that a slow flash closes the TCP window instead of filling the
+ * network buffers. The writes still run on the network task: a slow write delays the other connections as well.
+ */
+class AsyncFileBodySink {
+  using File = fs::File;
+  friend class AsyncWebServerRequest;
+
+private:
+  File _file;
+  size_t _pageSize;
+  uint8_t *_pages = nullptr;    // two pages
+  uint8_t *_pending = nullptr;  // full page waiting to be written
+  uint8_t _active = 0;          // page being filled
+  size_t _fill = 0;
+  size_t _written = 0;
+  size_t _held = 0;  // body bytes received and not acknowledged yet
+  bool _failed;
+
+  bool _writeFile(const uint8_t *data, size_t len);
+  void _write(AsyncClient *client, const uint8_t *data, size_t len, bool last);
+  void _flushPending(AsyncClient *client);
+  void _end(AsyncClient *client);
+
+public:
+  explicit AsyncFileBodySink(File file, size_t pageSize = ASYNCWEBSERVER_BODY_SINK_PAGE_SIZE);
+  ~AsyncFileBodySink();
+
+  /**
+   * @brief Returns true if the file could not be opened or a write failed: the file is incomplete
+   */
+  bool failed() const {
+    return _failed;
+  }
+  /**
+   * @brief Returns the number of bytes written to the file
+   */
+  size_t written() const {
+    return _written;
+  }
+};
+
 class AsyncWebServerRequest {
   using File = fs::File;
   using FS = fs::FS;
   friend class AsyncWebServer;
   friend class AsyncCallbackWebHandler;
   friend class AsyncFileResponse;
+  friend class AsyncWebServerResponse;
+  friend class AsyncAuthenticationMiddleware;
 
 private:
   AsyncClient *_client;
@@ -224,6 +389,18 @@ private:
   bool _paused = false;                          // request is paused (request continuation)
   std::shared_ptr<AsyncWebServerRequest> _this;  // shared pointer to this request
 
+  bool _keepAlive = false;          // connection is kept open for the next request once the response is sent
+  bool _noReuse = false;            // connection must be closed after this request, whatever the Connection header says
+  uint32_t _requestCount = 0;       // number of requests already served over this connection
+#if ASYNCWEBSERVER_METRICS
+  // lifecycle timestamps of the current request, in microseconds
+  uint32_t _tStart = 0;
+  uint32_t _tHeaders = 0;
+  uint32_t _tDispatch = 0;
+  uint32_t _tFirstByte = 0;
+#endif
+  std::vector<uint8_t> _pipelined;  // data of the next request(s) received while the current response is being sent
+
   String _temp;
   uint8_t _parseState;
 
@@ -242,9 +419,9 @@ private:
   size_t _contentLength;
   size_t _parsedLength;
 
-  std::list<AsyncWebHeader> _headers;
-  std::list<AsyncWebParameter> _params;
-  std::list<String> _pathParams;
+  asyncsrv::request_list<AsyncWebHeader> _headers;
+  asyncsrv::request_list<AsyncWebParameter> _params;
+  asyncsrv::request_list<String> _pathParams;
 
   std::unordered_map<const char *, String, std::hash<const char *>, std::equal_to<const char *>> _attributes;
 
@@ -260,6 +437,17 @@ private:
   size_t _itemBufferIndex;
   bool _itemIsFile;
 
+  AsyncFileBodySink *_bodySink = nullptr;
+
+#ifdef ESP32
+  // Handler offloaded to a worker, see AsyncCallbackWebHandler::offload():
+  // _offloading while it is queued or running, guarded by asyncsrv::workerLock() as the disconnection deferred until it returns,
+  // _offloaded until the end of the request, only used by the AsyncTCP task to know when to take this lock
+  bool _offloading = false;
+  bool _offloadDisconnected = false;
+  bool _offloaded = false;
+#endif
+
   void _onPoll();
   void _onAck(size_t len, uint32_t time);
   void _onError(int8_t error);
@@ -269,11 +457,12 @@ private:
 
   void _addPathParam(const char *param);
 
-  bool _parseReqHead();
-  bool _parseReqHeader();
-  void _parseLine();
+  bool _parseReqHead(const char *line, size_t len);
+  bool _parseReqHeader(const char *line, size_t len);
+  void _parseLine(const char *line, size_t len);
   void _parsePlainPostChar(uint8_t data);
   void _parseMultipartPostByte(uint8_t data, bool last);
+  size_t _parseMultipartPostData(uint8_t *data, size_t len);
   void _addGetParams(const String &params);
 
   void _handleUploadStart();
@@ -282,6 +471,18 @@ private:
 
   void _send();
   void _runMiddlewareChain();
+  void _runChains();
+
+  void _pipeline(const uint8_t *data, size_t len);
+  void _endResponse();
+  void _reset();
+#ifdef ESP32
+  bool _offload(const std::function<void(AsyncWebServerRequest *)> &handler);
+  void _runOffloaded(const std::function<void(AsyncWebServerRequest *)> &handler);
+  bool _deferDisconnect();
+  // locks the hand-over of an offloaded request for the AsyncTCP task, returns false while its handler is queued or running
+  bool _lockOffloaded(std::unique_lock<std::recursive_mutex> &lock);
+#endif
 
   static bool _getEtag(File gzFile, char *eTag);
 
@@ -292,12 +493,24 @@ public:
   AsyncWebServerRequest(AsyncWebServer *, AsyncClient *);
   ~AsyncWebServerRequest();
 
+#if ASYNCWEBSERVER_REQUEST_POOL_SIZE
+  // requests are taken from a preallocated pool, see ASYNCWEBSERVER_REQUEST_POOL_SIZE
+  static void *operator new(size_t size) noexcept;
+  static void operator delete(void *ptr) noexcept;
+#endif
+
   AsyncClient *client() {
     return _client;
   }
   uint8_t version() const {
     return _version;
   }
+  /**
+   * @brief Returns true if the connection will be kept open to serve another request once the response is sent
+   */
+  bool keepAlive() const {
+    return _keepAlive;
+  }
   WebRequestMethodComposite method() const {
     return _method;
   }
@@ -317,6 +530,27 @@ public:
     return _isMultipart;
   }
 
+  /**
+   * @brief Writes the body of the request into a file through a write-behind buffer, see AsyncFileBodySink
+   * To be called from a body handler, usually when index is 0: the data given to the handler in this call is written too.
+   * The file is flushed and closed once the body is received, before the request handler runs.
+   * Multipart and form bodies are parsed by the request and never reach the sink.
+   * @param file file opened for writing
+   * @return the sink, or nullptr if it could not be allocated
+   */
+  AsyncFileBodySink *sinkBody(File file);
+  /**
+   * @brief Returns the sink receiving the body of the request, or nullptr
+   */
+  AsyncFileBodySink *bodySink() const {
+    return _bodySink;
+  }
+  /**
+   * @brief Returns false if the authentication or authorization middlewares of the request already reject it from its headers.
+   * The middlewares only run once the body is received: a body handler keeping the body checks this first.
+   */
+  bool bodyAllowed();
+
   const char *methodToString() const;
   const char *requestedConnTypeToString() const;
 
@@ -498,6 +732,19 @@ public:
   AsyncResponseStream *beginResponseStream(const String &contentType, size_t bufferSize = RESPONSE_STREAM_BUFFER_SIZE) {
     return beginResponseStream(contentType.c_str(), bufferSize);
   }
+  /**
+   * @brief Streamed response: the content is sent as the producer writes it, from at most blocks buffers of blockSize bytes,
+   * instead of being buffered whole before the response starts. The producer is called from the network task each time
+   * buffers are free, until it returns false. It can also be written to before sending the response.
+   */
+  AsyncResponseStream *beginResponseStream(
+    const char *contentType, AwsResponseStreamProducer producer, size_t blockSize = RESPONSE_STREAM_BUFFER_SIZE, size_t blocks = RESPONSE_STREAM_BLOCKS
+  );
+  AsyncResponseStream *beginResponseStream(
+    const String &contentType, AwsResponseStreamProducer producer, size_t blockSize = RESPONSE_STREAM_BUFFER_SIZE, size_t blocks = RESPONSE_STREAM_BLOCKS
+  ) {
+    return beginResponseStream(contentType.c_str(), producer, blockSize, blocks);
+  }
 
 #ifndef ESP8266
   [[deprecated("Replaced by beginResponse(int code, const String& contentType, const uint8_t* content, size_t len, AwsTemplateProcessor callback = nullptr)")]]
@@ -642,12 +889,15 @@ public:
     return num < 0 ? nullptr : getHeader((size_t)num);
   };
 
-  const std::list<AsyncWebHeader> &getHeaders() const {
+  const asyncsrv::request_list<AsyncWebHeader> &getHeaders() const {
     return _headers;
   }
 
   size_t getHeaderNames(std::vector<const char *> &names) const;
 
+  // returns true if the Accept-Encoding header of the request accepts this content encoding (gzip, deflate, br...)
+  bool acceptsEncoding(const char *encoding) const;
+
   // Remove a header from the request.
   // It will free the memory and prevent the header to be seen during request processing.
   bool removeHeader(const char *name);
@@ -725,6 +975,21 @@ public:
     return next();
   };
 
+protected:
+  // For internal use only: middlewares only removing request headers can be applied while the headers are parsed,
+  // so that the dropped headers are never allocated
+  virtual bool _filtersHeaders() const {
+    return false;
+  }
+  // For internal use only: returns false if the middleware would remove this header from the request
+  virtual bool _retainHeader(__unused const char *name, __unused size_t len) const {
+    return true;
+  }
+  // For internal use only: returns false if the middleware would reject the request, as far as its headers tell
+  virtual bool _allowsBody(__unused AsyncWebServerRequest *request) const {
+    return true;
+  }
+
 private:
   friend class AsyncWebHandler;
   friend class AsyncEventSource;
@@ -756,6 +1021,8 @@ public:
 
   // For internal use only
   void _runChain(AsyncWebServerRequest *request, ArMiddlewareNext finalizer);
+  bool _retainHeader(const char *name, size_t len) const;
+  bool _allowsBody(AsyncWebServerRequest *request) const;
 
 protected:
   std::list<AsyncMiddleware *> _middlewares;
@@ -770,6 +1037,7 @@ public:
 
   void setRealm(const char *realm) {
     _realm = realm;
+    clearCache();
   }
   void setAuthFailureMessage(const char *message) {
     _authFailMsg = message;
@@ -785,6 +1053,7 @@ public:
   // if a method is set but no username or password is set, authentication will be ignored
   void setAuthType(AsyncAuthType authMethod) {
     _authMethod = authMethod;
+    clearCache();
   }
 
   // precompute and store the hash value based on the username, password, realm.
@@ -797,10 +1066,31 @@ public:
     return _hasCreds;
   }
 
+  // remember the verified credentials for ttlSeconds, in a table of `entries` slots (0 disables the cache, the default).
+  // A repeated Authorization header (basic, bearer), or a digest nonce sent again with a greater nonce count,
+  // is then allowed by a single lookup instead of being verified again.
+  // A cached digest nonce stays bound to the method and uri it was verified for, and its response is still computed again from HA1 on each hit.
+  void setCache(size_t entries, uint32_t ttlSeconds);
+  // also issue a session cookie with this name (empty to disable) after each full verification:
+  // the requests presenting this cookie are then allowed on the cookie alone, until it expires.
+  // The tokens come from the hardware random number generator: no cookie is issued on the targets without one.
+  void setSessionCookie(const char *name) {
+    _sessionCookie = name;
+  }
+  // forget all the cached credentials and sessions
+  void clearCache();
+
   bool allowed(AsyncWebServerRequest *request) const;
 
   void run(AsyncWebServerRequest *request, ArMiddlewareNext next);
 
+protected:
+  bool _allowsBody(AsyncWebServerRequest *request) const override {
+    // checked before run(), which takes the nonce count of the request
+    bool verified;
+    return _allowed(request, verified, false);
+  }
+
 private:
   String _username;
   String _credentials;
@@ -810,6 +1100,27 @@ private:
   AsyncAuthType _authMethod = AsyncAuthType::AUTH_NONE;
   String _authFailMsg;
   bool _hasCreds = false;
+
+  // Verified credential: hash of the Authorization header (or of the digest username, nonce, method and uri, or of the session cookie)
+  struct CacheEntry {
+    uint64_t key;
+    uint32_t expires;  // millis()
+    uint32_t nc;       // last digest nonce count seen
+  };
+  mutable std::vector<CacheEntry> _cache;
+  uint32_t _cacheTTL = 0;
+  String _sessionCookie;
+  String _ha1;  // digest hash of the credentials, when they are not already given hashed
+#ifdef ESP32
+  mutable std::mutex _cacheLock;
+#endif
+  // consume is false to check the request without taking its nonce count, nor caching it
+  bool _allowed(AsyncWebServerRequest *request, bool &verified, bool consume = true) const;
+  uint64_t _credentialKey(AsyncWebServerRequest *request, uint32_t &nc) const;
+  bool _digestMatches(AsyncWebServerRequest *request) const;
+  uint64_t _sessionKey(AsyncWebServerRequest *request) const;
+  bool _lookup(uint64_t key, uint32_t nc, bool consume = true) const;
+  void _store(uint64_t key, uint32_t nc) const;
 };
 
 using ArAuthorizeFunction = std::function<bool(AsyncWebServerRequest *request)>;
@@ -823,12 +1134,19 @@ public:
     return _authz && !_authz(request) ? request->send(_code) : next();
   }
 
+protected:
+  bool _allowsBody(AsyncWebServerRequest *request) const override {
+    return !_authz || _authz(request);
+  }
+
 private:
   int _code;
   ArAuthorizeFunction _authz;
 };
 
 // remove all headers from the incoming request except the ones provided in the constructor
+// When added first to the server middlewares (possibly after other header middlewares), the headers are filtered while the request is parsed:
+// the removed headers are never stored, even for handlers skipping the server middlewares.
 class AsyncHeaderFreeMiddleware : public AsyncMiddleware {
 public:
   void keep(const char *name) {
@@ -840,11 +1158,19 @@ public:
 
   void run(AsyncWebServerRequest *request, ArMiddlewareNext next);
 
+protected:
+  bool _filtersHeaders() const override {
+    return true;
+  }
+  bool _retainHeader(const char *name, size_t len) const override;
+
 private:
   std::list<const char *> _toKeep;
 };
 
 // filter out specific headers from the incoming request
+// When added first to the server middlewares (possibly after other header middlewares), the headers are filtered while the request is parsed:
+// the removed headers are never stored, even for handlers skipping the server middlewares.
 class AsyncHeaderFilterMiddleware : public AsyncMiddleware {
 public:
   void filter(const char *name) {
@@ -856,6 +1182,12 @@ public:
 
   void run(AsyncWebServerRequest *request, ArMiddlewareNext next);
 
+protected:
+  bool _filtersHeaders() const override {
+    return true;
+  }
+  bool _retainHeader(const char *name, size_t len) const override;
+
 private:
   std::list<const char *> _toRemove;
 };
@@ -878,6 +1210,9 @@ public:
 private:
   Print *_out = nullptr;
   bool _enabled = true;
+#ifdef ESP32
+  std::mutex _outLock;  // keeps the lines of a request together, the middlewares of offloaded requests running on the workers
+#endif
 };
 
 // CORS Middleware
@@ -885,18 +1220,23 @@ class AsyncCorsMiddleware : public AsyncMiddleware {
 public:
   void setOrigin(const char *origin) {
     _origin = origin;
+    _block.reset();
   }
   void setMethods(const char *methods) {
     _methods = methods;
+    _block.reset();
   }
   void setHeaders(const char *headers) {
     _headers = headers;
+    _block.reset();
   }
   void setAllowCredentials(bool credentials) {
     _credentials = credentials;
+    _block.reset();
   }
   void setMaxAge(uint32_t seconds) {
     _maxAge = seconds;
+    _block.reset();
   }
 
   void addCORSHeaders(AsyncWebServerResponse *response);
@@ -909,6 +1249,10 @@ private:
   String _headers = "*";
   bool _credentials = true;
   uint32_t _maxAge = 86400;
+  AsyncHeaderBlockPtr _block;  // the CORS headers, serialized on first use
+#ifdef ESP32
+  std::mutex _blockLock;
+#endif
 };
 
 // Rate limit Middleware
@@ -929,6 +1273,51 @@ private:
   size_t _maxRequests = 0;
   uint32_t _windowSizeMillis = 0;
   std::list<uint32_t> _requestTimes;
+#ifdef ESP32
+  std::mutex _requestTimesLock;
+#endif
+};
+
+// AsyncClientRateLimitMiddleware limits each client (remote IP) separately, with a token bucket:
+// a client can send maxRequests requests at once, and then maxRequests per window.
+// The clients are tracked in a fixed table of maxClients entries, each IP being hashed to a set of 4 entries:
+// when its set is full, a new client replaces the client seen the longest ago in this set.
+// The check only needs the remote IP: a constant time lookup, without any allocation once the table exists.
+class AsyncClientRateLimitMiddleware : public AsyncMiddleware {
+public:
+  void setMaxRequests(size_t maxRequests) {
+    _maxRequests = maxRequests;
+    _buckets.clear();
+  }
+  void setWindowSize(uint32_t seconds) {
+    _windowSizeMillis = seconds * 1000;
+    _buckets.clear();
+  }
+  // number of clients tracked at once (default 16), rounded up to a multiple of 4
+  void setMaxClients(size_t maxClients) {
+    _maxClients = maxClients;
+    _buckets.clear();
+  }
+
+  bool isRequestAllowed(const IPAddress &ip, uint32_t &retryAfterSeconds);
+
+  void run(AsyncWebServerRequest *request, ArMiddlewareNext next);
+
+private:
+  static constexpr size_t WAYS = 4;
+  struct Bucket {
+    uint64_t tokens;  // one request costs _windowSizeMillis, refilled by _maxRequests per millisecond
+    IPAddress client;  // the whole address, IPv6 included
+    uint32_t last;     // millis() of the last request
+    bool used;
+  };
+  size_t _maxRequests = 0;
+  uint32_t _windowSizeMillis = 0;
+  size_t _maxClients = 16;
+  std::vector<Bucket> _buckets;  // allocated by the first request
+#ifdef ESP32
+  std::mutex _bucketsLock;
+#endif
 };
 
 /*
@@ -1007,15 +1396,30 @@ public:
   virtual bool canHandle(AsyncWebServerRequest *request __attribute__((unused))) const {
     return false;
   }
+  /**
+   * @brief Returns the URI of the handler when it can only handle requests to this URI or its sub-paths.
+   * The server indexes handlers by this URI to only call canHandle() on the ones which can match a request.
+   * An empty string (the default) means that the handler is tried for every request.
+   * The returned URI must not change while the handler is attached to a server.
+   */
+  virtual const String &routeUri() const {
+    return emptyString;
+  }
   virtual void handleRequest(__unused AsyncWebServerRequest *request) {}
   virtual void handleUpload(
     __unused AsyncWebServerRequest *request, __unused const String &filename, __unused size_t index, __unused uint8_t *data, __unused size_t len,
     __unused bool final
   ) {}
   virtual void handleBody(__unused AsyncWebServerRequest *request, __unused uint8_t *data, __unused size_t len, __unused size_t index, __unused size_t total) {}
+  // called instead of handleRequest() when a middleware rejected the request, to release what was kept of its body
+  virtual void handleRejected(__unused AsyncWebServerRequest *request) {}
   virtual bool isRequestHandlerTrivial() const {
     return true;
   }
+  // true when the middlewares and the handler run on a worker task instead of the AsyncTCP task (ESP32 only)
+  virtual bool isOffloaded() const {
+    return false;
+  }
 };
 
 /*
@@ -1034,7 +1438,8 @@ typedef enum {
 class AsyncWebServerResponse {
 protected:
   int _code;
-  std::list<AsyncWebHeader> _headers;
+  asyncsrv::response_list<AsyncWebHeader> _headers;
+  std::vector<AsyncHeaderBlockPtr> _headerBlocks;
   String _contentType;
   size_t _contentLength;
   bool _sendContentLength;
@@ -1044,8 +1449,10 @@ protected:
   size_t _ackedLength;
   size_t _writtenLength;
   WebResponseState _state;
+  bool _compress;
 
   static bool headerMustBePresentOnce(const String &name);
+  void _addConnectionHeader(AsyncWebServerRequest *request);
 
 public:
   static const char *responseCodeToString(int code);
@@ -1079,9 +1486,25 @@ public:
   bool removeHeader(const char *name);
   bool removeHeader(const char *name, const char *value);
   const AsyncWebHeader *getHeader(const char *name) const;
-  const std::list<AsyncWebHeader> &getHeaders() const {
+  const asyncsrv::response_list<AsyncWebHeader> &getHeaders() const {
     return _headers;
   }
+  /**
+   * @brief Adds a preserialized set of headers, copied as is into the head of the response, see AsyncHeaderBlock
+   */
+  bool addHeaders(AsyncHeaderBlockPtr block);
+  const std::vector<AsyncHeaderBlockPtr> &getHeaderBlocks() const {
+    return _headerBlocks;
+  }
+
+  /**
+   * @brief Compresses the content on the fly with gzip or deflate, if the request accepts one of them.
+   * Only applies to the responses filling their content progressively (streams, callbacks, chunked, files, JSON...),
+   * which are then sent chunked. The HEAD requests, the ranges and the content already encoded are sent as is.
+   */
+  void setCompression(bool compress) {
+    _compress = compress;
+  }
 
 #ifndef ESP8266
   [[deprecated("Use instead: _assembleHead(String& buffer, uint8_t version)")]]
@@ -1117,6 +1540,20 @@ protected:
   std::list<std::unique_ptr<AsyncWebHandler>> _handlers;
   AsyncCallbackWebHandler *_catchAllHandler;
 
+  // Route table compiled from _handlers, rebuilt on the first request after the handlers have changed.
+  // Handlers are kept in registration order so that the first one able to handle a request still wins.
+  struct Route {
+    AsyncWebHandler *handler;
+    size_t order;
+  };
+  std::unordered_map<uint32_t, std::vector<Route>> _routes;  // handlers with a route URI, by hash of this URI
+  std::vector<Route> _genericRoutes;                        // handlers to try for every request
+  bool _routesChanged = true;
+  void _buildRoutes();
+  bool _keepAlive = false;
+  uint32_t _keepAliveTimeout = ASYNCWEBSERVER_KEEPALIVE_TIMEOUT;
+  uint32_t _keepAliveMaxRequests = ASYNCWEBSERVER_KEEPALIVE_MAX_REQUESTS;
+
 public:
   AsyncWebServer(uint16_t port);
   ~AsyncWebServer();
@@ -1133,6 +1570,52 @@ public:
 #endif
   }
 
+  /**
+   * @brief Enable or disable HTTP/1.1 persistent connections (disabled by default).
+   * When enabled, the connection of a client asking for it is kept open once the response is sent,
+   * and the same request object is reset to serve the next request (pipelined requests are supported).
+   * The callback set with AsyncWebServerRequest::onDisconnect() is called when each request ends.
+   *
+   * @param enable true to keep connections open between requests
+   * @param idleTimeout number of seconds a connection can stay idle waiting for the next request
+   * @param maxRequests maximum number of requests served over a connection before closing it (0 means unlimited)
+   */
+  void setKeepAlive(bool enable, uint32_t idleTimeout = ASYNCWEBSERVER_KEEPALIVE_TIMEOUT, uint32_t maxRequests = ASYNCWEBSERVER_KEEPALIVE_MAX_REQUESTS) {
+    _keepAlive = enable;
+    _keepAliveTimeout = idleTimeout;
+    _keepAliveMaxRequests = maxRequests;
+  }
+  bool keepAlive() const {
+    return _keepAlive;
+  }
+  uint32_t keepAliveTimeout() const {
+    return _keepAliveTimeout;
+  }
+  uint32_t keepAliveMaxRequests() const {
+    return _keepAliveMaxRequests;
+  }
+
+  /**
+   * @brief Sets the smallest size of the buffers of this use allocated in PSRAM (ESP32 with PSRAM only, the default being
+   * ASYNCWEBSERVER_PSRAM_THRESHOLD). The smaller buffers, and the larger ones when the PSRAM is full, keep the default heap.
+   * This applies to all the servers, and to the buffers allocated from then on.
+   *
+   * @param use buffers concerned
+   * @param threshold size in bytes, 0 for all the buffers of this use, SIZE_MAX for none of them
+   */
+  static void setPsramThreshold(AsyncMemoryUse use, size_t threshold) {
+    asyncsrv::setPsramThreshold(use, threshold);
+  }
+  // same threshold for all the uses
+  static void setPsramThreshold(size_t threshold) {
+    for (size_t i = 0; i < (size_t)AsyncMemoryUse::COUNT; i++) {
+      asyncsrv::setPsramThreshold((AsyncMemoryUse)i, threshold);
+    }
+  }
+  static size_t psramThreshold(AsyncMemoryUse use) {
+    return asyncsrv::psramThreshold(use);
+  }
+
 #if ASYNC_TCP_SSL_ENABLED
   void onSslFileRequest(AcSSlFileHandler cb, void *arg);
   void beginSecure(const char *cert, const char *private_key_file, const char *password);
@@ -1191,6 +1674,10 @@ public:
   );
 
   AsyncStaticWebHandler &serveStatic(const char *uri, fs::FS &fs, const char *path, const char *cache_control = NULL);
+#ifdef ESP32
+  // serves the flash image written to the data partition partitionLabel, see AsyncFlashWebHandler
+  AsyncFlashWebHandler &serveFlash(const char *uri, const char *partitionLabel, const char *cache_control = NULL);
+#endif
 
   void onNotFound(ArRequestHandlerFunction fn);   // called when handler is not assigned
   void onFileUpload(ArUploadHandlerFunction fn);  // handle file uploads
@@ -4,6 +4,10 @@
 #include "WebAuthentication.h"
 #include <ESPAsyncWebServer.h>
 
+#if defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
+#include <pico/rand.h>
+#endif
+
 AsyncMiddlewareChain::~AsyncMiddlewareChain() {
   for (AsyncMiddleware *m : _middlewares) {
     if (m->_freeOnRemoval) {
@@ -68,21 +72,68 @@ void AsyncMiddlewareChain::_runChain(AsyncWebServerRequest *request, ArMiddlewar
   return next();
 }
 
+bool AsyncMiddlewareChain::_retainHeader(const char *name, size_t len) const {
+  // only the header middlewares at the beginning of the chain can be applied early:
+  // any other middleware running before them must still see all the headers
+  for (const AsyncMiddleware *m : _middlewares) {
+    if (!m->_filtersHeaders()) {
+      break;
+    }
+    if (!m->_retainHeader(name, len)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AsyncMiddlewareChain::_allowsBody(AsyncWebServerRequest *request) const {
+  for (const AsyncMiddleware *m : _middlewares) {
+    if (!m->_allowsBody(request)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void AsyncAuthenticationMiddleware::setUsername(const char *username) {
   _username = username;
   _hasCreds = _username.length() && _credentials.length();
+  clearCache();
 }
 
 void AsyncAuthenticationMiddleware::setPassword(const char *password) {
   _credentials = password;
   _hash = false;
   _hasCreds = _username.length() && _credentials.length();
+  clearCache();
 }
 
 void AsyncAuthenticationMiddleware::setPasswordHash(const char *hash) {
   _credentials = hash;
   _hash = _credentials.length();
   _hasCreds = _username.length() && _credentials.length();
+  clearCache();
+}
+
+void AsyncAuthenticationMiddleware::setCache(size_t entries, uint32_t ttlSeconds) {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_cacheLock);
+#endif
+  _cache.assign(ttlSeconds ? entries : 0, CacheEntry{0, 0, 0});
+  _cache.shrink_to_fit();
+  _cacheTTL = ttlSeconds * 1000;
+}
+
+void AsyncAuthenticationMiddleware::clearCache() {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_cacheLock);
+#endif
+  for (CacheEntry &entry : _cache) {
+    entry.key = 0;
+  }
+  // the responses of the cached digest nonces are computed again from HA1 on each hit
+  _ha1 = _authMethod == AsyncAuthType::AUTH_DIGEST && _hasCreds && !_hash ? generateDigestHash(_username.c_str(), _credentials.c_str(), _realm.c_str())
+                                                                          : String();
 }
 
 bool AsyncAuthenticationMiddleware::generateHash() {
@@ -119,7 +170,240 @@ bool AsyncAuthenticationMiddleware::generateHash() {
   }
 }
 
+// FNV-1a: the keys only have to tell the credentials apart, a client has to know a credential to present it
+static constexpr uint64_t CREDENTIAL_KEY_SEED = 0xcbf29ce484222325ULL;
+
+static uint64_t credentialHash(uint64_t hash, const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3ULL;
+  }
+  return hash ? hash : 1;  // 0 marks the free cache entries
+}
+
+static uint64_t sessionHash(const char *token, size_t len) {
+  const char prefix = 0;  // not an authentication method: a session never shares the key of an Authorization header
+  return credentialHash(credentialHash(CREDENTIAL_KEY_SEED, &prefix, 1), token, len);
+}
+
+// empty without a hardware random number generator: the tokens must not be predictable, no session is opened then
+static String sessionToken() {
+#if defined(ESP32) || defined(ESP8266) || defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350) \
+  || defined(LIBRETINY)
+  char token[33];
+  for (size_t i = 0; i < 4; i++) {
+#if defined(ESP32)
+    uint32_t r = esp_random();
+#elif defined(ESP8266)
+    uint32_t r = RANDOM_REG32;
+#elif defined(LIBRETINY)
+    uint32_t r;
+    lt_rand_bytes((uint8_t *)&r, sizeof(r));
+#else
+    uint32_t r = get_rand_32();
+#endif
+    snprintf(token + i * 8, 9, "%08lx", (unsigned long)r);
+  }
+  return String(token);
+#else
+  return emptyString;
+#endif
+}
+
+// finds the value of a digest parameter, without its quotes, and without copying the header
+static bool digestParam(const char *header, const char *name, const char *&value, size_t &len) {
+  const size_t nameLen = strlen(name);
+  const char *p = header;
+  while (*p) {
+    while (*p == ' ' || *p == ',') {
+      p++;
+    }
+    const char *eq = strchr(p, '=');
+    if (!eq) {
+      return false;
+    }
+    const char *nameStart = p;
+    const char *nameEnd = eq;
+    while (nameEnd > nameStart && nameEnd[-1] == ' ') {
+      nameEnd--;
+    }
+    const char *start = eq + 1;
+    const char *end;
+    if (*start == '"') {
+      start++;
+      end = strchr(start, '"');
+      if (!end) {
+        return false;
+      }
+      p = end + 1;
+    } else {
+      end = strchr(start, ',');
+      if (!end) {
+        end = start + strlen(start);
+      }
+      p = end;
+    }
+    if ((size_t)(nameEnd - nameStart) == nameLen && strncmp(nameStart, name, nameLen) == 0) {
+      value = start;
+      len = end - start;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t AsyncAuthenticationMiddleware::_credentialKey(AsyncWebServerRequest *request, uint32_t &nc) const {
+  nc = 0;
+  const String &authorization = request->_authorization;
+  if (!authorization.length()) {
+    return 0;
+  }
+  const char method = (char)request->_authMethod;
+  uint64_t key = credentialHash(CREDENTIAL_KEY_SEED, &method, 1);
+
+  if (request->_authMethod != AsyncAuthType::AUTH_DIGEST) {
+    return credentialHash(key, authorization.c_str(), authorization.length());
+  }
+
+  // digest: the response changes with each request, the client is recognized by its username and nonce, for one method and uri,
+  // the nonce count protects against the replays (no qop, so no nonce count: not cached), and the response is still checked on each hit
+  const char *username, *nonce, *count, *uri;
+  size_t usernameLen, nonceLen, countLen, uriLen;
+  if (!digestParam(authorization.c_str(), asyncsrv::T_username, username, usernameLen)
+      || !digestParam(authorization.c_str(), asyncsrv::T_nonce, nonce, nonceLen) || !digestParam(authorization.c_str(), asyncsrv::T_nc, count, countLen)
+      || !digestParam(authorization.c_str(), asyncsrv::T_uri, uri, uriLen)) {
+    return 0;
+  }
+  nc = strtoul(count, nullptr, 16);
+  if (!nc || !nonceLen) {
+    return 0;
+  }
+  const char *methodName = request->methodToString();
+  key = credentialHash(key, username, usernameLen);
+  key = credentialHash(key, ":", 1);
+  key = credentialHash(key, nonce, nonceLen);
+  key = credentialHash(key, ":", 1);
+  key = credentialHash(key, methodName, strlen(methodName));
+  key = credentialHash(key, ":", 1);
+  return credentialHash(key, uri, uriLen);
+}
+
+// computes the response expected for the digest Authorization header of the request, from the HA1 of the credentials
+bool AsyncAuthenticationMiddleware::_digestMatches(AsyncWebServerRequest *request) const {
+  const String &ha1 = _hash ? _credentials : _ha1;
+  if (!ha1.length()) {
+    return false;
+  }
+  const char *header = request->_authorization.c_str();
+  const char *nonce, *count, *cnonce, *qop, *uri, *response;
+  size_t nonceLen, countLen, cnonceLen, qopLen, uriLen, responseLen;
+  if (!digestParam(header, asyncsrv::T_nonce, nonce, nonceLen) || !digestParam(header, asyncsrv::T_nc, count, countLen)
+      || !digestParam(header, asyncsrv::T_cnonce, cnonce, cnonceLen) || !digestParam(header, asyncsrv::T_qop, qop, qopLen)
+      || !digestParam(header, asyncsrv::T_uri, uri, uriLen) || !digestParam(header, asyncsrv::T_response, response, responseLen)) {
+    return false;
+  }
+
+  String ha2(request->methodToString());
+  ha2.concat(':');
+  ha2.concat(uri, uriLen);
+  String in;
+  if (!in.reserve(ha1.length() + nonceLen + countLen + cnonceLen + qopLen + 32 + 5)) {
+    async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
+    return false;
+  }
+  in.concat(ha1);
+  in.concat(':');
+  in.concat(nonce, nonceLen);
+  in.concat(':');
+  in.concat(count, countLen);
+  in.concat(':');
+  in.concat(cnonce, cnonceLen);
+  in.concat(':');
+  in.concat(qop, qopLen);
+  in.concat(':');
+  in.concat(stringMD5(ha2));
+  const String expected = stringMD5(in);
+  return expected.length() && expected.length() == responseLen && strncmp(expected.c_str(), response, responseLen) == 0;
+}
+
+uint64_t AsyncAuthenticationMiddleware::_sessionKey(AsyncWebServerRequest *request) const {
+  if (!_sessionCookie.length()) {
+    return 0;
+  }
+  const AsyncWebHeader *cookie = request->getHeader(asyncsrv::T_Cookie);
+  if (!cookie) {
+    return 0;
+  }
+  const char *cookies = cookie->value().c_str();
+  const size_t nameLen = _sessionCookie.length();
+  for (const char *p = cookies; (p = strstr(p, _sessionCookie.c_str())) != nullptr;) {
+    const bool atStart = p == cookies || p[-1] == ' ' || p[-1] == ';';
+    p += nameLen;
+    if (atStart && *p == '=') {
+      const char *token = p + 1;
+      const char *end = strchr(token, ';');
+      const size_t len = end ? end - token : strlen(token);
+      return len ? sessionHash(token, len) : 0;
+    }
+  }
+  return 0;
+}
+
+bool AsyncAuthenticationMiddleware::_lookup(uint64_t key, uint32_t nc, bool consume) const {
+  const uint32_t now = millis();
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_cacheLock);
+#endif
+  for (CacheEntry &entry : _cache) {
+    if (entry.key == key && (int32_t)(entry.expires - now) > 0) {
+      if (entry.nc && nc <= entry.nc) {
+        // replayed, or overtaken by a request of another connection: verified again
+        return false;
+      }
+      if (consume) {
+        entry.nc = nc;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void AsyncAuthenticationMiddleware::_store(uint64_t key, uint32_t nc) const {
+  const uint32_t now = millis();
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_cacheLock);
+#endif
+  // the entry of this key, else a free one, else the first to expire
+  CacheEntry *slot = nullptr;
+  for (CacheEntry &entry : _cache) {
+    if (entry.key == key) {
+      slot = &entry;
+      break;
+    }
+    if (!slot || !entry.key || (slot->key && (int32_t)(entry.expires - slot->expires) < 0)) {
+      slot = &entry;
+    }
+  }
+  if (!slot) {
+    return;
+  }
+  if (slot->key != key || slot->nc < nc) {
+    slot->nc = nc;
+  }
+  slot->key = key;
+  slot->expires = now + _cacheTTL;
+}
+
 bool AsyncAuthenticationMiddleware::allowed(AsyncWebServerRequest *request) const {
+  bool verified;
+  return _allowed(request, verified);
+}
+
+// verified is set when the credentials were checked, and not found in the cache
+bool AsyncAuthenticationMiddleware::_allowed(AsyncWebServerRequest *request, bool &verified, bool consume) const {
+  verified = false;
+
   if (_authMethod == AsyncAuthType::AUTH_NONE) {
     return true;
   }
@@ -132,11 +416,59 @@ bool AsyncAuthenticationMiddleware::allowed(AsyncWebServerRequest *request) cons
     return true;
   }
 
-  return request->authenticate(_username.c_str(), _credentials.c_str(), _realm.c_str(), _hash);
+  if (_cache.empty()) {
+    return request->authenticate(_username.c_str(), _credentials.c_str(), _realm.c_str(), _hash);
+  }
+
+  const uint64_t session = _sessionKey(request);
+  if (session && _lookup(session, 0, consume)) {
+    return true;
+  }
+
+  uint32_t nc;
+  const uint64_t key = _credentialKey(request, nc);
+  // a digest hit is only taken for a correct response: a wrong one must not advance the nonce count either
+  if (key && (request->_authMethod != AsyncAuthType::AUTH_DIGEST || _digestMatches(request)) && _lookup(key, nc, consume)) {
+    return true;
+  }
+
+  if (!request->authenticate(_username.c_str(), _credentials.c_str(), _realm.c_str(), _hash)) {
+    return false;
+  }
+  verified = true;
+  if (key && consume) {
+    _store(key, nc);
+  }
+  return true;
 }
 
 void AsyncAuthenticationMiddleware::run(AsyncWebServerRequest *request, ArMiddlewareNext next) {
-  return allowed(request) ? next() : request->requestAuthentication(_authMethod, _realm.c_str(), _authFailMsg.c_str());
+  bool verified;
+  if (!_allowed(request, verified)) {
+    return request->requestAuthentication(_authMethod, _realm.c_str(), _authFailMsg.c_str());
+  }
+  if (!verified || !_sessionCookie.length() || _cache.empty()) {
+    return next();
+  }
+
+  // new session for the client just verified
+  const String token = sessionToken();
+  if (!token.length()) {
+    return next();
+  }
+  _store(sessionHash(token.c_str(), token.length()), 0);
+  next();
+  AsyncWebServerResponse *response = request->getResponse();
+  if (response) {
+    String cookie;
+    cookie.reserve(_sessionCookie.length() + 1 + token.length() + strlen(asyncsrv::T__session_cookie) + 10);
+    cookie.concat(_sessionCookie);
+    cookie.concat('=');
+    cookie.concat(token);
+    cookie.concat(asyncsrv::T__session_cookie);
+    cookie.concat(_cacheTTL / 1000);
+    response->addHeader(asyncsrv::T_Set_Cookie, cookie.c_str(), false);  // next to the cookies of the handler
+  }
 }
 
 void AsyncHeaderFreeMiddleware::run(AsyncWebServerRequest *request, ArMiddlewareNext next) {
@@ -159,6 +491,24 @@ void AsyncHeaderFreeMiddleware::run(AsyncWebServerRequest *request, ArMiddleware
   next();
 }
 
+bool AsyncHeaderFreeMiddleware::_retainHeader(const char *name, size_t len) const {
+  for (const char *k : _toKeep) {
+    if (strlen(k) == len && strncasecmp(name, k, len) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool AsyncHeaderFilterMiddleware::_retainHeader(const char *name, size_t len) const {
+  for (const char *k : _toRemove) {
+    if (strlen(k) == len && strncasecmp(name, k, len) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void AsyncHeaderFilterMiddleware::run(AsyncWebServerRequest *request, ArMiddlewareNext next) {
   for (auto it = _toRemove.begin(); it != _toRemove.end(); ++it) {
     request->removeHeader(*it);
@@ -171,6 +521,10 @@ void AsyncLoggingMiddleware::run(AsyncWebServerRequest *request, ArMiddlewareNex
     next();
     return;
   }
+#ifdef ESP32
+  // not held while the request is handled: only the lines printed before and after
+  std::unique_lock<std::mutex> lock(_outLock);
+#endif
   _out->print(F("* Connection from "));
 #ifndef LIBRETINY
   _out->print(request->client()->remoteIP().toString());
@@ -197,9 +551,15 @@ void AsyncLoggingMiddleware::run(AsyncWebServerRequest *request, ArMiddlewareNex
     }
   }
   _out->println(F(">"));
+#ifdef ESP32
+  lock.unlock();
+#endif
   uint32_t elapsed = millis();
   next();
   elapsed = millis() - elapsed;
+#ifdef ESP32
+  lock.lock();
+#endif
   AsyncWebServerResponse *response = request->getResponse();
   if (response) {
     _out->print(F("* Processed in "));
@@ -222,6 +582,14 @@ void AsyncLoggingMiddleware::run(AsyncWebServerRequest *request, ArMiddlewareNex
         _out->println(h.value());
       }
     }
+    for (const auto &block : response->getHeaderBlocks()) {
+      const String &data = block->data();
+      for (int start = 0, end; (end = data.indexOf('\r', start)) >= 0; start = end + 2) {
+        _out->print('<');
+        _out->print(' ');
+        _out->println(data.substring(start, end));
+      }
+    }
     _out->println('<');
   } else {
     _out->println(F("* Connection closed!"));
@@ -229,6 +597,27 @@ void AsyncLoggingMiddleware::run(AsyncWebServerRequest *request, ArMiddlewareNex
 }
 
 void AsyncCorsMiddleware::addCORSHeaders(AsyncWebServerResponse *response) {
+  // CORS headers already set by the handler are replaced, one by one
+  if (!response->getHeader(asyncsrv::T_CORS_ACAO) && !response->getHeader(asyncsrv::T_CORS_ACAM) && !response->getHeader(asyncsrv::T_CORS_ACAH)
+      && !response->getHeader(asyncsrv::T_CORS_ACAC) && !response->getHeader(asyncsrv::T_CORS_ACMA)) {
+#ifdef ESP32
+    std::lock_guard<std::mutex> lock(_blockLock);
+#endif
+    AsyncHeaderBlockPtr block = _block;
+    if (!block) {
+      block = AsyncHeaderBlock::create({
+        AsyncWebHeader(asyncsrv::T_CORS_ACAO, _origin.c_str()),
+        AsyncWebHeader(asyncsrv::T_CORS_ACAM, _methods.c_str()),
+        AsyncWebHeader(asyncsrv::T_CORS_ACAH, _headers.c_str()),
+        AsyncWebHeader(asyncsrv::T_CORS_ACAC, _credentials ? asyncsrv::T_TRUE : asyncsrv::T_FALSE),
+        AsyncWebHeader(asyncsrv::T_CORS_ACMA, String(_maxAge)),
+      });
+      _block = block;
+    }
+    if (response->addHeaders(block)) {
+      return;
+    }
+  }
   response->addHeader(asyncsrv::T_CORS_ACAO, _origin.c_str());
   response->addHeader(asyncsrv::T_CORS_ACAM, _methods.c_str());
   response->addHeader(asyncsrv::T_CORS_ACAH, _headers.c_str());
@@ -261,6 +650,9 @@ void AsyncCorsMiddleware::run(AsyncWebServerRequest *request, ArMiddlewareNext n
 }
 
 bool AsyncRateLimitMiddleware::isRequestAllowed(uint32_t &retryAfterSeconds) {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_requestTimesLock);
+#endif
   uint32_t now = millis();
 
   while (!_requestTimes.empty() && _requestTimes.front() <= now - _windowSizeMillis) {
@@ -284,6 +676,90 @@ void AsyncRateLimitMiddleware::run(AsyncWebServerRequest *request, ArMiddlewareN
   if (isRequestAllowed(retryAfterSeconds)) {
     next();
   } else {
+    async_ws_metric_inc(rateLimited);
+    AsyncWebServerResponse *response = request->beginResponse(429);
+    response->addHeader(asyncsrv::T_retry_after, retryAfterSeconds);
+    request->send(response);
+  }
+}
+
+// Hash of all the bytes of the address: IPv6 clients sharing their last 4 bytes must not share a set
+static uint32_t clientHash(const IPAddress &ip) {
+#if defined(ESP32) && ESP_IDF_VERSION_MAJOR >= 5
+  const size_t len = ip.type() == IPv6 ? 16 : 0;
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ ip[i]) * 16777619U;
+  }
+  return len ? hash : (uint32_t)ip;
+#elif (defined(ESP8266) || defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)) && LWIP_IPV6
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(ip.raw6());
+  const size_t len = ip.isV6() ? 16 : 0;
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ bytes[i]) * 16777619U;
+  }
+  return len ? hash : (uint32_t)ip;
+#else
+  return (uint32_t)ip;
+#endif
+}
+
+bool AsyncClientRateLimitMiddleware::isRequestAllowed(const IPAddress &ip, uint32_t &retryAfterSeconds) {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_bucketsLock);
+#endif
+  if (_buckets.empty()) {
+    const size_t sets = _maxClients ? (_maxClients + WAYS - 1) / WAYS : 1;
+    _buckets.resize(sets * WAYS, Bucket{0, IPAddress(), 0, false});
+  }
+
+  const uint32_t now = millis();
+  const size_t sets = _buckets.size() / WAYS;
+  Bucket *set = &_buckets[(((clientHash(ip) * 2654435761U) >> 16) % sets) * WAYS];
+
+  // the bucket of this client, else a free one, else the least recently used of the set
+  Bucket *bucket = nullptr;
+  Bucket *victim = set;
+  for (size_t i = 0; i < WAYS; i++) {
+    if (set[i].used && set[i].client == ip) {
+      bucket = &set[i];
+      break;
+    }
+    if (victim->used && (!set[i].used || (int32_t)(set[i].last - victim->last) < 0)) {
+      victim = &set[i];
+    }
+  }
+
+  const uint64_t cost = _windowSizeMillis;
+  const uint64_t capacity = cost * _maxRequests;
+  if (bucket) {
+    bucket->tokens = std::min<uint64_t>(capacity, bucket->tokens + (uint64_t)(now - bucket->last) * _maxRequests);
+  } else {
+    bucket = victim;
+    bucket->used = true;
+    bucket->client = ip;
+    bucket->tokens = capacity;
+  }
+  bucket->last = now;
+
+  if (_maxRequests && bucket->tokens >= cost) {
+    bucket->tokens -= cost;
+    retryAfterSeconds = 0;
+    return true;
+  }
+
+  const uint32_t waitMillis = _maxRequests ? (cost - bucket->tokens + _maxRequests - 1) / _maxRequests : _windowSizeMillis;
+  retryAfterSeconds = waitMillis / 1000 + 1;
+  return false;
+}
+
+void AsyncClientRateLimitMiddleware::run(AsyncWebServerRequest *request, ArMiddlewareNext next) {
+  uint32_t retryAfterSeconds;
+  if (isRequestAllowed(request->client()->remoteIP(), retryAfterSeconds)) {
+    next();
+  } else {
+    async_ws_metric_inc(rateLimited);
     AsyncWebServerResponse *response = request->beginResponse(429);
     response->addHeader(asyncsrv::T_retry_after, retryAfterSeconds);
     request->send(response);
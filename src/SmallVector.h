@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Copyright 2016-2025 Hristo Gochkov, Mathieu Carbou, Emil Muratov
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <new>
+#include <utility>
+
+// Number of headers stored inline by each response (0 stores them in a std::list).
+// A response having more headers than that moves them to the heap, in a single block.
+#ifndef ASYNCWEBSERVER_RESPONSE_HEADERS_CAPACITY
+#define ASYNCWEBSERVER_RESPONSE_HEADERS_CAPACITY 0
+#endif
+
+namespace asyncsrv {
+
+/**
+ * @brief Vector storing its first N elements inline, without any allocation.
+ * Only provides what the responses need from their header list: iteration, emplace_back(), erase() and clear().
+ * As with any vector, erase() and a growth invalidate the iterators and references.
+ */
+template <typename T, size_t N> class SmallVector {
+  static_assert(N > 0, "SmallVector needs an inline capacity");
+
+private:
+  alignas(T) uint8_t _inline[N * sizeof(T)];
+  T *_data;
+  size_t _size = 0;
+  size_t _capacity = N;
+
+  bool _isInline() const {
+    return _data == reinterpret_cast<const T *>(_inline);
+  }
+
+public:
+  using value_type = T;
+  using iterator = T *;
+  using const_iterator = const T *;
+
+  SmallVector() : _data(reinterpret_cast<T *>(_inline)) {}
+  ~SmallVector() {
+    clear();
+    if (!_isInline()) {
+      ::operator delete(_data);
+    }
+  }
+  SmallVector(const SmallVector &) = delete;
+  SmallVector &operator=(const SmallVector &) = delete;
+
+  iterator begin() {
+    return _data;
+  }
+  iterator end() {
+    return _data + _size;
+  }
+  const_iterator begin() const {
+    return _data;
+  }
+  const_iterator end() const {
+    return _data + _size;
+  }
+  const_iterator cbegin() const {
+    return _data;
+  }
+  const_iterator cend() const {
+    return _data + _size;
+  }
+  size_t size() const {
+    return _size;
+  }
+  bool empty() const {
+    return _size == 0;
+  }
+
+  template <typename... Args> T &emplace_back(Args &&...args) {
+    if (_size < _capacity) {
+      new (_data + _size) T(std::forward<Args>(args)...);
+      return _data[_size++];
+    }
+    // the new element is built first: the arguments can refer to the current elements
+    const size_t capacity = _capacity * 2;
+    T *data = static_cast<T *>(::operator new(capacity * sizeof(T)));
+    new (data + _size) T(std::forward<Args>(args)...);
+    for (size_t i = 0; i < _size; i++) {
+      new (data + i) T(std::move(_data[i]));
+      _data[i].~T();
+    }
+    if (!_isInline()) {
+      ::operator delete(_data);
+    }
+    _data = data;
+    _capacity = capacity;
+    return _data[_size++];
+  }
+  void push_back(const T &value) {
+    emplace_back(value);
+  }
+  void push_back(T &&value) {
+    emplace_back(std::move(value));
+  }
+
+  iterator erase(const_iterator pos) {
+    iterator it = _data + (pos - _data);
+    for (iterator next = it + 1; next != end(); ++next) {
+      *(next - 1) = std::move(*next);
+    }
+    _data[--_size].~T();
+    return it;
+  }
+
+  void clear() {
+    for (size_t i = 0; i < _size; i++) {
+      _data[i].~T();
+    }
+    _size = 0;
+  }
+};
+
+// list type used by the responses to store their headers
+#if ASYNCWEBSERVER_RESPONSE_HEADERS_CAPACITY
+template <typename T> using response_list = SmallVector<T, ASYNCWEBSERVER_RESPONSE_HEADERS_CAPACITY>;
+#else
+template <typename T> using response_list = std::list<T>;
+#endif
+
+}  // namespace asyncsrv
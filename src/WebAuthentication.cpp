@@ -3,6 +3,7 @@
 
 #include "WebAuthentication.h"
 #include "AsyncWebServerLogging.h"
+#include "AsyncWebServerMetrics.h"
 
 #include <libb64/cencode.h>
 #if defined(ESP32) || defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
@@ -89,6 +90,7 @@ String genRandomMD5() {
   char *out = (char *)malloc(33);
   if (out == NULL || !getMD5((uint8_t *)(&r), 4, out)) {
     async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
     return emptyString;
   }
   String res = String(out);
@@ -96,10 +98,11 @@ String genRandomMD5() {
   return res;
 }
 
-static String stringMD5(const String &in) {
+String stringMD5(const String &in) {
   char *out = (char *)malloc(33);
   if (out == NULL || !getMD5((uint8_t *)(in.c_str()), in.length(), out)) {
     async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
     return emptyString;
   }
   String res = String(out);
@@ -114,12 +117,14 @@ String generateDigestHash(const char *username, const char *password, const char
   char *out = (char *)malloc(33);
   if (out == NULL) {
     async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
     return emptyString;
   }
 
   String in;
   if (!in.reserve(strlen(username) + strlen(realm) + strlen(password) + 2)) {
     async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
     free(out);
     return emptyString;
   }
@@ -132,6 +137,7 @@ String generateDigestHash(const char *username, const char *password, const char
 
   if (!getMD5((uint8_t *)(in.c_str()), in.length(), out)) {
     async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
     free(out);
     return emptyString;
   }
@@ -20,4 +20,7 @@ String generateBasicHash(const char *username, const char *password);
 
 String genRandomMD5();
 
+// MD5 of in, in lowercase hexadecimal (empty if it failed)
+String stringMD5(const String &in);
+
 #endif
@@ -11,6 +11,12 @@
 
 #include "stddef.h"
 #include <time.h>
+#include <list>
+#include <memory>
+#ifdef ESP32
+#include <mutex>
+#include <esp_partition.h>
+#endif
 
 class AsyncStaticWebHandler : public AsyncWebHandler {
   using File = fs::File;
@@ -19,6 +25,34 @@ class AsyncStaticWebHandler : public AsyncWebHandler {
 private:
   bool _getFile(AsyncWebServerRequest *request) const;
   bool _searchFile(AsyncWebServerRequest *request, const String &path);
+  // Opens the first variant of path found in the filesystem, in this order, without the cache
+  bool _openFile(AsyncWebServerRequest *request, const String &path, const uint8_t *order, size_t count);
+
+  // Variants of a path: 0 for the file itself, 1 + i for the precompressed asyncsrv::fileEncodings[i]
+  static constexpr size_t MAX_VARIANTS = 1 + asyncsrv::fileEncodingsLen;
+  size_t _variantOrder(AsyncWebServerRequest *request, uint8_t *order) const;
+
+  // Result of the search of a file, remembered by the cache: one entry for each variant served for a path
+  struct CacheEntry {
+    String path;                    // searched path
+    String file;                    // file found for this path (possibly a precompressed variant), empty if there is none
+    uint8_t variants;               // variants of the path which exist, bit 0 for the file itself, bit 1 + i for fileEncodings[i]
+    String etag;
+    time_t lastWrite;
+    size_t size;
+    std::shared_ptr<uint8_t> content;  // file content, if kept in memory
+  };
+  bool _cacheEnabled = false;
+  size_t _cacheMaxContentSize = 0;
+  size_t _cacheMaxFileSize = 0;
+  size_t _cacheContentSize = 0;
+  std::list<CacheEntry> _cache;  // most recently used first
+#ifdef ESP32
+  std::mutex _cacheLock;
+#endif
+  // variants is set to the variants of the path, or to -1 if the path is not cached
+  bool _getCacheEntry(const String &path, const uint8_t *order, size_t count, CacheEntry &entry, int &variants);
+  void _addCacheEntry(const String &path, const String &file, uint8_t variants, File &content);
 
 protected:
   FS _fs;
@@ -30,12 +64,21 @@ protected:
   AwsTemplateProcessor _callback;
   bool _isDir;
   bool _tryGzipFirst = true;
+  uint8_t _encodings[asyncsrv::fileEncodingsLen] = {1};  // indexes in fileEncodings, in order of preference: gzip
+  size_t _encodingsLen = 1;
 
 public:
   AsyncStaticWebHandler(const char *uri, FS &fs, const char *path, const char *cache_control);
   bool canHandle(AsyncWebServerRequest *request) const override final;
   void handleRequest(AsyncWebServerRequest *request) override final;
+  // serve the precompressed variants accepted by the client before the file itself (true by default)
   AsyncStaticWebHandler &setTryGzipFirst(bool value);
+  /**
+   * @brief Set the precompressed variants searched next to each file, in order of preference, as Content-Encoding names:
+   * "br, gzip" serves file.br, else file.gz, to the clients accepting them (default: "gzip", "" for none).
+   * A variant refused by the Accept-Encoding of a request is only served when neither the file itself nor an accepted variant exist.
+   */
+  AsyncStaticWebHandler &setEncodings(const char *encodings);
   AsyncStaticWebHandler &setIsDir(bool isDir);
   AsyncStaticWebHandler &setDefaultFile(const char *filename);
   AsyncStaticWebHandler &setCacheControl(const char *cache_control);
@@ -53,6 +96,72 @@ public:
   AsyncStaticWebHandler &setLastModified();
 
   AsyncStaticWebHandler &setTemplateProcessor(AwsTemplateProcessor newCallback);
+
+  /**
+   * @brief Remember the file found for each requested path, with its size and ETag, so that the file system is only searched once.
+   * The content of small files can also be kept in memory and served without accessing the file system.
+   * Call invalidateCache() when files are updated.
+   *
+   * @param maxContentSize total size of the file contents kept in memory (0 to cache only the file information)
+   * @param maxFileSize size of the largest file whose content can be kept in memory
+   * @return AsyncStaticWebHandler&
+   */
+  AsyncStaticWebHandler &enableCache(size_t maxContentSize = 0, size_t maxFileSize = 4096);
+  AsyncStaticWebHandler &disableCache();
+
+  /**
+   * @brief Forget everything the cache knows, or only what it knows about this file (or its precompressed variants)
+   */
+  void invalidateCache();
+  void invalidateCache(const char *path);
+};
+
+/**
+ * @brief WebDAV (class 1) access to a directory of a file system:
+ * PROPFIND (Depth 0 and 1), OPTIONS, GET, HEAD, PUT, DELETE, MKCOL, MOVE and COPY.
+ * PUT bodies are written to the file while they are received and PROPFIND listings are sent entry by entry
+ * while the directory is read, so that directories of any size can be listed.
+ */
+class AsyncWebDAVHandler : public AsyncWebHandler {
+  using File = fs::File;
+  using FS = fs::FS;
+
+private:
+  FS _fs;
+  String _uri;
+  String _path;
+  bool _readOnly = false;
+
+  bool _filePath(const String &url, String &path) const;
+  bool _destinationPath(AsyncWebServerRequest *request, String &path) const;
+  void _handleGet(AsyncWebServerRequest *request, const String &path);
+  void _handlePut(AsyncWebServerRequest *request, const String &path);
+  void _handleDelete(AsyncWebServerRequest *request, const String &path);
+  void _handleMkcol(AsyncWebServerRequest *request, const String &path);
+  void _handleMoveOrCopy(AsyncWebServerRequest *request, const String &path, bool move);
+  void _handlePropfind(AsyncWebServerRequest *request, const String &path);
+
+public:
+  /**
+   * @brief Serves the directory path of the file system under the uri
+   */
+  AsyncWebDAVHandler(const char *uri, FS &fs, const char *path);
+
+  /**
+   * @brief Rejects the requests modifying the file system (PUT, DELETE, MKCOL, MOVE and COPY) with a 403
+   */
+  AsyncWebDAVHandler &setReadOnly(bool readOnly);
+
+  bool canHandle(AsyncWebServerRequest *request) const override final;
+  const String &routeUri() const override final {
+    return _uri;
+  }
+  void handleRequest(AsyncWebServerRequest *request) override final;
+  void handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) override final;
+  void handleRejected(AsyncWebServerRequest *request) override final;
+  bool isRequestHandlerTrivial() const override final {
+    return false;
+  }
 };
 
 class AsyncCallbackWebHandler : public AsyncWebHandler {
@@ -64,6 +173,12 @@ protected:
   ArUploadHandlerFunction _onUpload;
   ArBodyHandlerFunction _onBody;
   bool _isRegex;
+  bool _offload = false;
+  // part of the URI to match, computed once by setUri(): the extension for "/*.ext", the prefix for "/prefix*"
+  String _uriTemplate;
+#ifdef ASYNCWEBSERVER_REGEX
+  std::regex _pattern;
+#endif
 
 public:
   AsyncCallbackWebHandler() : _uri(), _method(HTTP_ANY), _onRequest(NULL), _onUpload(NULL), _onBody(NULL), _isRegex(false) {}
@@ -80,8 +195,28 @@ public:
   void onBody(ArBodyHandlerFunction fn) {
     _onBody = fn;
   }
+  /**
+   * @brief Runs the request handler on a worker task (ESP32 only), so that a slow handler does not block the other connections:
+   * see ASYNCWEBSERVER_WORKER_TASKS. The request is answered with a 503 when ASYNCWEBSERVER_WORKER_QUEUE_SIZE requests already
+   * wait for a worker. The middlewares of the request run on the worker too, around the handler, while the body and upload
+   * handlers still run on the AsyncTCP task. A custom middleware keeping state must protect it, as the built-in ones do: it can
+   * run on the AsyncTCP task and on several workers at once.
+   * The response is sent when the middlewares return, unless the handler paused the request.
+   */
+  AsyncCallbackWebHandler &offload(bool state = true) {
+    _offload = state;
+    return *this;
+  }
+  bool isOffloaded() const override final {
+#ifdef ESP32
+    return _offload;
+#else
+    return false;
+#endif
+  }
 
   bool canHandle(AsyncWebServerRequest *request) const override final;
+  const String &routeUri() const override final;
   void handleRequest(AsyncWebServerRequest *request) override final;
   void handleUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) override final;
   void handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) override final;
@@ -90,4 +225,105 @@ public:
   }
 };
 
+// Largest request body forwarded by AsyncProxyHandler, which has to receive it whole before connecting to the upstream server
+#ifndef ASYNCWEBSERVER_PROXY_MAX_BODY
+#define ASYNCWEBSERVER_PROXY_MAX_BODY 4096
+#endif
+
+/**
+ * @brief Forwards the requests to uri and its sub-paths to an upstream HTTP server: /uri/sub?query goes to http://host:port/path/sub?query.
+ * The upstream response is relayed while it is received, without buffering its content whole: the upstream connection is
+ * only acknowledged as the client reads the content, so that a slow client slows the upstream server down.
+ * Request bodies are forwarded up to ASYNCWEBSERVER_PROXY_MAX_BODY bytes (413 above), multipart bodies are refused (415).
+ */
+class AsyncProxyHandler : public AsyncWebHandler {
+private:
+  String _uri;
+  String _host;
+  uint16_t _port;
+  String _path;
+  uint32_t _timeout = 10;
+
+public:
+  AsyncProxyHandler(const char *uri, const char *host, uint16_t port = 80, const char *path = "/");
+
+  /**
+   * @brief Seconds to wait for the upstream server to connect and send the head of its response before answering 502 (default: 10)
+   */
+  AsyncProxyHandler &setTimeout(uint32_t seconds);
+
+  bool canHandle(AsyncWebServerRequest *request) const override final;
+  const String &routeUri() const override final {
+    return _uri;
+  }
+  void handleRequest(AsyncWebServerRequest *request) override final;
+  void handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) override final;
+  bool isRequestHandlerTrivial() const override final {
+    return false;
+  }
+};
+
+#ifdef ESP32
+/**
+ * @brief Serves the files of a read-only image written to a flash partition, instead of a file system.
+ * The partition stays mapped: the files are written from the flash without going through a send buffer, and support Range requests.
+ * Their ETag is computed when the image is built, so that If-None-Match is answered with a 304 without reading them.
+ *
+ * The image is built by examples/FlashImage/flash_image.py. All its integers are 32 bits little-endian:
+ * - the header: "AWFI", the version (1) and the number of files
+ * - an entry for each file, sorted by path: offset and length of its path, offset and length of its content, ETag, flags
+ * - the paths (starting with '/') and the contents, at the offsets from the start of the image given by the entries
+ * The only flag is 1 when the content is compressed with gzip: it is sent as is with Content-Encoding: gzip.
+ */
+class AsyncFlashWebHandler : public AsyncWebHandler {
+private:
+  String _uri;
+  String _default_file;
+  String _cache_control;
+  const esp_partition_t *_partition = nullptr;
+  const uint8_t *_image = nullptr;  // nullptr if the partition does not hold a valid image
+  uint32_t _count = 0;
+
+  const uint8_t *_findFile(const String &path) const;
+  // returns the entry of the file served for the request and its path
+  const uint8_t *_getFile(AsyncWebServerRequest *request, String &path) const;
+
+public:
+  AsyncFlashWebHandler(const char *uri, const char *partitionLabel, const char *cache_control = nullptr);
+
+  AsyncFlashWebHandler &setDefaultFile(const char *filename);
+  AsyncFlashWebHandler &setCacheControl(const char *cache_control);
+  // number of files of the image, 0 if it could not be mapped or is not valid
+  uint32_t count() const {
+    return _count;
+  }
+
+  bool canHandle(AsyncWebServerRequest *request) const override final;
+  const String &routeUri() const override final {
+    return _uri;
+  }
+  void handleRequest(AsyncWebServerRequest *request) override final;
+};
+#endif
+
+#if ASYNCWEBSERVER_METRICS
+/**
+ * @brief Exports the metrics collected with ASYNCWEBSERVER_METRICS on GET requests:
+ * in the Prometheus text format, or in JSON with ?format=json or an Accept: application/json header
+ */
+class AsyncMetricsHandler : public AsyncWebHandler {
+private:
+  String _uri;
+
+public:
+  explicit AsyncMetricsHandler(const char *uri = "/metrics") : _uri(uri) {}
+
+  bool canHandle(AsyncWebServerRequest *request) const override final;
+  const String &routeUri() const override final {
+    return _uri;
+  }
+  void handleRequest(AsyncWebServerRequest *request) override final;
+};
+#endif
+
 #endif /* ASYNCWEBSERVERHANDLERIMPL_H_ */
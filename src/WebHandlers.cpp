@@ -52,6 +52,38 @@ AsyncStaticWebHandler &AsyncStaticWebHandler::setTryGzipFirst(bool value) {
   return *this;
 }
 
+AsyncStaticWebHandler &AsyncStaticWebHandler::setEncodings(const char *encodings) {
+  _encodingsLen = 0;
+  const char *p = encodings;
+  while (*p) {
+    while (*p == ' ' || *p == ',') {
+      p++;
+    }
+    const char *end = p;
+    while (*end && *end != ' ' && *end != ',') {
+      end++;
+    }
+    if (end == p) {
+      break;
+    }
+    bool known = false;
+    for (uint8_t e = 0; e < fileEncodingsLen; e++) {
+      if (strlen(fileEncodings[e].encoding) == (size_t)(end - p) && strncasecmp(p, fileEncodings[e].encoding, end - p) == 0) {
+        known = true;
+        if (std::find(_encodings, _encodings + _encodingsLen, e) == _encodings + _encodingsLen) {
+          _encodings[_encodingsLen++] = e;
+        }
+      }
+    }
+    if (!known) {
+      async_ws_log_w("Unknown content encoding: ignored");
+    }
+    p = end;
+  }
+  invalidateCache();
+  return *this;
+}
+
 AsyncStaticWebHandler &AsyncStaticWebHandler::setIsDir(bool isDir) {
   _isDir = isDir;
   return *this;
@@ -72,7 +104,8 @@ AsyncStaticWebHandler &AsyncStaticWebHandler::setLastModified(const char *last_m
   return *this;
 }
 
-AsyncStaticWebHandler &AsyncStaticWebHandler::setLastModified(struct tm *last_modified) {
+// HTTP date, as used by Last-Modified
+static String httpDate(const struct tm *time) {
   char result[30];
 #ifdef ESP8266
   auto formatP = PSTR("%a, %d %b %Y %H:%M:%S GMT");
@@ -82,8 +115,12 @@ AsyncStaticWebHandler &AsyncStaticWebHandler::setLastModified(struct tm *last_mo
   static constexpr const char *format = "%a, %d %b %Y %H:%M:%S GMT";
 #endif
 
-  strftime(result, sizeof(result), format, last_modified);
-  _last_modified = result;
+  strftime(result, sizeof(result), format, time);
+  return String(result);
+}
+
+AsyncStaticWebHandler &AsyncStaticWebHandler::setLastModified(struct tm *last_modified) {
+  _last_modified = httpDate(last_modified);
   return *this;
 }
 
@@ -137,44 +174,82 @@ bool AsyncStaticWebHandler::_getFile(AsyncWebServerRequest *request) const {
 #define FILE_IS_REAL(f) (f == true)
 #endif
 
-bool AsyncStaticWebHandler::_searchFile(AsyncWebServerRequest *request, const String &path) {
-  bool fileFound = false;
-  bool gzipFound = false;
+// The precompressed variants accepted by the client come first, after the file itself if _tryGzipFirst is false.
+// The refused ones come last: they are only served when nothing else exists, as before the negotiation of the encoding.
+size_t AsyncStaticWebHandler::_variantOrder(AsyncWebServerRequest *request, uint8_t *order) const {
+  size_t count = 0;
+  uint8_t refused[fileEncodingsLen];
+  size_t refusedCount = 0;
+  if (!_tryGzipFirst) {
+    order[count++] = 0;
+  }
+  for (size_t i = 0; i < _encodingsLen; i++) {
+    const uint8_t variant = 1 + _encodings[i];
+    if (request->acceptsEncoding(fileEncodings[_encodings[i]].encoding)) {
+      order[count++] = variant;
+    } else {
+      refused[refusedCount++] = variant;
+    }
+  }
+  if (_tryGzipFirst) {
+    order[count++] = 0;
+  }
+  for (size_t i = 0; i < refusedCount; i++) {
+    order[count++] = refused[i];
+  }
+  return count;
+}
 
-  String gzip = path + T__gz;
+static String variantPath(const String &path, uint8_t variant) {
+  return variant ? path + fileEncodings[variant - 1].extension : path;
+}
 
-  if (_tryGzipFirst) {
-    if (_fs.exists(gzip)) {
-      request->_tempFile = _fs.open(gzip, fs::FileOpenMode::read);
-      gzipFound = FILE_IS_REAL(request->_tempFile);
-    }
-    if (!gzipFound) {
-      if (_fs.exists(path)) {
-        request->_tempFile = _fs.open(path, fs::FileOpenMode::read);
-        fileFound = FILE_IS_REAL(request->_tempFile);
+bool AsyncStaticWebHandler::_searchFile(AsyncWebServerRequest *request, const String &path) {
+  bool found = false;
+  uint8_t order[MAX_VARIANTS];
+  const size_t count = _variantOrder(request, order);
+
+  CacheEntry entry;
+  int cachedVariants = -1;
+  if (_cacheEnabled && _getCacheEntry(path, order, count, entry, cachedVariants)) {
+    // the file is opened by handleRequest() if its content is not in the cache
+    found = entry.file.length() != 0;
+  } else if (_cacheEnabled) {
+    // the variants of the path are only probed once, the other variants of a known path are opened directly
+    uint8_t variants = 0;
+    if (cachedVariants >= 0) {
+      variants = cachedVariants;
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        if (_fs.exists(variantPath(path, order[i]))) {
+          variants |= 1 << order[i];
+        }
       }
     }
-  } else {
-    if (_fs.exists(path)) {
-      request->_tempFile = _fs.open(path, fs::FileOpenMode::read);
-      fileFound = FILE_IS_REAL(request->_tempFile);
-    }
-    if (!fileFound) {
-      if (_fs.exists(gzip)) {
-        request->_tempFile = _fs.open(gzip, fs::FileOpenMode::read);
-        gzipFound = FILE_IS_REAL(request->_tempFile);
+    String file;
+    for (size_t i = 0; i < count && !found; i++) {
+      if (variants & (1 << order[i])) {
+        file = variantPath(path, order[i]);
+        request->_tempFile = _fs.open(file, fs::FileOpenMode::read);
+        found = FILE_IS_REAL(request->_tempFile);
+        if (!found) {
+          // a directory
+          variants &= ~(1 << order[i]);
+        }
       }
     }
+    _addCacheEntry(path, found ? file : emptyString, variants, request->_tempFile);
+  } else {
+    found = _openFile(request, path, order, count);
   }
 
-  bool found = fileFound || gzipFound;
-
   if (found) {
     // Extract the file name from the path and keep it in _tempObject
     size_t pathLen = path.length();
     char *_tempPath = (char *)malloc(pathLen + 1);
     if (_tempPath == NULL) {
       async_ws_log_e("Failed to allocate");
+      async_ws_metric_inc(allocFailures);
       request->abort();
       request->_tempFile.close();
       return false;
@@ -186,41 +261,81 @@ bool AsyncStaticWebHandler::_searchFile(AsyncWebServerRequest *request, const St
   return found;
 }
 
-void AsyncStaticWebHandler::handleRequest(AsyncWebServerRequest *request) {
-  // Get the filename from request->_tempObject and free it
-  String filename((char *)request->_tempObject);
-  free(request->_tempObject);
-  request->_tempObject = NULL;
-
-  if (request->_tempFile != true) {
-    request->send(404);
-    return;
+bool AsyncStaticWebHandler::_openFile(AsyncWebServerRequest *request, const String &path, const uint8_t *order, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    const String file = variantPath(path, order[i]);
+    if (_fs.exists(file)) {
+      request->_tempFile = _fs.open(file, fs::FileOpenMode::read);
+      if (FILE_IS_REAL(request->_tempFile)) {
+        return true;
+      }
+    }
   }
+  return false;
+}
 
-  time_t lw = request->_tempFile.getLastWrite();  // get last file mod time (if supported by FS)
-  // set etag to lastmod timestamp if available, otherwise to size
+// etag combines file size and lastmod timestamp if available, otherwise it is the size
+static String fileETag(time_t lw, size_t size) {
   String etag;
   if (lw) {
-    setLastModified(lw);
 #if defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350)
     // time_t == long long int
     constexpr size_t len = 1 + 8 * sizeof(time_t);
     char buf[len];
-    char *ret = lltoa(lw ^ request->_tempFile.size(), buf, len, 10);
-    etag = ret ? String(ret) : String(request->_tempFile.size());
+    char *ret = lltoa(lw ^ size, buf, len, 10);
+    etag = ret ? String(ret) : String(size);
 #elif defined(LIBRETINY)
-    long val = lw ^ request->_tempFile.size();
+    long val = lw ^ size;
     etag = String(val);
 #else
-    etag = lw ^ request->_tempFile.size();  // etag combines file size and lastmod timestamp
+    etag = lw ^ size;
 #endif
   } else {
 #if defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350) || defined(LIBRETINY)
-    etag = String(request->_tempFile.size());
+    etag = String(size);
 #else
-    etag = request->_tempFile.size();
+    etag = size;
 #endif
   }
+  return etag;
+}
+
+void AsyncStaticWebHandler::handleRequest(AsyncWebServerRequest *request) {
+  // Get the filename from request->_tempObject and free it
+  String filename((char *)request->_tempObject);
+  free(request->_tempObject);
+  request->_tempObject = NULL;
+
+  CacheEntry entry;
+  uint8_t order[MAX_VARIANTS];
+  const size_t count = _variantOrder(request, order);
+  int variants;
+  const bool cached = _cacheEnabled && _getCacheEntry(filename, order, count, entry, variants) && entry.file.length();
+
+  if (cached && !entry.content && request->_tempFile != true) {
+    request->_tempFile = _fs.open(entry.file, fs::FileOpenMode::read);
+    if (!FILE_IS_REAL(request->_tempFile)) {
+      // the file was removed without invalidating the cache
+      invalidateCache(filename.c_str());
+      request->_tempFile.close();
+    }
+  }
+
+  if (!cached && request->_tempFile != true) {
+    // found in the cache by canHandle(), but evicted since then
+    _openFile(request, filename, order, count);
+  }
+
+  if (!(cached && entry.content) && request->_tempFile != true) {
+    request->send(404);
+    return;
+  }
+
+  time_t lw = cached ? entry.lastWrite : request->_tempFile.getLastWrite();  // get last file mod time (if supported by FS)
+  if (lw) {
+    setLastModified(lw);
+  }
+  String etag = cached ? entry.etag : fileETag(lw, request->_tempFile.size());
 
   bool not_modified = false;
 
@@ -236,17 +351,25 @@ void AsyncStaticWebHandler::handleRequest(AsyncWebServerRequest *request) {
   if (not_modified) {
     request->_tempFile.close();
     response = new AsyncBasicResponse(304);  // Not modified
+  } else if (cached && entry.content) {
+    request->_tempFile.close();
+    response = new AsyncCachedFileResponse(entry.content, entry.size, filename, fileEncoding(entry.file.c_str(), filename), _callback);
   } else {
     response = new AsyncFileResponse(request->_tempFile, filename, emptyString, false, _callback);
   }
 
   if (!response) {
     async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
     request->abort();
     return;
   }
 
   response->addHeader(T_ETag, etag.c_str());
+  if (_encodingsLen) {
+    // the file served depends on the encodings accepted by the client
+    response->addHeader(T_Vary, T_Accept_Encoding, false);
+  }
 
   if (_last_modified.length()) {
     response->addHeader(T_Last_Modified, _last_modified.c_str());
@@ -258,6 +381,137 @@ void AsyncStaticWebHandler::handleRequest(AsyncWebServerRequest *request) {
   request->send(response);
 }
 
+AsyncStaticWebHandler &AsyncStaticWebHandler::enableCache(size_t maxContentSize, size_t maxFileSize) {
+  invalidateCache();
+  _cacheMaxContentSize = maxContentSize;
+  _cacheMaxFileSize = maxFileSize;
+  _cacheEnabled = true;
+  return *this;
+}
+
+AsyncStaticWebHandler &AsyncStaticWebHandler::disableCache() {
+  _cacheEnabled = false;
+  invalidateCache();
+  return *this;
+}
+
+void AsyncStaticWebHandler::invalidateCache() {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_cacheLock);
+#endif
+  _cache.clear();
+  _cacheContentSize = 0;
+}
+
+void AsyncStaticWebHandler::invalidateCache(const char *path) {
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_cacheLock);
+#endif
+  const size_t len = strlen(path);
+  for (auto it = _cache.begin(); it != _cache.end();) {
+    // the entries of the path itself, or of the path without the extension of a precompressed variant
+    bool match = it->path == path || it->file == path;
+    for (size_t e = 0; e < fileEncodingsLen && !match; e++) {
+      const char *ext = fileEncodings[e].extension;
+      match = len == it->path.length() + strlen(ext) && strncmp(path, it->path.c_str(), it->path.length()) == 0 && strcmp(path + it->path.length(), ext) == 0;
+    }
+    if (match) {
+      if (it->content) {
+        _cacheContentSize -= it->size;
+      }
+      it = _cache.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool AsyncStaticWebHandler::_getCacheEntry(const String &path, const uint8_t *order, size_t count, CacheEntry &entry, int &variants) {
+  variants = -1;
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_cacheLock);
+#endif
+  String file;
+  for (auto it = _cache.begin(); it != _cache.end(); ++it) {
+    if (it->path != path) {
+      continue;
+    }
+    if (variants < 0) {
+      // all the entries of a path know its variants: the file to serve is the first of them in this order
+      variants = it->variants;
+      for (size_t i = 0; i < count; i++) {
+        if (variants & (1 << order[i])) {
+          file = variantPath(path, order[i]);
+          break;
+        }
+      }
+    }
+    if (it->file == file) {
+      _cache.splice(_cache.begin(), _cache, it);
+      entry = _cache.front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void AsyncStaticWebHandler::_addCacheEntry(const String &path, const String &file, uint8_t variants, File &content) {
+  CacheEntry entry;
+  entry.path = path;
+  entry.file = file;
+  entry.variants = variants;
+  entry.lastWrite = 0;
+  entry.size = 0;
+  if (file.length()) {
+    entry.lastWrite = content.getLastWrite();
+    entry.size = content.size();
+    entry.etag = fileETag(entry.lastWrite, entry.size);
+    if (entry.size && entry.size <= _cacheMaxFileSize && entry.size <= _cacheMaxContentSize) {
+      uint8_t *buf = (uint8_t *)allocateBuffer(AsyncMemoryUse::CACHE, entry.size);
+      if (buf && content.read(buf, entry.size) == entry.size) {
+        entry.content = std::shared_ptr<uint8_t>(buf, free);
+      } else {
+        free(buf);
+      }
+      content.seek(0);
+    }
+  }
+
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(_cacheLock);
+#endif
+  for (auto it = _cache.begin(); it != _cache.end();) {
+    if (it->path == path && it->file == file) {
+      if (it->content) {
+        _cacheContentSize -= it->size;
+      }
+      it = _cache.erase(it);
+    } else {
+      if (it->path == path) {
+        it->variants = variants;
+      }
+      ++it;
+    }
+  }
+  if (entry.content) {
+    // make room by dropping the contents of the least recently used entries
+    for (auto it = _cache.rbegin(); it != _cache.rend() && _cacheContentSize + entry.size > _cacheMaxContentSize; ++it) {
+      if (it->content) {
+        _cacheContentSize -= it->size;
+        it->content.reset();
+      }
+    }
+    _cacheContentSize += entry.size;
+  }
+  _cache.emplace_front(std::move(entry));
+  while (_cache.size() > ASYNCWEBSERVER_STATIC_CACHE_ENTRIES) {
+    if (_cache.back().content) {
+      _cacheContentSize -= _cache.back().size;
+    }
+    _cache.pop_back();
+  }
+}
+
 AsyncStaticWebHandler &AsyncStaticWebHandler::setTemplateProcessor(AwsTemplateProcessor newCallback) {
   _callback = newCallback;
   return *this;
@@ -266,6 +520,19 @@ AsyncStaticWebHandler &AsyncStaticWebHandler::setTemplateProcessor(AwsTemplatePr
 void AsyncCallbackWebHandler::setUri(const String &uri) {
   _uri = uri;
   _isRegex = uri.startsWith("^") && uri.endsWith("$");
+  _uriTemplate = emptyString;
+#ifdef ASYNCWEBSERVER_REGEX
+  if (_isRegex) {
+    // compile the pattern once instead of for each request
+    _pattern = std::regex(_uri.c_str());
+    return;
+  }
+#endif
+  if (_uri.startsWith("/*.")) {
+    _uriTemplate = _uri.substring(_uri.lastIndexOf("."));
+  } else if (_uri.endsWith("*")) {
+    _uriTemplate = _uri.substring(0, _uri.length() - 1);
+  }
 }
 
 bool AsyncCallbackWebHandler::canHandle(AsyncWebServerRequest *request) const {
@@ -273,12 +540,11 @@ bool AsyncCallbackWebHandler::canHandle(AsyncWebServerRequest *request) const {
     return false;
   }
 
+  const String &url = request->url();
 #ifdef ASYNCWEBSERVER_REGEX
   if (_isRegex) {
-    std::regex pattern(_uri.c_str());
-    std::smatch matches;
-    std::string s(request->url().c_str());
-    if (std::regex_search(s, matches, pattern)) {
+    std::cmatch matches;
+    if (std::regex_search(url.c_str(), matches, _pattern)) {
       for (size_t i = 1; i < matches.size(); ++i) {  // start from 1
         request->_addPathParam(matches[i].str().c_str());
       }
@@ -288,24 +554,29 @@ bool AsyncCallbackWebHandler::canHandle(AsyncWebServerRequest *request) const {
   } else
 #endif
     if (_uri.length() && _uri.startsWith("/*.")) {
-    String uriTemplate = String(_uri);
-    uriTemplate = uriTemplate.substring(uriTemplate.lastIndexOf("."));
-    if (!request->url().endsWith(uriTemplate)) {
+    if (!url.endsWith(_uriTemplate)) {
       return false;
     }
   } else if (_uri.length() && _uri.endsWith("*")) {
-    String uriTemplate = String(_uri);
-    uriTemplate = uriTemplate.substring(0, uriTemplate.length() - 1);
-    if (!request->url().startsWith(uriTemplate)) {
+    if (!url.startsWith(_uriTemplate)) {
       return false;
     }
-  } else if (_uri.length() && (_uri != request->url() && !request->url().startsWith(_uri + "/"))) {
+  } else if (_uri.length() && (!url.startsWith(_uri) || (url.length() != _uri.length() && url[_uri.length()] != '/'))) {
+    // the url must be the uri or one of its sub-paths
     return false;
   }
 
   return true;
 }
 
+const String &AsyncCallbackWebHandler::routeUri() const {
+  // patterns cannot be indexed
+  if (_isRegex || _uri.startsWith("/*.") || _uri.endsWith("*")) {
+    return emptyString;
+  }
+  return _uri;
+}
+
 void AsyncCallbackWebHandler::handleRequest(AsyncWebServerRequest *request) {
   if (_onRequest) {
     _onRequest(request);
@@ -324,3 +595,951 @@ void AsyncCallbackWebHandler::handleBody(AsyncWebServerRequest *request, uint8_t
     _onBody(request, data, len, index, total);
   }
 }
+
+/*
+ * WebDAV Handler
+ * */
+
+namespace {
+
+// Name of a file without its directory, whether the file system gives its full path or not
+const char *baseName(const char *name) {
+  const char *slash = strrchr(name, '/');
+  return slash ? slash + 1 : name;
+}
+
+String childPath(const String &dir, const char *name) {
+  String path(dir);
+  if (!path.endsWith("/")) {
+    path.concat('/');
+  }
+  path.concat(baseName(name));
+  return path;
+}
+
+// Percent-encodes a decoded url to be used in an href
+void appendHref(String &out, const char *url) {
+  static constexpr const char *hex = "0123456789ABCDEF";
+  for (const char *p = url; *p; p++) {
+    const char c = *p;
+    if (isalnum((unsigned char)c) || c == '/' || c == '-' || c == '_' || c == '.' || c == '~') {
+      out.concat(c);
+    } else {
+      out.concat('%');
+      out.concat(hex[(uint8_t)c >> 4]);
+      out.concat(hex[(uint8_t)c & 0x0F]);
+    }
+  }
+}
+
+bool copyFile(fs::FS &fs, const String &from, const String &to) {
+  fs::File src = fs.open(from, fs::FileOpenMode::read);
+  if (!src) {
+    return false;
+  }
+  fs::File dst = fs.open(to, fs::FileOpenMode::write);
+  if (!dst) {
+    src.close();
+    return false;
+  }
+  uint8_t buf[256];
+  bool ok = true;
+  size_t len;
+  while (ok && (len = src.read(buf, sizeof(buf))) > 0) {
+    ok = dst.write(buf, len) == len;
+  }
+  src.close();
+  dst.close();
+  return ok;
+}
+
+bool copyRecursive(fs::FS &fs, const String &from, const String &to, bool recursive) {
+  fs::File src = fs.open(from, fs::FileOpenMode::read);
+  if (!src) {
+    return false;
+  }
+  if (!src.isDirectory()) {
+    src.close();
+    return copyFile(fs, from, to);
+  }
+  bool ok = fs.mkdir(to);
+  while (ok && recursive) {
+    fs::File child = src.openNextFile();
+    if (!child) {
+      break;
+    }
+    const String name(baseName(child.name()));
+    child.close();
+    ok = copyRecursive(fs, childPath(from, name.c_str()), childPath(to, name.c_str()), true);
+  }
+  src.close();
+  return ok;
+}
+
+bool removeRecursive(fs::FS &fs, const String &path) {
+  fs::File file = fs.open(path, fs::FileOpenMode::read);
+  if (!file) {
+    return false;
+  }
+  if (!file.isDirectory()) {
+    file.close();
+    return fs.remove(path);
+  }
+  file.close();
+  // the directory is not modified while it is read: its children are removed by batches
+  while (true) {
+    String batch[8];
+    size_t count = 0;
+    fs::File dir = fs.open(path, fs::FileOpenMode::read);
+    while (count < 8) {
+      fs::File child = dir.openNextFile();
+      if (!child) {
+        break;
+      }
+      batch[count++] = childPath(path, child.name());
+      child.close();
+    }
+    dir.close();
+    if (!count) {
+      break;
+    }
+    for (size_t i = 0; i < count; i++) {
+      if (!removeRecursive(fs, batch[i])) {
+        return false;
+      }
+    }
+  }
+  return fs.rmdir(path);
+}
+
+// Generates a PROPFIND multistatus response entry by entry, the directory is read between the buffers
+class PropfindListing {
+private:
+  enum State {
+    HEAD,
+    SELF,
+    CHILDREN,
+    TAIL,
+    DONE
+  };
+  fs::File _file;
+  String _url;
+  bool _children;
+  State _state = HEAD;
+  String _chunk;
+  size_t _sent = 0;
+
+  void _entry(const char *url, const char *name, fs::File &file) {
+    const bool dir = file.isDirectory();
+    _chunk = T_DAV_response;
+    appendHref(_chunk, url);
+    if (name) {
+      appendHref(_chunk, baseName(name));
+    }
+    if (dir && !_chunk.endsWith("/")) {
+      _chunk.concat('/');
+    }
+    _chunk.concat(T_DAV_propstat);
+    if (dir) {
+      _chunk.concat(T_DAV_collection);
+    } else {
+      _chunk.concat(T_DAV_resource);
+      _chunk.concat(T_DAV_length);
+      _chunk.concat(file.size());
+      _chunk.concat(T_DAV_length_end);
+    }
+    const time_t lastWrite = file.getLastWrite();
+    if (lastWrite) {
+      _chunk.concat(T_DAV_modified);
+      _chunk.concat(httpDate(gmtime(&lastWrite)));
+      _chunk.concat(T_DAV_modified_end);
+    }
+    _chunk.concat(T_DAV_response_end);
+  }
+
+public:
+  PropfindListing(fs::File file, const String &url, bool children) : _file(file), _url(url), _children(children && file.isDirectory()) {
+    if (_children && !_url.endsWith("/")) {
+      _url.concat('/');
+    }
+  }
+  ~PropfindListing() {
+    _file.close();
+  }
+
+  size_t fill(uint8_t *buf, size_t maxLen) {
+    size_t out = 0;
+    while (out < maxLen) {
+      if (_sent < _chunk.length()) {
+        const size_t n = std::min(maxLen - out, _chunk.length() - _sent);
+        memcpy(buf + out, _chunk.c_str() + _sent, n);
+        _sent += n;
+        out += n;
+        continue;
+      }
+      _sent = 0;
+      switch (_state) {
+        case HEAD:
+          _chunk = T_DAV_multistatus;
+          _state = SELF;
+          break;
+        case SELF:
+          _entry(_url.c_str(), nullptr, _file);
+          _state = _children ? CHILDREN : TAIL;
+          break;
+        case CHILDREN:
+        {
+          fs::File child = _file.openNextFile();
+          if (child) {
+            _entry(_url.c_str(), child.name(), child);
+            child.close();
+          } else {
+            _file.close();
+            _chunk = emptyString;
+            _state = TAIL;
+          }
+          break;
+        }
+        case TAIL:
+          _chunk = T_DAV_multistatus_end;
+          _state = DONE;
+          break;
+        case DONE: return out;
+      }
+    }
+    return out;
+  }
+};
+
+}  // namespace
+
+AsyncWebDAVHandler::AsyncWebDAVHandler(const char *uri, FS &fs, const char *path) : _fs(fs), _uri(uri), _path(path) {
+  // same normalization as AsyncStaticWebHandler: leading '/' and no trailing '/', the root being ""
+  if (_uri.length() == 0 || _uri[0] != '/') {
+    _uri = String('/') + _uri;
+  }
+  if (_path.length() == 0 || _path[0] != '/') {
+    _path = String('/') + _path;
+  }
+  if (_uri[_uri.length() - 1] == '/') {
+    _uri = _uri.substring(0, _uri.length() - 1);
+  }
+  if (_path[_path.length() - 1] == '/') {
+    _path = _path.substring(0, _path.length() - 1);
+  }
+}
+
+AsyncWebDAVHandler &AsyncWebDAVHandler::setReadOnly(bool readOnly) {
+  _readOnly = readOnly;
+  return *this;
+}
+
+bool AsyncWebDAVHandler::canHandle(AsyncWebServerRequest *request) const {
+  static constexpr WebRequestMethodComposite methods =
+    HTTP_OPTIONS | HTTP_GET | HTTP_HEAD | HTTP_PUT | HTTP_DELETE | HTTP_PROPFIND | HTTP_MKCOL | HTTP_MOVE | HTTP_COPY;
+  if (!request->isHTTP() || !(request->method() & methods)) {
+    return false;
+  }
+  const String &url = request->url();
+  return url.startsWith(_uri) && (url.length() == _uri.length() || url[_uri.length()] == '/');
+}
+
+bool AsyncWebDAVHandler::_filePath(const String &url, String &path) const {
+  const String rest = url.substring(_uri.length());
+  // do not give access outside of the served directory
+  if (rest.indexOf("/../") >= 0 || rest.endsWith("/..")) {
+    return false;
+  }
+  path = _path + rest;
+  while (path.endsWith("/")) {
+    path.remove(path.length() - 1);
+  }
+  if (path.length() == 0) {
+    path = '/';
+  }
+  return true;
+}
+
+bool AsyncWebDAVHandler::_destinationPath(AsyncWebServerRequest *request, String &path) const {
+  const AsyncWebHeader *destination = request->getHeader(T_Destination);
+  if (!destination) {
+    return false;
+  }
+  // the destination is an absolute URI or an absolute path
+  const String &value = destination->value();
+  int start = 0;
+  const int scheme = value.indexOf("://");
+  if (scheme >= 0) {
+    start = value.indexOf('/', scheme + 3);
+    if (start < 0) {
+      return false;
+    }
+  }
+  int end = value.indexOf('?', start);
+  const String url = request->urlDecode(end < 0 ? value.substring(start) : value.substring(start, end));
+  if (!url.startsWith(_uri) || (url.length() != _uri.length() && url[_uri.length()] != '/')) {
+    return false;
+  }
+  return _filePath(url, path);
+}
+
+void AsyncWebDAVHandler::handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  (void)data;
+  (void)len;
+  (void)total;
+  // the body itself is written by the sink of the request
+  if (request->method() != HTTP_PUT || _readOnly) {
+    return;
+  }
+  if (index == 0) {
+    // the body is received before the middlewares run: do not write it for a request which will be rejected
+    if (!request->bodyAllowed()) {
+      return;
+    }
+    String path;
+    if (!_filePath(request->url(), path) || request->bodySink()) {
+      return;
+    }
+    // the body is first written aside, replacing the file only once it is complete
+    if (!request->sinkBody(_fs.open(path + T__part, fs::FileOpenMode::write))) {
+      request->abort();
+    }
+  }
+}
+
+void AsyncWebDAVHandler::handleRejected(AsyncWebServerRequest *request) {
+  // a middleware not known from the headers rejected the request: the body written aside is not kept
+  String path;
+  if (request->bodySink() && _filePath(request->url(), path)) {
+    _fs.remove(path + T__part);
+  }
+}
+
+void AsyncWebDAVHandler::handleRequest(AsyncWebServerRequest *request) {
+  String path;
+  if (!_filePath(request->url(), path)) {
+    request->send(400);
+    return;
+  }
+
+  switch (request->method()) {
+    case HTTP_OPTIONS:
+    {
+      AsyncWebServerResponse *response = request->beginResponse(200);
+      response->addHeader(T_DAV, "1");
+      response->addHeader(T_Allow, _readOnly ? "OPTIONS, GET, HEAD, PROPFIND" : T_DAV_allow);
+      request->send(response);
+      return;
+    }
+    case HTTP_GET:
+    case HTTP_HEAD:     _handleGet(request, path); return;
+    case HTTP_PROPFIND: _handlePropfind(request, path); return;
+    default:            break;
+  }
+
+  if (_readOnly) {
+    request->send(403);
+    return;
+  }
+  switch (request->method()) {
+    case HTTP_PUT:    _handlePut(request, path); return;
+    case HTTP_DELETE: _handleDelete(request, path); return;
+    case HTTP_MKCOL:  _handleMkcol(request, path); return;
+    case HTTP_MOVE:   _handleMoveOrCopy(request, path, true); return;
+    case HTTP_COPY:   _handleMoveOrCopy(request, path, false); return;
+    default:          request->send(405); return;
+  }
+}
+
+void AsyncWebDAVHandler::_handleGet(AsyncWebServerRequest *request, const String &path) {
+  File file = _fs.open(path, fs::FileOpenMode::read);
+  if (!file) {
+    request->send(404);
+    return;
+  }
+  if (file.isDirectory()) {
+    // collections are listed by PROPFIND
+    file.close();
+    request->send(403);
+    return;
+  }
+  request->send(file, path);
+}
+
+void AsyncWebDAVHandler::_handlePut(AsyncWebServerRequest *request, const String &path) {
+  const bool existed = _fs.exists(path);
+  const AsyncFileBodySink *sink = request->bodySink();
+  const String part = path + T__part;
+
+  if (!sink) {
+    if (request->contentLength()) {
+      // form and multipart bodies are parsed by the request instead of being given to the handler
+      request->send(415);
+      return;
+    }
+    // empty body
+    File file = _fs.open(part, fs::FileOpenMode::write);
+    if (!file) {
+      request->send(409);
+      return;
+    }
+    file.close();
+  } else if (sink->failed()) {
+    if (!_fs.exists(part)) {
+      // the parent collection does not exist
+      request->send(409);
+      return;
+    }
+    _fs.remove(part);
+    request->send(507);
+    return;
+  }
+
+  if (existed) {
+    _fs.remove(path);
+  }
+  if (!_fs.rename(part, path)) {
+    _fs.remove(part);
+    request->send(500);
+    return;
+  }
+  request->send(existed ? 204 : 201);
+}
+
+void AsyncWebDAVHandler::_handleDelete(AsyncWebServerRequest *request, const String &path) {
+  if (path == "/" || path == _path) {
+    request->send(403);
+    return;
+  }
+  if (!_fs.exists(path)) {
+    request->send(404);
+    return;
+  }
+  request->send(removeRecursive(_fs, path) ? 204 : 500);
+}
+
+void AsyncWebDAVHandler::_handleMkcol(AsyncWebServerRequest *request, const String &path) {
+  if (request->contentLength()) {
+    request->send(415);
+    return;
+  }
+  if (_fs.exists(path)) {
+    request->send(405);
+    return;
+  }
+  // fails if the parent collection does not exist
+  request->send(_fs.mkdir(path) ? 201 : 409);
+}
+
+void AsyncWebDAVHandler::_handleMoveOrCopy(AsyncWebServerRequest *request, const String &path, bool move) {
+  String destination;
+  if (!_destinationPath(request, destination)) {
+    request->send(400);
+    return;
+  }
+  if (destination == path || destination.startsWith(path + "/") || (move && (path == "/" || path == _path))) {
+    request->send(403);
+    return;
+  }
+  if (!_fs.exists(path)) {
+    request->send(404);
+    return;
+  }
+
+  const AsyncWebHeader *overwrite = request->getHeader(T_Overwrite);
+  const bool existed = _fs.exists(destination);
+  if (existed) {
+    if (overwrite && overwrite->value().equalsIgnoreCase("F")) {
+      request->send(412);
+      return;
+    }
+    if (!removeRecursive(_fs, destination)) {
+      request->send(500);
+      return;
+    }
+  }
+
+  bool done;
+  if (move) {
+    done = _fs.rename(path, destination);
+  } else {
+    // Depth: 0 only copies the collection itself
+    const AsyncWebHeader *depth = request->getHeader(T_Depth);
+    done = copyRecursive(_fs, path, destination, !(depth && depth->value() == "0"));
+  }
+  request->send(done ? (existed ? 204 : 201) : 409);
+}
+
+void AsyncWebDAVHandler::_handlePropfind(AsyncWebServerRequest *request, const String &path) {
+  File file = _fs.open(path, fs::FileOpenMode::read);
+  if (!file) {
+    request->send(404);
+    return;
+  }
+
+  // the requested properties are ignored: all the supported ones are returned.
+  // Depth: infinity is answered as Depth: 1
+  const AsyncWebHeader *depth = request->getHeader(T_Depth);
+  std::shared_ptr<PropfindListing> listing = std::make_shared<PropfindListing>(file, request->url(), !(depth && depth->value() == "0"));
+  AsyncWebServerResponse *response = request->beginChunkedResponse(T_application_xml, [listing](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+    (void)index;
+    return listing->fill(buf, maxLen);
+  });
+  response->setCode(207);
+  request->send(response);
+}
+
+/*
+ * Proxy Handler
+ * */
+
+AsyncProxyHandler::AsyncProxyHandler(const char *uri, const char *host, uint16_t port, const char *path)
+  : _uri(uri), _host(host), _port(port), _path(path) {
+  // the sub-path of the request, starting with a '/', is appended to the path
+  if (_uri.endsWith("/")) {
+    _uri.remove(_uri.length() - 1);
+  }
+  if (_path.endsWith("/")) {
+    _path.remove(_path.length() - 1);
+  }
+}
+
+AsyncProxyHandler &AsyncProxyHandler::setTimeout(uint32_t seconds) {
+  _timeout = seconds;
+  return *this;
+}
+
+bool AsyncProxyHandler::canHandle(AsyncWebServerRequest *request) const {
+  if (!request->isHTTP()) {
+    return false;
+  }
+  const String &url = request->url();
+  return url.startsWith(_uri) && (url.length() == _uri.length() || url[_uri.length()] == '/');
+}
+
+void AsyncProxyHandler::handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  // the body is forwarded with the head of the request, once received whole
+  if (index == 0) {
+    if (total > ASYNCWEBSERVER_PROXY_MAX_BODY || request->_tempObject) {
+      return;
+    }
+    request->_tempObject = allocateBuffer(AsyncMemoryUse::BODY, total);
+    if (!request->_tempObject) {
+      async_ws_log_e("Failed to allocate");
+      async_ws_metric_inc(allocFailures);
+      return;
+    }
+  }
+  if (request->_tempObject && index + len <= total) {
+    memcpy((uint8_t *)request->_tempObject + index, data, len);
+  }
+}
+
+// encodes the characters which are not unreserved (RFC 3986 2.3), besides the '/' of a path
+static void appendEncoded(String &out, const String &value, bool path) {
+  static const char hex[] = "0123456789ABCDEF";
+  for (size_t i = 0; i < value.length(); i++) {
+    const char c = value[i];
+    if (isalnum((unsigned char)c) || c == '-' || c == '.' || c == '_' || c == '~' || (path && c == '/')) {
+      out.concat(c);
+    } else {
+      out.concat('%');
+      out.concat(hex[(uint8_t)c >> 4]);
+      out.concat(hex[(uint8_t)c & 0x0f]);
+    }
+  }
+}
+
+// the parameters decoded by the request are encoded again: the query string, or a form body which was not given to handleBody()
+static void appendParams(String &out, AsyncWebServerRequest *request, bool post) {
+  bool first = true;
+  for (size_t i = 0; i < request->params(); i++) {
+    const AsyncWebParameter *p = request->getParam(i);
+    if (p->isPost() != post || p->isFile()) {
+      continue;
+    }
+    if (!first) {
+      out.concat('&');
+    }
+    first = false;
+    appendEncoded(out, p->name(), false);
+    out.concat('=');
+    appendEncoded(out, p->value(), false);
+  }
+}
+
+void AsyncProxyHandler::handleRequest(AsyncWebServerRequest *request) {
+  String form;
+  const uint8_t *body = (const uint8_t *)request->_tempObject;
+  size_t bodyLen = body ? request->contentLength() : 0;
+  if (request->contentLength() && !body) {
+    if (request->contentType().startsWith(T_MULTIPART_)) {
+      request->send(415);
+      return;
+    }
+    appendParams(form, request, true);
+    if (!form.length()) {
+      request->send(request->contentLength() > ASYNCWEBSERVER_PROXY_MAX_BODY ? 413 : 500);
+      return;
+    }
+    body = (const uint8_t *)form.c_str();
+    bodyLen = form.length();
+  }
+
+  // HTTP/1.0 to the upstream server: the content comes without chunks, until the connection is closed if its length is unknown
+  String head;
+  head.reserve(256);
+  head.concat(request->methodToString());
+  head.concat(' ');
+  const String target = _path + request->url().substring(_uri.length());
+  if (target.length()) {
+    appendEncoded(head, target, true);
+  } else {
+    head.concat('/');
+  }
+  String query;
+  appendParams(query, request, false);
+  if (query.length()) {
+    head.concat('?');
+    head.concat(query);
+  }
+  head.concat(' ');
+  head.concat(T_HTTP_1_0);
+  head.concat(T_rn);
+
+  head.concat("Host: ");
+  head.concat(_host);
+  if (_port != 80) {
+    head.concat(':');
+    head.concat(_port);
+  }
+  head.concat(T_rn);
+  for (const AsyncWebHeader &h : request->getHeaders()) {
+    const String &name = h.name();
+    if (name.equalsIgnoreCase(T_Host) || name.equalsIgnoreCase(T_Content_Length) || name.equalsIgnoreCase(T_EXPECT)
+        || isHopByHopHeader(name.c_str(), name.length())) {
+      continue;
+    }
+    head.concat(name);
+    head.concat(':');
+    head.concat(' ');
+    head.concat(h.value());
+    head.concat(T_rn);
+  }
+  head.concat(T_X_Forwarded_For);
+  head.concat(':');
+  head.concat(' ');
+  head.concat(request->client()->remoteIP().toString());
+  head.concat(T_rn);
+  if (bodyLen) {
+    head.concat(T_Content_Length);
+    head.concat(':');
+    head.concat(' ');
+    head.concat(bodyLen);
+    head.concat(T_rn);
+  }
+  head.concat(T_Connection);
+  head.concat(':');
+  head.concat(' ');
+  head.concat(T_close);
+  head.concat(T_rnrn);
+
+  std::vector<uint8_t> outgoing;
+  outgoing.reserve(head.length() + bodyLen);
+  outgoing.insert(outgoing.end(), (const uint8_t *)head.c_str(), (const uint8_t *)head.c_str() + head.length());
+  outgoing.insert(outgoing.end(), body, body + bodyLen);
+  head = String();
+  form = String();
+  free(request->_tempObject);
+  request->_tempObject = NULL;
+
+  AsyncProxyResponse *response = new (std::nothrow) AsyncProxyResponse(std::move(outgoing), request->method() == HTTP_HEAD);
+  if (!response) {
+    async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
+    request->abort();
+    return;
+  }
+  // the response is sent once the upstream server has sent its head
+  if (!response->begin(request, _host.c_str(), _port, _timeout)) {
+    delete response;
+    request->send(502);
+  }
+}
+
+#ifdef ESP32
+static constexpr size_t FLASH_IMAGE_HEADER = 12;
+static constexpr size_t FLASH_IMAGE_ENTRY = 24;
+static constexpr uint32_t FLASH_IMAGE_GZIP = 1;
+
+// field of an entry (or of the header) of a flash image
+static uint32_t imageWord(const uint8_t *data, size_t field) {
+  data += field * 4;
+  return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+AsyncFlashWebHandler::AsyncFlashWebHandler(const char *uri, const char *partitionLabel, const char *cache_control)
+  : _uri(uri), _default_file(F("index.html")), _cache_control(cache_control) {
+  // Ensure leading '/' and remove the trailing one, as for AsyncStaticWebHandler
+  if (_uri.length() == 0 || _uri[0] != '/') {
+    _uri = String('/') + _uri;
+  }
+  if (_uri[_uri.length() - 1] == '/') {
+    _uri = _uri.substring(0, _uri.length() - 1);
+  }
+
+  _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partitionLabel);
+  const uint8_t *image = _partition ? asyncsrv::mapPartition(_partition) : nullptr;
+  if (!image) {
+    async_ws_log_e("Unable to map the flash image %s", partitionLabel);
+    return;
+  }
+
+  const size_t size = _partition->size;
+  const uint32_t count = imageWord(image, 2);
+  bool valid = memcmp(image, "AWFI", 4) == 0 && imageWord(image, 1) == 1 && count <= (size - FLASH_IMAGE_HEADER) / FLASH_IMAGE_ENTRY;
+  for (uint32_t i = 0; valid && i < count; i++) {
+    const uint8_t *entry = image + FLASH_IMAGE_HEADER + i * FLASH_IMAGE_ENTRY;
+    valid = imageWord(entry, 0) <= size && imageWord(entry, 1) <= size - imageWord(entry, 0) && imageWord(entry, 2) <= size
+            && imageWord(entry, 3) <= size - imageWord(entry, 2);
+  }
+  if (!valid) {
+    async_ws_log_e("Invalid flash image %s", partitionLabel);
+    return;
+  }
+  _image = image;
+  _count = count;
+}
+
+AsyncFlashWebHandler &AsyncFlashWebHandler::setDefaultFile(const char *filename) {
+  _default_file = filename;
+  return *this;
+}
+
+AsyncFlashWebHandler &AsyncFlashWebHandler::setCacheControl(const char *cache_control) {
+  _cache_control = cache_control;
+  return *this;
+}
+
+// binary search, the entries being sorted by the bytes of their paths
+const uint8_t *AsyncFlashWebHandler::_findFile(const String &path) const {
+  size_t low = 0;
+  size_t high = _count;
+  while (low < high) {
+    const size_t mid = low + (high - low) / 2;
+    const uint8_t *entry = _image + FLASH_IMAGE_HEADER + mid * FLASH_IMAGE_ENTRY;
+    const size_t len = imageWord(entry, 1);
+    int cmp = memcmp(path.c_str(), _image + imageWord(entry, 0), std::min(len, (size_t)path.length()));
+    if (cmp == 0) {
+      cmp = path.length() < len ? -1 : path.length() > len;
+    }
+    if (cmp == 0) {
+      return entry;
+    }
+    if (cmp < 0) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return nullptr;
+}
+
+const uint8_t *AsyncFlashWebHandler::_getFile(AsyncWebServerRequest *request, String &path) const {
+  // Remove the found uri
+  path = request->url().substring(_uri.length());
+
+  if (path.length() && path[path.length() - 1] != '/') {
+    const uint8_t *entry = _findFile(path);
+    if (entry) {
+      return entry;
+    }
+  }
+
+  // Can't handle if not default file
+  if (_default_file.length() == 0) {
+    return nullptr;
+  }
+  if (path.length() == 0 || path[path.length() - 1] != '/') {
+    path += String('/');
+  }
+  path += _default_file;
+  return _findFile(path);
+}
+
+bool AsyncFlashWebHandler::canHandle(AsyncWebServerRequest *request) const {
+  String path;
+  return _image && request->isHTTP() && (request->method() & (HTTP_GET | HTTP_HEAD)) && request->url().startsWith(_uri) && _getFile(request, path);
+}
+
+void AsyncFlashWebHandler::handleRequest(AsyncWebServerRequest *request) {
+  String path;
+  const uint8_t *entry = _getFile(request, path);
+  if (!entry) {
+    request->send(404);
+    return;
+  }
+
+  char etag[11];
+  snprintf(etag, sizeof(etag), "\"%08lx\"", (unsigned long)imageWord(entry, 4));
+
+  AsyncWebServerResponse *response;
+  if (request->hasHeader(T_INM) && request->header(T_INM).equals(etag)) {
+    response = new AsyncBasicResponse(304);  // Not modified
+  } else {
+    const char *encoding = imageWord(entry, 5) & FLASH_IMAGE_GZIP ? T_gzip : nullptr;
+    response = new AsyncFlashResponse(_partition, imageWord(entry, 2), imageWord(entry, 3), path, encoding);
+  }
+
+  if (!response) {
+    async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
+    request->abort();
+    return;
+  }
+
+  response->addHeader(T_ETag, etag);
+  if (_cache_control.length()) {
+    response->addHeader(T_Cache_Control, _cache_control.c_str());
+  }
+  request->send(response);
+}
+#endif
+
+#if ASYNCWEBSERVER_METRICS
+namespace {
+struct MetricHistogramEntry {
+  const char *name;
+  const MetricHistogram &histogram;
+};
+struct MetricCounterEntry {
+  const char *name;
+  uint64_t value;
+};
+
+// seconds with microsecond precision, from microseconds
+void concatSeconds(String &out, uint64_t us) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%lu.%06lu", (unsigned long)(us / 1000000), (unsigned long)(us % 1000000));
+  out.concat(buf);
+}
+
+void concatNumber(String &out, uint64_t value) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+  out.concat(buf);
+}
+}  // namespace
+
+bool AsyncMetricsHandler::canHandle(AsyncWebServerRequest *request) const {
+  return request->isHTTP() && request->method() == HTTP_GET && request->url() == _uri;
+}
+
+void AsyncMetricsHandler::handleRequest(AsyncWebServerRequest *request) {
+  const MetricHistogramEntry histograms[] = {
+    {"request_headers", metrics.headers},
+    {"request_dispatch", metrics.dispatch},
+    {"response_first_byte", metrics.firstByte},
+    {"response_acked", metrics.response},
+  };
+  const MetricCounterEntry counters[] = {
+    {"connections", metrics.connections.value()},
+    {"requests", metrics.requests.value()},
+    {"responses", metrics.responses.value()},
+    {"alloc_failures", metrics.allocFailures.value()},
+    {"received_bytes", metrics.bytesReceived.value()},
+    {"sent_bytes", metrics.bytesSent.value()},
+    {"ws_dropped_messages", metrics.wsDropped.value()},
+    {"sse_dropped_messages", metrics.sseDropped.value()},
+    {"rate_limited_requests", metrics.rateLimited.value()},
+    {"offload_rejected_requests", metrics.offloadRejected.value()},
+  };
+
+  const AsyncWebParameter *format = request->getParam("format");
+  const AsyncWebHeader *accept = request->getHeader(T_ACCEPT);
+  const bool json = format ? format->value() == "json" : accept && accept->value().indexOf(T_application_json) >= 0;
+
+  String out;
+  if (!out.reserve(json ? 1536 : 4096)) {
+    async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
+    request->abort();
+    return;
+  }
+
+  if (json) {
+    // {"request_headers_seconds":{"le":[...],"buckets":[...],"count":n,"sum":s},...,"connections_total":n,...}
+    out.concat('{');
+    for (const auto &h : histograms) {
+      out.concat('"');
+      out.concat(h.name);
+      out.concat("_seconds\":{\"le\":[");
+      for (size_t i = 0; i < MetricHistogram::BUCKETS - 1; i++) {
+        concatSeconds(out, MetricHistogram::bounds[i]);
+        out.concat(',');
+      }
+      out.concat("\"+Inf\"],\"buckets\":[");
+      uint32_t cumulative = 0;
+      for (size_t i = 0; i < MetricHistogram::BUCKETS; i++) {
+        cumulative += h.histogram.buckets[i].value();
+        concatNumber(out, cumulative);
+        out.concat(i + 1 < MetricHistogram::BUCKETS ? ',' : ']');
+      }
+      out.concat(",\"count\":");
+      concatNumber(out, h.histogram.count.value());
+      out.concat(",\"sum\":");
+      concatSeconds(out, h.histogram.sum.value());
+      out.concat("},");
+    }
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+      out.concat('"');
+      out.concat(counters[i].name);
+      out.concat("_total\":");
+      concatNumber(out, counters[i].value);
+      out.concat(i + 1 < sizeof(counters) / sizeof(counters[0]) ? ',' : '}');
+    }
+    request->send(200, T_application_json, out);
+    return;
+  }
+
+  // Prometheus text exposition format
+  for (const auto &h : histograms) {
+    const String name = String("asyncwebserver_") + h.name + "_seconds";
+    out.concat("# TYPE ");
+    out.concat(name);
+    out.concat(" histogram\n");
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < MetricHistogram::BUCKETS; i++) {
+      cumulative += h.histogram.buckets[i].value();
+      out.concat(name);
+      out.concat("_bucket{le=\"");
+      if (i < MetricHistogram::BUCKETS - 1) {
+        concatSeconds(out, MetricHistogram::bounds[i]);
+      } else {
+        out.concat("+Inf");
+      }
+      out.concat("\"} ");
+      concatNumber(out, cumulative);
+      out.concat('\n');
+    }
+    out.concat(name);
+    out.concat("_sum ");
+    concatSeconds(out, h.histogram.sum.value());
+    out.concat('\n');
+    out.concat(name);
+    out.concat("_count ");
+    concatNumber(out, h.histogram.count.value());
+    out.concat('\n');
+  }
+  for (const auto &c : counters) {
+    out.concat("# TYPE asyncwebserver_");
+    out.concat(c.name);
+    out.concat("_total counter\nasyncwebserver_");
+    out.concat(c.name);
+    out.concat("_total ");
+    concatNumber(out, c.value);
+    out.concat('\n');
+  }
+  request->send(200, T_text_plain_prometheus, out);
+}
+#endif  // ASYNCWEBSERVER_METRICS
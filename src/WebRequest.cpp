@@ -5,6 +5,7 @@
 #include "WebAuthentication.h"
 #include "WebResponseImpl.h"
 #include "AsyncWebServerLogging.h"
+#include "AsyncWebServerWorkers.h"
 #include "literals.h"
 #include <cstring>
 
@@ -43,6 +44,7 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer *s, AsyncClient *c)
       (void)c;
       // async_ws_log_e("AsyncWebServerRequest::_onAck");
       AsyncWebServerRequest *req = (AsyncWebServerRequest *)r;
+      async_ws_metric_add(bytesSent, len);
       req->_onAck(len, time);
     },
     this
@@ -51,6 +53,11 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer *s, AsyncClient *c)
     [](void *r, AsyncClient *c) {
       // async_ws_log_e("AsyncWebServerRequest::_onDisconnect");
       AsyncWebServerRequest *req = (AsyncWebServerRequest *)r;
+#ifdef ESP32
+      if (req->_deferDisconnect()) {
+        return;
+      }
+#endif
       req->_onDisconnect();
       delete c;
     },
@@ -70,6 +77,7 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer *s, AsyncClient *c)
       (void)c;
       // async_ws_log_e("AsyncWebServerRequest::_onData");
       AsyncWebServerRequest *req = (AsyncWebServerRequest *)r;
+      async_ws_metric_add(bytesReceived, len);
       req->_onData(buf, len);
     },
     this
@@ -83,8 +91,30 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer *s, AsyncClient *c)
     },
     this
   );
+  async_ws_metric_inc(connections);
+}
+
+#if ASYNCWEBSERVER_REQUEST_POOL_SIZE
+using RequestPool = BlockPool<sizeof(AsyncWebServerRequest), ASYNCWEBSERVER_REQUEST_POOL_SIZE>;
+
+void *AsyncWebServerRequest::operator new(size_t size) noexcept {
+  void *ptr = RequestPool::allocate();
+  if (!ptr) {
+    async_ws_log_d("Request pool exhausted: allocating from heap");
+    ptr = ::operator new(size, std::nothrow);
+  }
+  return ptr;
 }
 
+void AsyncWebServerRequest::operator delete(void *ptr) noexcept {
+  if (RequestPool::owns(ptr)) {
+    RequestPool::deallocate(ptr);
+  } else {
+    ::operator delete(ptr);
+  }
+}
+#endif
+
 AsyncWebServerRequest::~AsyncWebServerRequest() {
   // async_ws_log_e("AsyncWebServerRequest::~AsyncWebServerRequest");
 
@@ -109,9 +139,24 @@ AsyncWebServerRequest::~AsyncWebServerRequest() {
   if (_itemBuffer) {
     free(_itemBuffer);
   }
+
+  delete _bodySink;
 }
 
 void AsyncWebServerRequest::_onData(void *buf, size_t len) {
+#ifdef ESP32
+  // while its handler is queued or running, an offloaded request only keeps the data of the next requests
+  std::unique_lock<std::recursive_mutex> lock(workerLock(), std::defer_lock);
+  if (!_lockOffloaded(lock)) {
+    _pipeline((uint8_t *)buf, len);
+    return;
+  }
+#endif
+#if ASYNCWEBSERVER_METRICS
+  if (_parseState == PARSE_REQ_START && !_tStart) {
+    _tStart = micros();
+  }
+#endif
   // SSL/TLS handshake detection
 #ifndef ASYNC_TCP_SSL_ENABLED
   if (_parseState == PARSE_REQ_START && len && ((uint8_t *)buf)[0] == 0x16) {  // 0x16 indicates a Handshake message (SSL/TLS).
@@ -139,22 +184,42 @@ void AsyncWebServerRequest::_onData(void *buf, size_t len) {
           break;
         }
       }
-      if (i == len) {  // No new line, just add the buffer in _temp
-        char ch = str[len - 1];
-        str[len - 1] = 0;
+      if (i == len) {  // No new line, keep the beginning of the line in _temp
         if (!_temp.reserve(_temp.length() + len)) {
           async_ws_log_e("Failed to allocate");
+          async_ws_metric_inc(allocFailures);
           _parseState = PARSE_REQ_FAIL;
           abort();
           return;
         }
-        _temp.concat(str);
-        _temp.concat(ch);
-      } else {       // Found new line - extract it and parse
-        str[i] = 0;  // Terminate the string at the end of the line.
-        _temp.concat(str);
-        _temp.trim();
-        _parseLine();
+        _temp.concat(str, len);
+      } else {  // Found new line - parse it in place, or in _temp if it started in a previous packet
+        const char *line = str;
+        size_t lineLen = i;
+        if (_temp.length()) {
+          if (!_temp.reserve(_temp.length() + i)) {
+            async_ws_log_e("Failed to allocate");
+            async_ws_metric_inc(allocFailures);
+            _parseState = PARSE_REQ_FAIL;
+            abort();
+            return;
+          }
+          _temp.concat(str, i);
+          line = _temp.c_str();
+          lineLen = _temp.length();
+        }
+        // trim the line, including the \r
+        while (lineLen && isspace((uint8_t)line[lineLen - 1])) {
+          lineLen--;
+        }
+        while (lineLen && isspace((uint8_t)*line)) {
+          line++;
+          lineLen--;
+        }
+        _parseLine(line, lineLen);
+        if (_temp.length()) {
+          _temp = emptyString;
+        }
         if (++i < len) {
           // Still have more buffer to process
           buf = str + i;
@@ -166,14 +231,23 @@ void AsyncWebServerRequest::_onData(void *buf, size_t len) {
       // A handler should be already attached at this point in _parseLine function.
       // If handler does nothing (_onRequest is NULL), we don't need to really parse the body.
       const bool needParse = _handler && !_handler->isRequestHandlerTrivial();
-      // Discard any bytes after content length; handlers may overrun their buffers
+      // Discard any bytes after content length; handlers may overrun their buffers.
+      // On a persistent connection, these bytes are the beginning of the next request.
+      const size_t received = len;
       len = std::min(len, _contentLength - _parsedLength);
       if (_isMultipart) {
         if (needParse) {
-          size_t i;
-          for (i = 0; i < len; i++) {
-            _parseMultipartPostByte(((uint8_t *)buf)[i], i == len - 1);
-            _parsedLength++;
+          size_t i = 0;
+          while (i < len) {
+            // item data is consumed in blocks up to the next possible boundary, the state machine handles the rest
+            const size_t consumed = _parseMultipartPostData((uint8_t *)buf + i, len - i);
+            i += consumed;
+            _parsedLength += consumed;
+            if (i < len) {
+              _parseMultipartPostByte(((uint8_t *)buf)[i], i == len - 1);
+              _parsedLength++;
+              i++;
+            }
           }
         } else {
           _parsedLength += len;
@@ -198,6 +272,9 @@ void AsyncWebServerRequest::_onData(void *buf, size_t len) {
           if (_handler) {
             _handler->handleBody(this, (uint8_t *)buf, len, _parsedLength, _contentLength);
           }
+          if (_bodySink) {
+            _bodySink->_write(_client, (uint8_t *)buf, len, _parsedLength + len == _contentLength);
+          }
           _parsedLength += len;
         } else if (needParse) {
           size_t i;
@@ -211,40 +288,177 @@ void AsyncWebServerRequest::_onData(void *buf, size_t len) {
       }
       if (_parsedLength == _contentLength) {
         _parseState = PARSE_REQ_END;
+        if (_bodySink) {
+          _bodySink->_end(_client);
+        }
+        if (received > len) {
+          _pipeline((uint8_t *)buf + len, received - len);
+        }
         _runMiddlewareChain();
         _send();
       }
+    } else if (_parseState == PARSE_REQ_END) {
+      // the client did not wait for the end of the response to send its next request
+      _pipeline((uint8_t *)buf, len);
     }
     break;
   }
 }
 
+void AsyncWebServerRequest::_pipeline(const uint8_t *data, size_t len) {
+  if (!_keepAlive) {
+    return;
+  }
+  if (_pipelined.size() + len > ASYNCWEBSERVER_KEEPALIVE_PIPELINE_SIZE) {
+    async_ws_log_w("Too many pipelined requests: connection will be closed");
+    _keepAlive = false;
+    _pipelined.clear();
+    _pipelined.shrink_to_fit();
+    return;
+  }
+  _pipelined.insert(_pipelined.end(), data, data + len);
+}
+
+void AsyncWebServerRequest::_endResponse() {
+  AsyncWebServerResponse *r = _response;
+  _response = NULL;
+  const bool keepAlive = _keepAlive && !_noReuse && !r->_failed() && _client->connected();
+  delete r;
+#if ASYNCWEBSERVER_METRICS
+  if (_tFirstByte) {
+    async_ws_metric_observe(response, micros() - _tFirstByte);
+  }
+#endif
+
+  if (!keepAlive) {
+    _client->close();
+    return;
+  }
+
+  _reset();
+
+  // process the requests received while the previous response was being sent
+  if (!_pipelined.empty()) {
+    std::vector<uint8_t> pipelined;
+    pipelined.swap(_pipelined);
+    _onData(pipelined.data(), pipelined.size());
+  }
+}
+
+void AsyncWebServerRequest::_reset() {
+  // the request ends here: notify the handler as if the client was disconnected
+  if (_onDisconnectfn) {
+    ArDisconnectHandler fn = std::move(_onDisconnectfn);
+    _onDisconnectfn = NULL;
+    fn();
+  }
+
+  // invalidate the weak pointers given by pause()
+  _this.reset();
+  _sent = false;
+  _paused = false;
+
+  _handler = NULL;
+  _parseState = PARSE_REQ_START;
+  _version = 0;
+  _method = HTTP_ANY;
+  _url = emptyString;
+  _host = emptyString;
+  _contentType = emptyString;
+  _boundary = emptyString;
+  _authorization = emptyString;
+  _temp = emptyString;
+  _reqconntype = RCT_HTTP;
+  _authMethod = AsyncAuthType::AUTH_NONE;
+  _isMultipart = false;
+  _isPlainPost = false;
+  _expectingContinue = false;
+  _contentLength = 0;
+  _parsedLength = 0;
+
+  _headers.clear();
+  _params.clear();
+  _pathParams.clear();
+  _attributes.clear();
+
+  _multiParseState = 0;
+  _boundaryPosition = 0;
+  _itemStartIndex = 0;
+  _itemSize = 0;
+  _itemName = emptyString;
+  _itemFilename = emptyString;
+  _itemType = emptyString;
+  _itemValue = emptyString;
+  if (_itemBuffer) {
+    free(_itemBuffer);
+    _itemBuffer = NULL;
+  }
+  _itemBufferIndex = 0;
+  _itemIsFile = false;
+
+  if (_tempObject != NULL) {
+    free(_tempObject);
+    _tempObject = NULL;
+  }
+  if (_tempFile) {
+    _tempFile.close();
+  }
+  delete _bodySink;
+  _bodySink = nullptr;
+
+  _keepAlive = false;
+#ifdef ESP32
+  _offloaded = false;
+#endif
+  ++_requestCount;
+#if ASYNCWEBSERVER_METRICS
+  _tStart = _tHeaders = _tDispatch = _tFirstByte = 0;
+#endif
+  _client->setRxTimeout(_server->keepAliveTimeout());
+}
+
 void AsyncWebServerRequest::_onPoll() {
   // os_printf("p\n");
+#ifdef ESP32
+  std::unique_lock<std::recursive_mutex> lock(workerLock(), std::defer_lock);
+  if (!_lockOffloaded(lock)) {
+    return;
+  }
+#endif
+  if (_bodySink && _parseState == PARSE_REQ_BODY) {
+    // the connection is idle: time to write behind
+    _bodySink->_flushPending(_client);
+  }
   if (_response != NULL && _client != NULL && _client->canSend()) {
     if (!_response->_finished()) {
       _response->_ack(this, 0, 0);
+      // hand over a persistent connection to the next request as soon as possible
+      if (_keepAlive && _response->_finished()) {
+        _endResponse();
+      }
     } else {
-      AsyncWebServerResponse *r = _response;
-      _response = NULL;
-      delete r;
-
-      _client->close();
+      _endResponse();
     }
   }
 }
 
 void AsyncWebServerRequest::_onAck(size_t len, uint32_t time) {
   // os_printf("a:%u:%u\n", len, time);
+#ifdef ESP32
+  std::unique_lock<std::recursive_mutex> lock(workerLock(), std::defer_lock);
+  if (!_lockOffloaded(lock)) {
+    return;
+  }
+#endif
   if (_response != NULL) {
     if (!_response->_finished()) {
       _response->_ack(this, len, time);
+      // hand over a persistent connection to the next request as soon as possible
+      if (_keepAlive && _response->_finished()) {
+        _endResponse();
+      }
     } else if (_response->_finished()) {
-      AsyncWebServerResponse *r = _response;
-      _response = NULL;
-      delete r;
-
-      _client->close();
+      _endResponse();
     }
   }
 }
@@ -255,6 +469,13 @@ void AsyncWebServerRequest::_onError(int8_t error) {
 
 void AsyncWebServerRequest::_onTimeout(uint32_t time) {
   (void)time;
+#ifdef ESP32
+  // an offloaded request has no timeout until its handler returns
+  std::unique_lock<std::recursive_mutex> lock(workerLock(), std::defer_lock);
+  if (!_lockOffloaded(lock)) {
+    return;
+  }
+#endif
   // os_printf("TIMEOUT: %u, state: %s\n", time, _client->stateToString());
   _client->close();
 }
@@ -295,131 +516,194 @@ void AsyncWebServerRequest::_addGetParams(const String &params) {
   }
 }
 
-bool AsyncWebServerRequest::_parseReqHead() {
-  // Split the head into method, url and version
-  int index = _temp.indexOf(' ');
-  String m = _temp.substring(0, index);
-  index = _temp.indexOf(' ', index + 1);
-  String u = _temp.substring(m.length() + 1, index);
-  _temp = _temp.substring(index + 1);
-
-  if (m == T_GET) {
-    _method = HTTP_GET;
-  } else if (m == T_POST) {
-    _method = HTTP_POST;
-  } else if (m == T_DELETE) {
-    _method = HTTP_DELETE;
-  } else if (m == T_PUT) {
-    _method = HTTP_PUT;
-  } else if (m == T_PATCH) {
-    _method = HTTP_PATCH;
-  } else if (m == T_HEAD) {
-    _method = HTTP_HEAD;
-  } else if (m == T_OPTIONS) {
-    _method = HTTP_OPTIONS;
-  } else if (m == T_PROPFIND) {
-    _method = HTTP_PROPFIND;
-  } else if (m == T_LOCK) {
-    _method = HTTP_LOCK;
-  } else if (m == T_UNLOCK) {
-    _method = HTTP_UNLOCK;
-  } else if (m == T_PROPPATCH) {
-    _method = HTTP_PROPPATCH;
-  } else if (m == T_MKCOL) {
-    _method = HTTP_MKCOL;
-  } else if (m == T_MOVE) {
-    _method = HTTP_MOVE;
-  } else if (m == T_COPY) {
-    _method = HTTP_COPY;
-  } else if (m == T_RESERVED) {
-    _method = HTTP_RESERVED;
-  } else if (m == T_ANY) {
-    _method = HTTP_ANY;
-  } else {
+static String makeString(const char *data, size_t len) {
+  String str;
+  if (len && str.reserve(len)) {
+    str.concat(data, len);
+  }
+  return str;
+}
+
+static bool tokenEquals(const char *token, size_t len, const char *literal) {
+  return strlen(literal) == len && strncmp(token, literal, len) == 0;
+}
+
+static bool tokenEqualsIgnoreCase(const char *token, size_t len, const char *literal) {
+  return strlen(literal) == len && strncasecmp(token, literal, len) == 0;
+}
+
+bool AsyncWebServerRequest::_parseReqHead(const char *line, size_t len) {
+  static const struct {
+    const char *name;
+    WebRequestMethod method;
+  } methods[] = {
+    {T_GET, HTTP_GET},
+    {T_POST, HTTP_POST},
+    {T_DELETE, HTTP_DELETE},
+    {T_PUT, HTTP_PUT},
+    {T_PATCH, HTTP_PATCH},
+    {T_HEAD, HTTP_HEAD},
+    {T_OPTIONS, HTTP_OPTIONS},
+    {T_PROPFIND, HTTP_PROPFIND},
+    {T_LOCK, HTTP_LOCK},
+    {T_UNLOCK, HTTP_UNLOCK},
+    {T_PROPPATCH, HTTP_PROPPATCH},
+    {T_MKCOL, HTTP_MKCOL},
+    {T_MOVE, HTTP_MOVE},
+    {T_COPY, HTTP_COPY},
+    {T_RESERVED, HTTP_RESERVED},
+    {T_ANY, HTTP_ANY},
+  };
+
+  // Split the head into method, url and version without copying it
+  const char *end = line + len;
+  const char *m = line;
+  const char *u = (const char *)memchr(m, ' ', len);
+  if (!u) {
     return false;
   }
+  const size_t mLen = u - m;
+  u++;
+  const char *v = (const char *)memchr(u, ' ', end - u);
+  if (!v) {
+    v = end;
+  }
+  const size_t uLen = v - u;
+  if (v < end) {
+    v++;
+  }
 
-  String g;
-  index = u.indexOf('?');
-  if (index > 0) {
-    g = u.substring(index + 1);
-    u = u.substring(0, index);
+  bool found = false;
+  for (const auto &entry : methods) {
+    if (tokenEquals(m, mLen, entry.name)) {
+      _method = entry.method;
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  const char *q = (const char *)memchr(u, '?', uLen);
+  if (q && q > u) {
+    _url = urlDecode(makeString(u, q - u));
+    _addGetParams(makeString(q + 1, u + uLen - q - 1));
+  } else {
+    _url = urlDecode(makeString(u, uLen));
   }
-  _url = urlDecode(u);
-  _addGetParams(g);
 
   if (!_url.length()) {
     return false;
   }
 
-  if (!_temp.startsWith(T_HTTP_1_0)) {
+  const size_t versionLen = strlen(T_HTTP_1_0);
+  if ((size_t)(end - v) < versionLen || strncmp(v, T_HTTP_1_0, versionLen) != 0) {
     _version = 1;
+    // HTTP/1.1 connections are persistent unless the client asks otherwise
+    _keepAlive = true;
   }
 
-  _temp = emptyString;
   return true;
 }
 
-bool AsyncWebServerRequest::_parseReqHeader() {
-  AsyncWebHeader header = AsyncWebHeader::parse(_temp);
-  if (header) {
-    const String &name = header.name();
-    const String &value = header.value();
-    if (name.equalsIgnoreCase(T_Host)) {
-      _host = value;
-    } else if (name.equalsIgnoreCase(T_Content_Type)) {
-      _contentType = value.substring(0, value.indexOf(';'));
-      if (value.startsWith(T_MULTIPART_)) {
-        _boundary = value.substring(value.indexOf('=') + 1);
-        _boundary.replace(String('"'), String());
-        _isMultipart = true;
-      }
-    } else if (name.equalsIgnoreCase(T_Content_Length)) {
-      _contentLength = atoi(value.c_str());
-    } else if (name.equalsIgnoreCase(T_EXPECT) && value.equalsIgnoreCase(T_100_CONTINUE)) {
-      _expectingContinue = true;
-    } else if (name.equalsIgnoreCase(T_AUTH)) {
-      int space = value.indexOf(' ');
-      if (space == -1) {
-        _authorization = value;
-        _authMethod = AsyncAuthType::AUTH_OTHER;
+bool AsyncWebServerRequest::_parseReqHeader(const char *line, size_t len) {
+  // https://developer.mozilla.org/en-US/docs/Web/HTTP/Reference/Headers
+  // The name is only allocated if the header is kept in the request, the value when it is kept or interpreted
+  const char *colon = (const char *)memchr(line, ':', len);
+  if (!colon || colon == line) {
+    return true;  // invalid header: ignored
+  }
+  const size_t nameLen = colon - line;
+  const char *start = colon + 1;
+  const char *end = line + len;
+  while (start < end && (*start == ' ' || *start == '\t')) {
+    start++;
+  }
+  const size_t valueLen = end - start;
+  const bool retained = _server->_retainHeader(line, nameLen);
+
+  String value;
+  if (retained) {
+    value = makeString(start, valueLen);
+  }
+
+  // the headers interpreted by the request are parsed even when they are not kept
+  auto is = [line, nameLen](const char *name) {
+    return tokenEqualsIgnoreCase(line, nameLen, name);
+  };
+  auto materialize = [&value, start, valueLen, retained]() -> const String & {
+    if (!retained) {
+      value = makeString(start, valueLen);
+    }
+    return value;
+  };
+
+  if (is(T_Host)) {
+    _host = materialize();
+  } else if (is(T_Content_Type)) {
+    materialize();
+    _contentType = value.substring(0, value.indexOf(';'));
+    if (value.startsWith(T_MULTIPART_)) {
+      _boundary = value.substring(value.indexOf('=') + 1);
+      _boundary.replace(String('"'), String());
+      _isMultipart = true;
+    }
+  } else if (is(T_Content_Length)) {
+    _contentLength = strtoul(start, nullptr, 10);
+  } else if (is(T_EXPECT) && tokenEqualsIgnoreCase(start, valueLen, T_100_CONTINUE)) {
+    _expectingContinue = true;
+  } else if (is(T_AUTH)) {
+    const char *space = (const char *)memchr(start, ' ', valueLen);
+    if (!space) {
+      _authorization = materialize();
+      _authMethod = AsyncAuthType::AUTH_OTHER;
+    } else {
+      const size_t methodLen = space - start;
+      if (tokenEqualsIgnoreCase(start, methodLen, T_BASIC)) {
+        _authMethod = AsyncAuthType::AUTH_BASIC;
+      } else if (tokenEqualsIgnoreCase(start, methodLen, T_DIGEST)) {
+        _authMethod = AsyncAuthType::AUTH_DIGEST;
+      } else if (tokenEqualsIgnoreCase(start, methodLen, T_BEARER)) {
+        _authMethod = AsyncAuthType::AUTH_BEARER;
       } else {
-        String method = value.substring(0, space);
-        if (method.equalsIgnoreCase(T_BASIC)) {
-          _authMethod = AsyncAuthType::AUTH_BASIC;
-        } else if (method.equalsIgnoreCase(T_DIGEST)) {
-          _authMethod = AsyncAuthType::AUTH_DIGEST;
-        } else if (method.equalsIgnoreCase(T_BEARER)) {
-          _authMethod = AsyncAuthType::AUTH_BEARER;
-        } else {
-          _authMethod = AsyncAuthType::AUTH_OTHER;
-        }
-        _authorization = value.substring(space + 1);
+        _authMethod = AsyncAuthType::AUTH_OTHER;
       }
-    } else if (name.equalsIgnoreCase(T_UPGRADE) && value.equalsIgnoreCase(T_WS)) {
-      // WebSocket request can be uniquely identified by header: [Upgrade: websocket]
-      _reqconntype = RCT_WS;
-    } else if (name.equalsIgnoreCase(T_ACCEPT)) {
-      String lowcase(value);
-      lowcase.toLowerCase();
+      _authorization = makeString(space + 1, end - space - 1);
+    }
+  } else if (is(T_Connection)) {
+    String lowcase = makeString(start, valueLen);
+    lowcase.toLowerCase();
+    if (lowcase.indexOf(T_close) >= 0) {
+      _keepAlive = false;
+    } else if (lowcase.indexOf(T_keep_alive) >= 0) {
+      _keepAlive = true;
+    }
+  } else if (is(T_Transfer_Encoding)) {
+    // chunked request bodies are not parsed: we cannot know where the next request would start,
+    // whatever a Connection header says before or after this one
+    _keepAlive = false;
+    _noReuse = true;
+  } else if (is(T_UPGRADE) && tokenEqualsIgnoreCase(start, valueLen, T_WS)) {
+    // WebSocket request can be uniquely identified by header: [Upgrade: websocket]
+    _reqconntype = RCT_WS;
+  } else if (is(T_ACCEPT)) {
+    String lowcase = makeString(start, valueLen);
+    lowcase.toLowerCase();
 #ifndef ESP8266
-      const char *substr = std::strstr(lowcase.c_str(), T_text_event_stream);
+    const char *substr = std::strstr(lowcase.c_str(), T_text_event_stream);
 #else
-      const char *substr = std::strstr(lowcase.c_str(), String(T_text_event_stream).c_str());
+    const char *substr = std::strstr(lowcase.c_str(), String(T_text_event_stream).c_str());
 #endif
-      if (substr != NULL) {
-        // WebEvent request can be uniquely identified by header:  [Accept: text/event-stream]
-        _reqconntype = RCT_EVENT;
-      }
+    if (substr != NULL) {
+      // WebEvent request can be uniquely identified by header:  [Accept: text/event-stream]
+      _reqconntype = RCT_EVENT;
     }
-    _headers.emplace_back(std::move(header));
   }
-#if defined(TARGET_RP2040) || defined(TARGET_RP2350) || defined(PICO_RP2040) || defined(PICO_RP2350) || defined(LIBRETINY)
-  // Ancient PRI core does not have String::clear() method 8-()
-  _temp = emptyString;
-#else
-  _temp.clear();
-#endif
+
+  if (retained) {
+    _headers.emplace_back(makeString(line, nameLen), std::move(value));
+  }
   return true;
 }
 
@@ -474,6 +758,49 @@ enum {
   PARSE_ERROR
 };
 
+size_t AsyncWebServerRequest::_parseMultipartPostData(uint8_t *data, size_t len) {
+  if (_multiParseState != WAIT_FOR_RETURN1 || !_parsedLength) {
+    return 0;
+  }
+  // the item data runs at least until the next \r, which might be the beginning of the boundary
+  const uint8_t *cr = (const uint8_t *)memchr(data, '\r', len);
+  const size_t n = cr ? cr - data : len;
+  if (!n) {
+    return 0;
+  }
+
+  if (!_itemIsFile) {
+    _itemValue.concat((const char *)data, n);
+    _itemSize += n;
+    return n;
+  }
+
+  if (_itemBufferIndex + n <= RESPONSE_STREAM_BUFFER_SIZE) {
+    // small slice: keep it in the item buffer
+    memcpy(_itemBuffer + _itemBufferIndex, data, n);
+    _itemBufferIndex += n;
+    _itemSize += n;
+    if (n == len || _itemBufferIndex == RESPONSE_STREAM_BUFFER_SIZE) {
+      if (_handler) {
+        _handler->handleUpload(this, _itemFilename, _itemSize - _itemBufferIndex, _itemBuffer, _itemBufferIndex, false);
+      }
+      _itemBufferIndex = 0;
+    }
+    return n;
+  }
+
+  // large slice: flush the buffered bytes, then give the slice to the handler without copying it
+  if (_handler) {
+    if (_itemBufferIndex) {
+      _handler->handleUpload(this, _itemFilename, _itemSize - _itemBufferIndex, _itemBuffer, _itemBufferIndex, false);
+    }
+    _handler->handleUpload(this, _itemFilename, _itemSize, data, n, false);
+  }
+  _itemBufferIndex = 0;
+  _itemSize += n;
+  return n;
+}
+
 void AsyncWebServerRequest::_parseMultipartPostByte(uint8_t data, bool last) {
 #define itemWriteByte(b)          \
   do {                            \
@@ -558,9 +885,10 @@ void AsyncWebServerRequest::_parseMultipartPostByte(uint8_t data, bool last) {
           if (_itemBuffer) {
             free(_itemBuffer);
           }
-          _itemBuffer = (uint8_t *)malloc(RESPONSE_STREAM_BUFFER_SIZE);
+          _itemBuffer = (uint8_t *)allocateBuffer(AsyncMemoryUse::UPLOAD, RESPONSE_STREAM_BUFFER_SIZE);
           if (_itemBuffer == NULL) {
             async_ws_log_e("Failed to allocate");
+            async_ws_metric_inc(allocFailures);
             _multiParseState = PARSE_ERROR;
             abort();
             return;
@@ -669,14 +997,15 @@ void AsyncWebServerRequest::_parseMultipartPostByte(uint8_t data, bool last) {
   }
 }
 
-void AsyncWebServerRequest::_parseLine() {
+void AsyncWebServerRequest::_parseLine(const char *line, size_t len) {
   if (_parseState == PARSE_REQ_START) {
-    if (!_temp.length()) {
+    if (!len) {
       _parseState = PARSE_REQ_FAIL;
       abort();
     } else {
-      if (_parseReqHead()) {
+      if (_parseReqHead(line, len)) {
         _parseState = PARSE_REQ_HEADERS;
+        async_ws_metric_inc(requests);
       } else {
         _parseState = PARSE_REQ_FAIL;
         abort();
@@ -686,10 +1015,22 @@ void AsyncWebServerRequest::_parseLine() {
   }
 
   if (_parseState == PARSE_REQ_HEADERS) {
-    if (!_temp.length()) {
+    if (!len) {
       // end of headers
+#if ASYNCWEBSERVER_METRICS
+      _tHeaders = micros();
+      async_ws_metric_observe(headers, _tHeaders - _tStart);
+#endif
       _server->_rewriteRequest(this);
       _server->_attachHandler(this);
+      if (_keepAlive && !_noReuse) {
+        // WebSocket and SSE connections are taken over by their handler
+        const uint32_t maxRequests = _server->keepAliveMaxRequests();
+        _keepAlive = _server->keepAlive() && isExpectedRequestedConnType(RCT_DEFAULT, RCT_HTTP)
+                     && (!maxRequests || _requestCount + 1 < maxRequests);
+      } else {
+        _keepAlive = false;
+      }
       if (_expectingContinue) {
         String response(T_HTTP_100_CONT);
         _client->write(response.c_str(), response.length());
@@ -702,28 +1043,72 @@ void AsyncWebServerRequest::_parseLine() {
         _send();
       }
     } else {
-      _parseReqHeader();
+      _parseReqHeader(line, len);
     }
   }
 }
 
 void AsyncWebServerRequest::_runMiddlewareChain() {
+#if ASYNCWEBSERVER_METRICS
+  _tDispatch = micros();
+  async_ws_metric_observe(dispatch, _tDispatch - _tHeaders);
+#endif
+#ifdef ESP32
+  // the middlewares run around the handler on its worker: what they do after next() sees its response
+  if (_handler && _handler->isOffloaded()) {
+    if (!_offload([](AsyncWebServerRequest *request) {
+          request->_runChains();
+        })) {
+      async_ws_log_w("Worker queue full: request rejected");
+      async_ws_metric_inc(offloadRejected);
+      AsyncWebServerResponse *response = beginResponse(503);
+      response->addHeader(T_retry_after, "1");
+      send(response);
+    }
+    return;
+  }
+#endif
+  _runChains();
+}
+
+void AsyncWebServerRequest::_runChains() {
+  bool handled = false;
   if (_handler && _handler->mustSkipServerMiddlewares()) {
-    _handler->_runChain(this, [this]() {
+    _handler->_runChain(this, [this, &handled]() {
+      handled = true;
       _handler->handleRequest(this);
     });
   } else {
-    _server->_runChain(this, [this]() {
+    _server->_runChain(this, [this, &handled]() {
       if (_handler) {
-        _handler->_runChain(this, [this]() {
+        _handler->_runChain(this, [this, &handled]() {
+          handled = true;
           _handler->handleRequest(this);
         });
       }
     });
   }
+  // the middlewares call next() before returning: a handler not reached was rejected
+  if (_handler && !handled) {
+    _handler->handleRejected(this);
+  }
+}
+
+bool AsyncWebServerRequest::bodyAllowed() {
+  if (!_handler) {
+    return false;
+  }
+  return (_handler->mustSkipServerMiddlewares() || _server->_allowsBody(this)) && _handler->_allowsBody(this);
 }
 
 void AsyncWebServerRequest::_send() {
+#ifdef ESP32
+  // the response of an offloaded handler is sent by its worker, once the handler returns
+  std::unique_lock<std::recursive_mutex> lock(workerLock(), std::defer_lock);
+  if (!_lockOffloaded(lock)) {
+    return;
+  }
+#endif
   if (!_sent && !_paused) {
     // async_ws_log_d("AsyncWebServerRequest::_send()");
 
@@ -741,6 +1126,10 @@ void AsyncWebServerRequest::_send() {
     _client->setRxTimeout(0);
     _response->_respond(this);
     _sent = true;
+#if ASYNCWEBSERVER_METRICS
+    _tFirstByte = micros();
+    async_ws_metric_observe(firstByte, _tFirstByte - _tDispatch);
+#endif
   }
 }
 
@@ -756,6 +1145,70 @@ AsyncWebServerRequestPtr AsyncWebServerRequest::pause() {
   return _this;
 }
 
+#ifdef ESP32
+bool AsyncWebServerRequest::_offload(const std::function<void(AsyncWebServerRequest *)> &handler) {
+  std::lock_guard<std::recursive_mutex> guard(workerLock());
+  _offloaded = true;
+  _offloading = true;
+  _offloadDisconnected = false;
+  // as for a paused request, the client can take as long as the handler to be answered
+  _client->setRxTimeout(0);
+  if (!runOnWorker([this, handler]() {
+        _runOffloaded(handler);
+      })) {
+    _offloading = false;
+    _offloaded = false;
+    return false;
+  }
+  return true;
+}
+
+// Runs on the worker
+void AsyncWebServerRequest::_runOffloaded(const std::function<void(AsyncWebServerRequest *)> &handler) {
+  bool disconnected;
+  {
+    std::lock_guard<std::recursive_mutex> guard(workerLock());
+    disconnected = _offloadDisconnected;
+  }
+  if (!disconnected) {
+    handler(this);
+  }
+
+  // the AsyncTCP task waits for the end of the hand-over before handling any event of the request
+  std::unique_lock<std::recursive_mutex> lock(workerLock());
+  _offloading = false;
+  if (_offloadDisconnected) {
+    AsyncClient *c = _client;
+    lock.unlock();
+    _onDisconnect();
+    delete c;
+    return;
+  }
+  _send();
+}
+
+bool AsyncWebServerRequest::_lockOffloaded(std::unique_lock<std::recursive_mutex> &lock) {
+  if (!_offloaded) {
+    return true;
+  }
+  lock.lock();
+  return !_offloading;
+}
+
+// The request is deleted by its worker once the handler returns
+bool AsyncWebServerRequest::_deferDisconnect() {
+  if (!_offloaded) {
+    return false;
+  }
+  std::lock_guard<std::recursive_mutex> guard(workerLock());
+  if (!_offloading) {
+    return false;
+  }
+  _offloadDisconnected = true;
+  return true;
+}
+#endif
+
 void AsyncWebServerRequest::abort() {
   if (!_sent) {
     _sent = true;
@@ -823,6 +1276,41 @@ size_t AsyncWebServerRequest::getHeaderNames(std::vector<const char *> &names) c
   return names.size() - size;
 }
 
+bool AsyncWebServerRequest::acceptsEncoding(const char *encoding) const {
+  const AsyncWebHeader *accept = getHeader(T_Accept_Encoding);
+  if (!accept) {
+    return false;
+  }
+  // list of codings, each possibly followed by a weight: "gzip, deflate;q=0.5, br;q=0"
+  const size_t len = strlen(encoding);
+  const char *p = accept->value().c_str();
+  while (*p) {
+    while (*p == ' ' || *p == ',') {
+      p++;
+    }
+    const char *end = p;
+    while (*end && *end != ',' && *end != ';' && *end != ' ') {
+      end++;
+    }
+    const bool match = ((size_t)(end - p) == len && strncasecmp(p, encoding, len) == 0) || (end - p == 1 && *p == '*');
+    // a weight of 0 refuses the coding
+    bool refused = false;
+    const char *next = strchr(end, ',');
+    const char *q = strstr(end, "q=");
+    if (q && (!next || q < next)) {
+      refused = atof(q + 2) <= 0;
+    }
+    if (match && !refused) {
+      return true;
+    }
+    if (!next) {
+      break;
+    }
+    p = next;
+  }
+  return false;
+}
+
 bool AsyncWebServerRequest::removeHeader(const char *name) {
   const size_t size = _headers.size();
   _headers.remove_if([name](const AsyncWebHeader &header) {
@@ -936,6 +1424,11 @@ AsyncResponseStream *AsyncWebServerRequest::beginResponseStream(const char *cont
   return new AsyncResponseStream(contentType, bufferSize);
 }
 
+AsyncResponseStream *
+  AsyncWebServerRequest::beginResponseStream(const char *contentType, AwsResponseStreamProducer producer, size_t blockSize, size_t blocks) {
+  return new AsyncResponseStream(contentType, producer, blockSize, blocks, _version);
+}
+
 AsyncWebServerResponse *AsyncWebServerRequest::beginResponse_P(int code, const String &contentType, PGM_P content, AwsTemplateProcessor callback) {
   return new AsyncProgmemResponse(code, contentType, (const uint8_t *)content, strlen_P(content), callback);
 }
@@ -1022,6 +1515,7 @@ void AsyncWebServerRequest::requestAuthentication(AsyncAuthType method, const ch
         r->addHeader(T_WWW_AUTH, header.c_str());
       } else {
         async_ws_log_e("Failed to allocate");
+        async_ws_metric_inc(allocFailures);
         abort();
       }
 
@@ -1046,6 +1540,7 @@ void AsyncWebServerRequest::requestAuthentication(AsyncAuthType method, const ch
           r->addHeader(T_WWW_AUTH, header.c_str());
         } else {
           async_ws_log_e("Failed to allocate");
+          async_ws_metric_inc(allocFailures);
           abort();
         }
       }
@@ -1133,6 +1628,7 @@ String AsyncWebServerRequest::urlDecode(const String &text) const {
   // Allocate the string internal buffer - never longer from source text
   if (!decoded.reserve(len)) {
     async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
     return emptyString;
   }
   while (i < len) {
@@ -1219,3 +1715,100 @@ bool AsyncWebServerRequest::isExpectedRequestedConnType(RequestedConnectionType
   return ((erct1 != RCT_NOT_USED) && (erct1 == _reqconntype)) || ((erct2 != RCT_NOT_USED) && (erct2 == _reqconntype))
          || ((erct3 != RCT_NOT_USED) && (erct3 == _reqconntype));
 }
+
+AsyncFileBodySink *AsyncWebServerRequest::sinkBody(File file) {
+  delete _bodySink;
+  _bodySink = new (std::nothrow) AsyncFileBodySink(file);
+  if (!_bodySink) {
+    async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
+  }
+  return _bodySink;
+}
+
+AsyncFileBodySink::AsyncFileBodySink(File file, size_t pageSize) : _file(file), _pageSize(pageSize ? pageSize : 1), _failed(!file) {}
+
+AsyncFileBodySink::~AsyncFileBodySink() {
+  // not ended: the body is incomplete
+  free(_pages);
+  if (_file) {
+    _file.close();
+  }
+}
+
+bool AsyncFileBodySink::_writeFile(const uint8_t *data, size_t len) {
+  if (!_failed && _file.write(data, len) != len) {
+    async_ws_log_w("Failed to write the body");
+    _failed = true;
+  }
+  if (!_failed) {
+    _written += len;
+  }
+  return !_failed;
+}
+
+void AsyncFileBodySink::_write(AsyncClient *client, const uint8_t *data, size_t len, bool last) {
+  if (_failed || !len) {
+    return;
+  }
+  // the page completed by the previous data is written now, while this data goes to the other page
+  _flushPending(client);
+  if (!_pages) {
+    _pages = (uint8_t *)malloc(2 * _pageSize);
+    if (!_pages) {
+      // still works, without buffering
+      async_ws_log_w("Failed to allocate the pages: body written unbuffered");
+      _writeFile(data, len);
+      return;
+    }
+  }
+  if (!last) {
+    // the end of the body is written by _end() before this data is acknowledged
+    client->ackLater();
+  }
+  while (len) {
+    uint8_t *page = _pages + _active * _pageSize;
+    const size_t n = std::min(len, _pageSize - _fill);
+    memcpy(page + _fill, data, n);
+    _fill += n;
+    _held += last ? 0 : n;
+    data += n;
+    len -= n;
+    if (_fill == _pageSize) {
+      // the other page cannot wait any longer
+      _flushPending(client);
+      _pending = page;
+      _active ^= 1;
+      _fill = 0;
+    }
+  }
+}
+
+void AsyncFileBodySink::_flushPending(AsyncClient *client) {
+  if (_pending) {
+    _writeFile(_pending, _pageSize);
+    _pending = nullptr;
+  }
+  // the bytes on flash are acknowledged, the ones still in a page are held back (all of them are released on failure)
+  const size_t unwritten = _failed ? 0 : _fill;
+  if (_held > unwritten) {
+    client->ack(_held - unwritten);
+    _held = unwritten;
+  }
+}
+
+void AsyncFileBodySink::_end(AsyncClient *client) {
+  _flushPending(client);
+  if (_pages && _fill) {
+    _writeFile(_pages + _active * _pageSize, _fill);
+    _fill = 0;
+  }
+  free(_pages);
+  _pages = nullptr;
+  if (_file) {
+    _file.close();
+  }
+  // the rest of the segments held back, if they also carried the head of the request
+  _held = 0;
+  client->ack(SIZE_MAX);
+}
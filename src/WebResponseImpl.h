@@ -10,12 +10,32 @@
 #undef max
 #endif
 #include "literals.h"
+#include "DeflateEncoder.h"
 #include <cbuf.h>
 #include <memory>
 #include <vector>
+#ifdef ESP32
+#include <esp_partition.h>
+#endif
 
 // It is possible to restore these defines, but one can use _min and _max instead. Or std::min, std::max.
 
+namespace asyncsrv {
+
+// Returns the Content-Encoding of the file opened to serve path, or nullptr if it is not a precompressed variant of path
+const char *fileEncoding(const char *file, const String &path);
+
+// Returns true for the headers which only apply to a single connection, and which a proxy must not forward (RFC 9110 7.6.1)
+bool isHopByHopHeader(const char *name, size_t len);
+
+#ifdef ESP32
+// Maps the whole partition in the address space of the data, or returns nullptr if it cannot be mapped as it is read.
+// A partition is only mapped once and stays mapped, instead of being mapped again for each response.
+const uint8_t *mapPartition(const esp_partition_t *partition);
+#endif
+
+}  // namespace asyncsrv
+
 class AsyncBasicResponse : public AsyncWebServerResponse {
 private:
   String _content;
@@ -31,6 +51,19 @@ public:
   }
 };
 
+#ifndef TEMPLATE_PLACEHOLDER
+#define TEMPLATE_PLACEHOLDER '%'
+#endif
+
+#define TEMPLATE_PARAM_NAME_LENGTH 32
+
+// Position of a template placeholder, including its placeholder characters, in a content scanned before being sent
+struct AsyncTemplatePlaceholder {
+  size_t offset;
+  uint8_t length;
+};
+typedef std::vector<AsyncTemplatePlaceholder> AsyncTemplateIndex;
+
 class AsyncAbstractResponse : public AsyncWebServerResponse {
 private:
 #if ASYNCWEBSERVER_USE_CHUNK_INFLIGHT
@@ -40,20 +73,80 @@ private:
   size_t _in_flight_credit{2};
 #endif
   String _head;
-  // Data is inserted into cache at begin().
-  // This is inefficient with vector, but if we use some other container,
-  // we won't be able to access it as contiguous array of bytes when reading from it,
-  // so by gaining performance in one place, we'll lose it in another.
-  std::vector<uint8_t> _cache;
-  size_t _readDataFromCacheOrContent(uint8_t *data, const size_t len);
+  // Buffer reused by each call to _ack() to fill the response data, it only grows up to the available socket space
+  uint8_t *_sendBuffer{nullptr};
+  size_t _sendBufferSize{0};
+  // Template processing state:
+  // content read ahead and not processed yet, it always starts at a placeholder character when it is read in place
+  uint8_t *_tplStage{nullptr};
+  size_t _tplStageSize{0};
+  size_t _tplStageStart{0};
+  size_t _tplStageEnd{0};
+  bool _tplEnded{false};
+  // value of the last placeholder, sent over the next buffers if it does not fit
+  String _tplValue;
+  size_t _tplValueSent{0};
+  // placeholders of the content when they were found before sending it, the literal runs between them are read directly
+  std::shared_ptr<const AsyncTemplateIndex> _tplIndex;
+  size_t _tplIndexNext{0};
+  size_t _tplOffset{0};
+  bool _tplStarted{false};
+  // Ranges of the content sent in a 206 response, as the parts of a multipart/byteranges content if there are several of them
+  struct Range {
+    size_t start;
+    size_t length;
+  };
+  std::vector<Range> _ranges;
+  size_t _rangeTotal{0};
+  String _rangeContentType;
+  String _rangeBoundary;
+  String _rangeHead;
+  size_t _rangeHeadSent{0};
+  size_t _rangeIndex{0};
+  size_t _rangeSent{0};
+  // On-the-fly compression of the content, see setCompression(): _sentLength counts the content given to the encoder,
+  // which is still bounded by _contentLength if this length was known
+  std::unique_ptr<asyncsrv::DeflateEncoder> _deflate;
+  bool _deflateSized{false};
+  void _prepareCompression(AsyncWebServerRequest *request);
+  size_t _fillBufferAndCompress(uint8_t *buf, size_t maxLen);
+  size_t _fillContent(uint8_t *buf, size_t maxLen) {
+    return _deflate ? _fillBufferAndCompress(buf, maxLen) : _fillBufferAndProcessTemplates(buf, maxLen);
+  }
+  bool _parseRanges(const char *value);
+  void _prepareRanges(AsyncWebServerRequest *request);
+  void _rangePartHead(String &head, size_t index) const;
+  size_t _fillBufferWithRanges(uint8_t *buf, size_t maxLen);
+  bool _reserveTemplateStage(size_t len);
+  size_t _processTemplate(uint8_t *data, const uint8_t *placeholder, size_t len);
   size_t _fillBufferAndProcessTemplates(uint8_t *buf, size_t maxLen);
 
 protected:
   AwsTemplateProcessor _callback;
+  void _setContentTypeFromPath(const String &path);
+  // Returns the placeholders of the whole content if the response is able to scan it before sending it
+  virtual std::shared_ptr<const AsyncTemplateIndex> _templateIndex() {
+    return nullptr;
+  }
+  // Returns true if the content can be sent by ranges, from the offsets given to _seekContent()
+  virtual bool _seekable() const {
+    return false;
+  }
+  virtual bool _seekContent(size_t offset __attribute__((unused))) {
+    return false;
+  }
+  // Returns the address of the next len bytes of the content and skips them if they can be read in place, nullptr to
+  // have them copied by _fillBuffer(). They are written to the connection from there, without going through the send buffer.
+  virtual const uint8_t *_directContent(size_t len __attribute__((unused))) {
+    return nullptr;
+  }
 
 public:
   AsyncAbstractResponse(AwsTemplateProcessor callback = nullptr);
-  virtual ~AsyncAbstractResponse() {}
+  virtual ~AsyncAbstractResponse() {
+    free(_sendBuffer);
+    free(_tplStage);
+  }
   void _respond(AsyncWebServerRequest *request) override final;
   size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time) override final;
   virtual bool _sourceValid() const {
@@ -64,18 +157,22 @@ public:
   }
 };
 
-#ifndef TEMPLATE_PLACEHOLDER
-#define TEMPLATE_PLACEHOLDER '%'
-#endif
-
-#define TEMPLATE_PARAM_NAME_LENGTH 32
 class AsyncFileResponse : public AsyncAbstractResponse {
   using File = fs::File;
   using FS = fs::FS;
 
 private:
   File _content;
-  void _setContentTypeFromPath(const String &path);
+  String _path;
+
+protected:
+  std::shared_ptr<const AsyncTemplateIndex> _templateIndex() override;
+  bool _seekable() const override {
+    return true;
+  }
+  bool _seekContent(size_t offset) override {
+    return _content.seek(offset);
+  }
 
 public:
   AsyncFileResponse(FS &fs, const String &path, const char *contentType = asyncsrv::empty, bool download = false, AwsTemplateProcessor callback = nullptr);
@@ -109,11 +206,20 @@ public:
   size_t _fillBuffer(uint8_t *buf, size_t maxLen) override final;
 };
 
+// The callback is given the offset of the data to fill: adding an "Accept-Ranges: bytes" header to the response
+// allows the ranges of its content to be requested.
 class AsyncCallbackResponse : public AsyncAbstractResponse {
 private:
   AwsResponseFiller _content;
   size_t _filledLength;
 
+protected:
+  bool _seekable() const override;
+  bool _seekContent(size_t offset) override {
+    _filledLength = offset;
+    return true;
+  }
+
 public:
   AsyncCallbackResponse(const char *contentType, size_t len, AwsResponseFiller callback, AwsTemplateProcessor templateCallback = nullptr);
   AsyncCallbackResponse(const String &contentType, size_t len, AwsResponseFiller callback, AwsTemplateProcessor templateCallback = nullptr)
@@ -143,6 +249,20 @@ class AsyncProgmemResponse : public AsyncAbstractResponse {
 private:
   const uint8_t *_content;
   size_t _readLength;
+  size_t _size;  // length of the whole content, _contentLength being the length of the ranges sent if any
+
+protected:
+  std::shared_ptr<const AsyncTemplateIndex> _templateIndex() override;
+  bool _seekable() const override {
+    return true;
+  }
+  bool _seekContent(size_t offset) override {
+    _readLength = offset;
+    return true;
+  }
+#ifdef ESP32
+  const uint8_t *_directContent(size_t len) override;
+#endif
 
 public:
   AsyncProgmemResponse(int code, const char *contentType, const uint8_t *content, size_t len, AwsTemplateProcessor callback = nullptr);
@@ -154,13 +274,93 @@ public:
   size_t _fillBuffer(uint8_t *buf, size_t maxLen) override final;
 };
 
+#ifdef ESP32
+// Content of a flash partition, from offset for len bytes (up to its end by default).
+// It is written from the partition mapped by asyncsrv::mapPartition(), or read with esp_partition_read() if it cannot be mapped.
+class AsyncFlashResponse : public AsyncAbstractResponse {
+private:
+  const esp_partition_t *_partition;
+  const uint8_t *_content{nullptr};  // mapped content, nullptr if it is read from the partition
+  size_t _offset{0};
+  size_t _readLength{0};
+  size_t _size{0};  // length of the whole content, _contentLength being the length of the ranges sent if any
+
+protected:
+  bool _seekable() const override {
+    return true;
+  }
+  bool _seekContent(size_t offset) override {
+    _readLength = offset;
+    return true;
+  }
+  const uint8_t *_directContent(size_t len) override;
+
+public:
+  AsyncFlashResponse(const esp_partition_t *partition, const char *contentType, size_t offset = 0, size_t len = SIZE_MAX);
+  AsyncFlashResponse(const esp_partition_t *partition, const String &contentType, size_t offset = 0, size_t len = SIZE_MAX)
+    : AsyncFlashResponse(partition, contentType.c_str(), offset, len) {}
+  // a file of a flash image, with the content type of its path
+  AsyncFlashResponse(const esp_partition_t *partition, size_t offset, size_t len, const String &path, const char *contentEncoding);
+  bool _sourceValid() const override final {
+    return _partition != nullptr;
+  }
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override final;
+};
+#endif
+
+// File content held in memory by the cache of AsyncStaticWebHandler
+class AsyncCachedFileResponse : public AsyncAbstractResponse {
+private:
+  std::shared_ptr<uint8_t> _content;
+  size_t _readLength;
+  size_t _size;  // length of the whole content, _contentLength being the length of the ranges sent if any
+
+protected:
+  bool _seekable() const override {
+    return true;
+  }
+  bool _seekContent(size_t offset) override {
+    _readLength = offset;
+    return true;
+  }
+
+public:
+  AsyncCachedFileResponse(
+    std::shared_ptr<uint8_t> content, size_t len, const String &path, const char *contentEncoding, AwsTemplateProcessor callback = nullptr
+  );
+  bool _sourceValid() const override final {
+    return !!(_content);
+  }
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override final;
+};
+
 class AsyncResponseStream : public AsyncAbstractResponse, public Print {
 private:
-  std::unique_ptr<cbuf> _content;
+  // the whole content, kept until it is sent, or null in streaming mode
+  std::unique_ptr<uint8_t, asyncsrv::BufferDeleter> _content;
+  size_t _capacity{0};
+  // Streaming mode: the content goes out as it is written, through a ring of fixed-size blocks each allocated on first use,
+  // and the producer is called for more of it each time blocks are freed by the sent content
+  struct Block {
+    std::unique_ptr<uint8_t, asyncsrv::BufferDeleter> data;
+    size_t len;
+  };
+  std::vector<Block> _blocks;
+  size_t _blockSize{0};  // 0 if not streaming
+  size_t _first{0};      // oldest block holding content
+  size_t _used{0};       // blocks holding content, from _first
+  size_t _readPos{0};    // content already sent from the oldest block, or from _content
+  size_t _buffered{0};   // content not sent yet
+  AwsResponseStreamProducer _producer;
+  bool _ended{false};
+  size_t _writeBlocks(const uint8_t *data, size_t len);
+  size_t _readBlocks(uint8_t *buf, size_t maxLen);
 
 public:
   AsyncResponseStream(const char *contentType, size_t bufferSize);
   AsyncResponseStream(const String &contentType, size_t bufferSize) : AsyncResponseStream(contentType.c_str(), bufferSize) {}
+  // streaming mode, sent chunked or, if chunked is false (HTTP/1.0), until the connection is closed
+  AsyncResponseStream(const char *contentType, AwsResponseStreamProducer producer, size_t blockSize, size_t blocks, bool chunked = true);
   bool _sourceValid() const override final {
     return (_state < RESPONSE_END);
   }
@@ -171,9 +371,61 @@ public:
    * @brief Returns the number of bytes available in the stream.
    */
   size_t available() const {
-    return _content->available();
+    return _buffered;
   }
+  /**
+   * @brief Returns the number of bytes which can be written without being refused: in streaming mode,
+   * what remains of the blocks, the producer having to wait for its next call to write more.
+   */
+  size_t room() const;
   using Print::write;
 };
 
+// Longest head of an upstream response relayed by AsyncProxyResponse
+#ifndef ASYNCWEBSERVER_PROXY_MAX_HEAD
+#define ASYNCWEBSERVER_PROXY_MAX_HEAD 2048
+#endif
+
+/**
+ * @brief Relays the response of an upstream HTTP server to a request of AsyncProxyHandler.
+ * The request is paused while the upstream server is connected and sends its head, the response being sent with the
+ * upstream status and headers once the head is parsed: until then, the response belongs to itself and is deleted if the
+ * upstream connection ends (the request then being answered with 502 if it is still there).
+ * The content is kept in a buffer until it is sent, and only then acknowledged to the upstream server: the buffer is
+ * bounded by the TCP receive window, and the upstream server waits for a slow client.
+ */
+class AsyncProxyResponse : public AsyncAbstractResponse {
+private:
+  AsyncClient *_upstream;
+  std::vector<uint8_t> _outgoing;  // request to the upstream server
+  size_t _outgoingSent{0};
+  AsyncWebServerRequestPtr _requestPtr;        // until the response is sent
+  AsyncWebServerRequest *_request{nullptr};    // once the response is sent, the request owning it
+  bool _headOnly{false};
+  String _upstreamHead;
+  bool _headParsed{false};
+  std::unique_ptr<cbuf> _content;
+  size_t _received{0};
+  size_t _expected{SIZE_MAX};  // content length announced by the upstream server
+  size_t _unacked{0};          // content received and not acknowledged to the upstream server
+  bool _upstreamEnded{false};
+  bool _truncated{false};
+
+  void _sendOutgoing();
+  void _onUpstreamData(uint8_t *data, size_t len);
+  void _onUpstreamEnd();
+  bool _parseUpstreamHead();
+  void _resume();
+
+public:
+  AsyncProxyResponse(std::vector<uint8_t> &&outgoing, bool headOnly);
+  ~AsyncProxyResponse();
+  // connects to the upstream server and pauses the request, returns false if the connection could not be started
+  bool begin(AsyncWebServerRequest *request, const char *host, uint16_t port, uint32_t timeout);
+  bool _sourceValid() const override final {
+    return !_truncated;
+  }
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override final;
+};
+
 #endif /* ASYNCWEBSERVERRESPONSEIMPL_H_ */
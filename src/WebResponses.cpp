@@ -5,6 +5,15 @@
 #include "WebResponseImpl.h"
 #include "AsyncWebServerLogging.h"
 
+#ifdef ESP32
+#include <esp_flash_encrypt.h>
+#if ESP_IDF_VERSION_MAJOR < 5
+#include <soc/soc_memory_layout.h>
+#else
+#include <esp_memory_utils.h>
+#endif
+#endif
+
 using namespace asyncsrv;
 
 /*
@@ -23,6 +32,7 @@ const char *AsyncWebServerResponse::responseCodeToString(int code) {
     case 204: return T_HTTP_CODE_204;
     case 205: return T_HTTP_CODE_205;
     case 206: return T_HTTP_CODE_206;
+    case 207: return T_HTTP_CODE_207;
     case 300: return T_HTTP_CODE_300;
     case 301: return T_HTTP_CODE_301;
     case 302: return T_HTTP_CODE_302;
@@ -55,13 +65,15 @@ const char *AsyncWebServerResponse::responseCodeToString(int code) {
     case 503: return T_HTTP_CODE_503;
     case 504: return T_HTTP_CODE_504;
     case 505: return T_HTTP_CODE_505;
+    case 507: return T_HTTP_CODE_507;
     default:  return T_HTTP_CODE_ANY;
   }
 }
 
 AsyncWebServerResponse::AsyncWebServerResponse()
   : _code(0), _contentType(), _contentLength(0), _sendContentLength(true), _chunked(false), _headLength(0), _sentLength(0), _ackedLength(0), _writtenLength(0),
-    _state(RESPONSE_SETUP) {
+    _state(RESPONSE_SETUP), _compress(false) {
+  async_ws_metric_inc(responses);
   for (const auto &header : DefaultHeaders::Instance()) {
     _headers.emplace_back(header);
   }
@@ -89,7 +101,7 @@ bool AsyncWebServerResponse::removeHeader(const char *name) {
   bool h_erased = false;
   for (auto i = _headers.begin(); i != _headers.end();) {
     if (i->name().equalsIgnoreCase(name)) {
-      _headers.erase(i);
+      i = _headers.erase(i);
       h_erased = true;
     } else {
       ++i;
@@ -169,6 +181,30 @@ bool AsyncWebServerResponse::addHeader(const char *name, const char *value, bool
   return true;
 }
 
+bool AsyncWebServerResponse::addHeaders(AsyncHeaderBlockPtr block) {
+  if (_state != RESPONSE_SETUP || !block || !block->length()) {
+    return false;
+  }
+  _headerBlocks.emplace_back(std::move(block));
+  return true;
+}
+
+void AsyncWebServerResponse::_addConnectionHeader(AsyncWebServerRequest *request) {
+  // without a length, the end of the response can only be signaled by closing the connection
+  if (!_sendContentLength && !(_chunked && request->version())) {
+    request->_keepAlive = false;
+  }
+  const AsyncWebHeader *connection = getHeader(T_Connection);
+  if (connection) {
+    // a Connection header set by the user takes precedence
+    if (!connection->value().equalsIgnoreCase(T_keep_alive)) {
+      request->_keepAlive = false;
+    }
+  } else {
+    addHeader(T_Connection, request->_keepAlive ? T_keep_alive : T_close);
+  }
+}
+
 void AsyncWebServerResponse::_assembleHead(String &buffer, uint8_t version) {
   if (version) {
     addHeader(T_Accept_Ranges, T_none, false);
@@ -191,6 +227,9 @@ void AsyncWebServerResponse::_assembleHead(String &buffer, uint8_t version) {
   for (const auto &header : _headers) {
     len += header.name().length() + header.value().length() + 4;
   }
+  for (const auto &block : _headerBlocks) {
+    len += block->length();
+  }
 
   // prepare buffer
   buffer.reserve(len);
@@ -219,6 +258,9 @@ void AsyncWebServerResponse::_assembleHead(String &buffer, uint8_t version) {
     buffer.concat(header.value());
     buffer.concat(T_rn);
   }
+  for (const auto &block : _headerBlocks) {
+    buffer.concat(block->data());
+  }
 
   buffer.concat(T_rn);
   _headLength = buffer.length();
@@ -260,13 +302,18 @@ AsyncBasicResponse::AsyncBasicResponse(int code, const char *contentType, const
       _contentType = T_text_plain;
     }
   }
-  addHeader(T_Connection, T_close, false);
 }
 
 void AsyncBasicResponse::_respond(AsyncWebServerRequest *request) {
+  _addConnectionHeader(request);
   _state = RESPONSE_HEADERS;
   String out;
   _assembleHead(out, request->version());
+  if (request->method() == HTTP_HEAD) {
+    // the head announces the length of the content, which is not sent
+    _content = emptyString;
+    _contentLength = 0;
+  }
   size_t outLen = out.length();
   size_t space = request->client()->space();
   if (!_contentLength && space >= outLen) {
@@ -339,8 +386,20 @@ AsyncAbstractResponse::AsyncAbstractResponse(AwsTemplateProcessor callback) : _c
 }
 
 void AsyncAbstractResponse::_respond(AsyncWebServerRequest *request) {
-  addHeader(T_Connection, T_close, false);
+  if (_compress) {
+    _prepareCompression(request);
+  }
+  _addConnectionHeader(request);
+  if (request->version() && _code == 200 && !_callback && _sendContentLength && !_chunked && _seekable()) {
+    _prepareRanges(request);
+  }
   _assembleHead(_head, request->version());
+  if (request->method() == HTTP_HEAD) {
+    // the head is the whole response
+    _chunked = false;
+    _sendContentLength = true;
+    _contentLength = 0;
+  }
   _state = RESPONSE_HEADERS;
   _ack(request, 0, 0);
 }
@@ -371,20 +430,20 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest *request, size_t len, u
   _ackedLength += len;
   size_t space = request->client()->space();
 
-  size_t headLen = _head.length();
+  // headers are the first bytes written, so what remains to send of them starts at _writtenLength
+  size_t headLen = _head.length() ? _head.length() - _writtenLength : 0;
   if (_state == RESPONSE_HEADERS) {
     if (space >= headLen) {
       _state = RESPONSE_CONTENT;
       space -= headLen;
     } else {
-      String out = _head.substring(0, space);
-      _head = _head.substring(space);
-      _writtenLength += request->client()->write(out.c_str(), out.length());
+      size_t written = request->client()->write(_head.c_str() + _writtenLength, space);
+      _writtenLength += written;
 #if ASYNCWEBSERVER_USE_CHUNK_INFLIGHT
-      _in_flight += out.length();
+      _in_flight += written;
       --_in_flight_credit;  // take a credit
 #endif
-      return out.length();
+      return written;
     }
   }
 
@@ -417,66 +476,94 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest *request, size_t len, u
       outLen = ((_contentLength - _sentLength) > space) ? space : (_contentLength - _sentLength);
     }
 
-    uint8_t *buf = (uint8_t *)malloc(outLen + headLen);
-    if (!buf) {
-      async_ws_log_e("Failed to allocate");
-      request->abort();
-      return 0;
-    }
-
-    if (headLen) {
-      memcpy(buf, _head.c_str(), _head.length());
+    // content readable in place is written from where it is, without going through the send buffer
+    const uint8_t *direct = nullptr;
+    if (!_chunked && _sendContentLength && outLen && !_callback && !_deflate && _ranges.empty()) {
+      direct = _directContent(outLen);
     }
+    uint8_t *buf = nullptr;
 
     size_t readLen = 0;
 
-    if (_chunked) {
+    if (!direct) {
+      // the buffer is kept between calls and only reallocated when the socket space has grown
+      if (outLen > _sendBufferSize) {
+        free(_sendBuffer);
+        _sendBuffer = (uint8_t *)allocateBuffer(AsyncMemoryUse::RESPONSE, outLen);
+        if (!_sendBuffer) {
+          _sendBufferSize = 0;
+          async_ws_log_e("Failed to allocate");
+          async_ws_metric_inc(allocFailures);
+          request->abort();
+          return 0;
+        }
+        _sendBufferSize = outLen;
+      }
+      buf = _sendBuffer;
+    }
+
+    if (direct) {
+      readLen = outLen;
+    } else if (_chunked) {
       // HTTP 1.1 allows leading zeros in chunk length. Or spaces may be added.
       // See RFC2616 sections 2, 3.6.1.
-      readLen = _fillBufferAndProcessTemplates(buf + headLen + 6, outLen - 8);
+      readLen = _fillContent(buf + 6, outLen - 8);
       if (readLen == RESPONSE_TRY_AGAIN) {
-        free(buf);
         return 0;
       }
-      outLen = sprintf((char *)buf + headLen, "%04x", readLen) + headLen;
+      outLen = sprintf((char *)buf, "%04x", readLen);
       buf[outLen++] = '\r';
       buf[outLen++] = '\n';
       outLen += readLen;
       buf[outLen++] = '\r';
       buf[outLen++] = '\n';
-    } else {
-      readLen = _fillBufferAndProcessTemplates(buf + headLen, outLen);
+    } else if (outLen) {
+      readLen = _fillContent(buf, outLen);
       if (readLen == RESPONSE_TRY_AGAIN) {
-        free(buf);
         return 0;
       }
-      outLen = readLen + headLen;
+      outLen = readLen;
     }
 
+    // the remaining headers are queued as is, in front of the data, without copying them into the buffer
     if (headLen) {
-      _head = emptyString;
+      _writtenLength += request->client()->add(_head.c_str() + _writtenLength, headLen);
+      _head = String();
     }
 
-    if (outLen) {
+    if (direct) {
+      // still copied by lwIP, straight from the flash: the lwIP of ESP-IDF copies anyway (LWIP_NETIF_TX_SINGLE_PBUF, see
+      // AsyncEventSourceMessage::write()), and the Wi-Fi driver must not be given memory mapped flash to transmit
+      _writtenLength += request->client()->write((const char *)direct, outLen, ASYNC_WRITE_FLAG_COPY);
+    } else if (outLen) {
       _writtenLength += request->client()->write((const char *)buf, outLen);
+    } else if (headLen) {
+      request->client()->send();
+    }
 #if ASYNCWEBSERVER_USE_CHUNK_INFLIGHT
-      _in_flight += outLen;
+    if (outLen || headLen) {
+      _in_flight += outLen + headLen;
       --_in_flight_credit;  // take a credit
-#endif
     }
+#endif
 
-    if (_chunked) {
+    if (_deflate) {
+      // counted while filling the encoder
+    } else if (_chunked) {
       _sentLength += readLen;
     } else {
-      _sentLength += outLen - headLen;
+      _sentLength += outLen;
     }
 
-    free(buf);
-
-    if ((_chunked && readLen == 0) || (!_sendContentLength && outLen == 0) || (!_chunked && _sentLength == _contentLength)) {
+    // the encoder is done when it has nothing more to send, not when the whole content went into it
+    if ((_chunked && readLen == 0) || (!_sendContentLength && outLen == 0) || (!_chunked && !_deflate && _sentLength == _contentLength)) {
       _state = RESPONSE_WAIT_ACK;
+      // no more data to fill: release the buffer while waiting for the acks
+      free(_sendBuffer);
+      _sendBuffer = nullptr;
+      _sendBufferSize = 0;
     }
-    return outLen;
+    return outLen + headLen;
 
   } else if (_state == RESPONSE_WAIT_ACK) {
     if (!_sendContentLength || _ackedLength >= _writtenLength) {
@@ -489,117 +576,536 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest *request, size_t len, u
   return 0;
 }
 
-size_t AsyncAbstractResponse::_readDataFromCacheOrContent(uint8_t *data, const size_t len) {
-  // If we have something in cache, copy it to buffer
-  const size_t readFromCache = std::min(len, _cache.size());
-  if (readFromCache) {
-    memcpy(data, _cache.data(), readFromCache);
-    _cache.erase(_cache.begin(), _cache.begin() + readFromCache);
+// Selects the encoding of the content from the Accept-Encoding header of the request,
+// the encoded content being then sent chunked (or until the connection is closed, in HTTP/1.0)
+void AsyncAbstractResponse::_prepareCompression(AsyncWebServerRequest *request) {
+  if (request->method() == HTTP_HEAD || _code < 200 || _code == 204 || _code == 304 || getHeader(T_Content_Encoding)) {
+    return;
+  }
+  const bool sized = _sendContentLength && !_chunked;
+  if (sized && _contentLength < ASYNCWEBSERVER_COMPRESS_MIN_SIZE) {
+    return;
+  }
+  DeflateEncoder::Format format;
+  if (request->acceptsEncoding(T_gzip)) {
+    format = DeflateEncoder::Format::GZIP;
+  } else if (request->acceptsEncoding(T_deflate)) {
+    format = DeflateEncoder::Format::ZLIB;
+  } else {
+    return;
+  }
+  _deflate.reset(new (std::nothrow) DeflateEncoder());
+  if (!_deflate || !_deflate->begin(format)) {
+    // sent as is
+    _deflate.reset();
+    async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
+    return;
+  }
+  _deflateSized = sized;
+  addHeader(T_Content_Encoding, format == DeflateEncoder::Format::GZIP ? T_gzip : T_deflate);
+  addHeader(T_Vary, T_Accept_Encoding, false);
+  _sendContentLength = false;
+  _chunked = request->version();
+}
+
+size_t AsyncAbstractResponse::_fillBufferAndCompress(uint8_t *data, size_t len) {
+  size_t written = 0;
+  bool stalled = false;
+  while (written < len) {
+    written += _deflate->read(data + written, len - written);
+    if (written == len || _deflate->finished()) {
+      break;
+    }
+
+    // the encoder is drained: gather its next input until it is full or the source has nothing more for now,
+    // the matches being only searched inside the history and this input
+    uint8_t *input = _deflate->input();
+    const size_t space = _deflate->inputSpace();
+    size_t staged = 0;
+    bool ended = false;
+    while (!stalled && !ended && staged < space) {
+      const size_t want = _deflateSized ? std::min(space - staged, _contentLength - _sentLength) : space - staged;
+      const size_t n = want ? _fillBufferAndProcessTemplates(input + staged, want) : 0;
+      if (n == RESPONSE_TRY_AGAIN) {
+        stalled = true;
+      } else if (!n) {
+        ended = true;
+      } else {
+        staged += n;
+        _sentLength += n;
+      }
+    }
+
+    _deflate->compress(staged);
+    if (ended) {
+      _deflate->finish();
+    } else if (!staged) {
+      return written ? written : RESPONSE_TRY_AGAIN;
+    }
+  }
+  return written;
+}
+
+// Parses the value of a Range header for the content of _rangeTotal bytes, only keeping the satisfiable ranges.
+// Returns false if the header is invalid or has too many ranges, in which case the whole content is sent.
+bool AsyncAbstractResponse::_parseRanges(const char *value) {
+  const size_t size = _rangeTotal;
+  const size_t unitLen = strlen(T_bytes);
+  if (strncasecmp(value, T_bytes, unitLen) != 0 || value[unitLen] != '=') {
+    return false;
+  }
+  const char *p = value + unitLen + 1;
+  size_t count = 0;
+  while (*p) {
+    while (*p == ' ' || *p == '\t' || *p == ',') {
+      p++;
+    }
+    if (!*p) {
+      break;
+    }
+    if (++count > ASYNCWEBSERVER_MAX_RANGES) {
+      return false;
+    }
+    const bool suffix = *p == '-';
+    if (suffix) {
+      p++;
+    }
+    if (*p < '0' || *p > '9') {
+      return false;
+    }
+    char *end;
+    const unsigned long long first = strtoull(p, &end, 10);
+    p = end;
+    unsigned long long last = 0;
+    bool toEnd = true;
+    if (!suffix) {
+      if (*p++ != '-') {
+        return false;
+      }
+      if (*p >= '0' && *p <= '9') {
+        last = strtoull(p, &end, 10);
+        p = end;
+        toEnd = false;
+        if (last < first) {
+          return false;
+        }
+      }
+    }
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    if (*p && *p != ',') {
+      return false;
+    }
+    if (suffix) {
+      // the last bytes of the content
+      if (first && size) {
+        const size_t length = first < size ? first : size;
+        _ranges.push_back({size - length, length});
+      }
+    } else if (first < size) {
+      _ranges.push_back({(size_t)first, (size_t)((!toEnd && last < size ? last + 1 : size) - first)});
+    }
+  }
+  return count != 0;
+}
+
+void AsyncAbstractResponse::_prepareRanges(AsyncWebServerRequest *request) {
+  addHeader(T_Accept_Ranges, T_bytes, false);
+
+  const AsyncWebHeader *range = request->method() == HTTP_GET ? request->getHeader(T_Range) : nullptr;
+  if (!range) {
+    return;
+  }
+
+  // If-Range: only send the ranges if the content is the one the client already has part of
+  const AsyncWebHeader *ifRange = request->getHeader(T_If_Range);
+  if (ifRange) {
+    const AsyncWebHeader *etag = getHeader(T_ETag);
+    const AsyncWebHeader *lastModified = getHeader(T_Last_Modified);
+    if (!(etag && ifRange->value() == etag->value()) && !(lastModified && ifRange->value() == lastModified->value())) {
+      return;
+    }
+  }
+
+  _rangeTotal = _contentLength;
+  if (!_parseRanges(range->value().c_str())) {
+    _ranges.clear();
+    return;
+  }
+
+  String contentRange;
+  contentRange.reserve(48);
+  contentRange.concat(T_bytes_);
+
+  if (_ranges.empty()) {
+    _code = 416;
+    contentRange.concat('*');
+    contentRange.concat('/');
+    contentRange.concat(_rangeTotal);
+    addHeader(T_Content_Range, contentRange.c_str());
+    _contentLength = 0;
+    return;
+  }
+
+  if (!_seekContent(_ranges[0].start)) {
+    _ranges.clear();
+    return;
+  }
+  _code = 206;
+
+  if (_ranges.size() == 1) {
+    contentRange.concat(_ranges[0].start);
+    contentRange.concat('-');
+    contentRange.concat(_ranges[0].start + _ranges[0].length - 1);
+    contentRange.concat('/');
+    contentRange.concat(_rangeTotal);
+    addHeader(T_Content_Range, contentRange.c_str());
+    _contentLength = _ranges[0].length;
+    _ranges.clear();
+    return;
+  }
+
+  // several ranges: each one is sent in its own part, after a part head with its own content type and range
+  _rangeContentType = _contentType;
+  _rangeBoundary = String((uint32_t)random(0x7FFFFFFF), HEX);
+  _rangeBoundary.concat(String((uint32_t)random(0x7FFFFFFF), HEX));
+  _contentLength = 0;
+  String head;
+  for (size_t i = 0; i <= _ranges.size(); i++) {
+    _rangePartHead(head, i);
+    _contentLength += head.length() + (i < _ranges.size() ? _ranges[i].length : 0);
+  }
+  _rangePartHead(_rangeHead, 0);
+
+  String contentType(T_byteranges);
+  contentType.concat(_rangeBoundary);
+  setContentType(contentType.c_str());
+}
+
+void AsyncAbstractResponse::_rangePartHead(String &head, size_t index) const {
+  head = T_rn;
+  head.concat('-');
+  head.concat('-');
+  head.concat(_rangeBoundary);
+  if (index == _ranges.size()) {
+    // closing delimiter
+    head.concat('-');
+    head.concat('-');
+    head.concat(T_rn);
+    return;
+  }
+  head.concat(T_rn);
+  if (_rangeContentType.length()) {
+    head.concat(T_Content_Type);
+    head.concat(':');
+    head.concat(' ');
+    head.concat(_rangeContentType);
+    head.concat(T_rn);
   }
-  // If we need to read more...
-  const size_t needFromFile = len - readFromCache;
-  const size_t readFromContent = _fillBuffer(data + readFromCache, needFromFile);
-  return readFromCache + readFromContent;
+  head.concat(T_Content_Range);
+  head.concat(':');
+  head.concat(' ');
+  head.concat(T_bytes_);
+  head.concat(_ranges[index].start);
+  head.concat('-');
+  head.concat(_ranges[index].start + _ranges[index].length - 1);
+  head.concat('/');
+  head.concat(_rangeTotal);
+  head.concat(T_rnrn);
+}
+
+size_t AsyncAbstractResponse::_fillBufferWithRanges(uint8_t *data, size_t len) {
+  size_t out = 0;
+  while (out < len) {
+    if (_rangeHeadSent < _rangeHead.length()) {
+      const size_t n = std::min(len - out, _rangeHead.length() - _rangeHeadSent);
+      memcpy(data + out, _rangeHead.c_str() + _rangeHeadSent, n);
+      _rangeHeadSent += n;
+      out += n;
+      continue;
+    }
+    if (_rangeIndex == _ranges.size()) {
+      break;
+    }
+    if (_rangeSent < _ranges[_rangeIndex].length) {
+      const size_t r = _fillBuffer(data + out, std::min(len - out, _ranges[_rangeIndex].length - _rangeSent));
+      if (!r || r == RESPONSE_TRY_AGAIN) {
+        break;
+      }
+      _rangeSent += r;
+      out += r;
+      continue;
+    }
+    // next part
+    _rangeIndex++;
+    _rangeSent = 0;
+    _rangeHeadSent = 0;
+    _rangePartHead(_rangeHead, _rangeIndex);
+    if (_rangeIndex < _ranges.size() && !_seekContent(_ranges[_rangeIndex].start)) {
+      break;
+    }
+  }
+  return out;
+}
+
+// A placeholder is made of at most TEMPLATE_PARAM_NAME_LENGTH characters between two placeholder characters,
+// "%%" is an escaped placeholder character and any other placeholder character is sent as is.
+static constexpr size_t TEMPLATE_PLACEHOLDER_MAX_LENGTH = TEMPLATE_PARAM_NAME_LENGTH + 2;
+
+bool AsyncAbstractResponse::_reserveTemplateStage(size_t len) {
+  len = std::max(len, TEMPLATE_PLACEHOLDER_MAX_LENGTH);
+  if (len <= _tplStageSize) {
+    return true;
+  }
+  // only called when the stage is empty
+  free(_tplStage);
+  _tplStage = (uint8_t *)malloc(len);
+  _tplStageSize = _tplStage ? len : 0;
+  return _tplStage != nullptr;
+}
+
+size_t AsyncAbstractResponse::_processTemplate(uint8_t *data, const uint8_t *placeholder, size_t len) {
+  if (len == 2) {
+    *data = TEMPLATE_PLACEHOLDER;
+    return 1;
+  }
+  char name[TEMPLATE_PARAM_NAME_LENGTH + 1];
+  memcpy(name, placeholder + 1, len - 2);
+  name[len - 2] = 0;
+  _tplValue = _callback(String(name));
+  _tplValueSent = 0;
+  return 0;
 }
 
 size_t AsyncAbstractResponse::_fillBufferAndProcessTemplates(uint8_t *data, size_t len) {
   if (!_callback) {
-    return _fillBuffer(data, len);
-  }
-
-  const size_t originalLen = len;
-  len = _readDataFromCacheOrContent(data, len);
-  // Now we've read 'len' bytes, either from cache or from file
-  // Search for template placeholders
-  uint8_t *pTemplateStart = data;
-  while ((pTemplateStart < &data[len]) && (pTemplateStart = (uint8_t *)memchr(pTemplateStart, TEMPLATE_PLACEHOLDER, &data[len - 1] - pTemplateStart + 1))
-  ) {  // data[0] ... data[len - 1]
-    uint8_t *pTemplateEnd =
-      (pTemplateStart < &data[len - 1]) ? (uint8_t *)memchr(pTemplateStart + 1, TEMPLATE_PLACEHOLDER, &data[len - 1] - pTemplateStart) : nullptr;
-    // temporary buffer to hold parameter name
-    uint8_t buf[TEMPLATE_PARAM_NAME_LENGTH + 1];
-    String paramName;
-    // If closing placeholder is found:
-    if (pTemplateEnd) {
-      // prepare argument to callback
-      const size_t paramNameLength = std::min((size_t)sizeof(buf) - 1, (size_t)(pTemplateEnd - pTemplateStart - 1));
-      if (paramNameLength) {
-        memcpy(buf, pTemplateStart + 1, paramNameLength);
-        buf[paramNameLength] = 0;
-        paramName = String(reinterpret_cast<char *>(buf));
-      } else {  // double percent sign encountered, this is single percent sign escaped.
-        // remove the 2nd percent sign
-        memmove(pTemplateEnd, pTemplateEnd + 1, &data[len] - pTemplateEnd - 1);
-        len += _readDataFromCacheOrContent(&data[len - 1], 1) - 1;
-        ++pTemplateStart;
-      }
-    } else if (&data[len - 1] - pTemplateStart + 1
-               < TEMPLATE_PARAM_NAME_LENGTH + 2) {  // closing placeholder not found, check if it's in the remaining file data
-      memcpy(buf, pTemplateStart + 1, &data[len - 1] - pTemplateStart);
-      const size_t readFromCacheOrContent =
-        _readDataFromCacheOrContent(buf + (&data[len - 1] - pTemplateStart), TEMPLATE_PARAM_NAME_LENGTH + 2 - (&data[len - 1] - pTemplateStart + 1));
-      if (readFromCacheOrContent) {
-        pTemplateEnd = (uint8_t *)memchr(buf + (&data[len - 1] - pTemplateStart), TEMPLATE_PLACEHOLDER, readFromCacheOrContent);
-        if (pTemplateEnd) {
-          // prepare argument to callback
-          *pTemplateEnd = 0;
-          paramName = String(reinterpret_cast<char *>(buf));
-          // Copy remaining read-ahead data into cache
-          _cache.insert(_cache.begin(), pTemplateEnd + 1, buf + (&data[len - 1] - pTemplateStart) + readFromCacheOrContent);
-          pTemplateEnd = &data[len - 1];
-        } else  // closing placeholder not found in file data, store found percent symbol as is and advance to the next position
-        {
-          // but first, store read file data in cache
-          _cache.insert(_cache.begin(), buf + (&data[len - 1] - pTemplateStart), buf + (&data[len - 1] - pTemplateStart) + readFromCacheOrContent);
-          ++pTemplateStart;
+    return _ranges.empty() ? _fillBuffer(data, len) : _fillBufferWithRanges(data, len);
+  }
+
+  if (!_tplStarted) {
+    _tplStarted = true;
+    _tplIndex = _templateIndex();
+  }
+
+  size_t out = 0;
+  while (out < len) {
+    // 1. the rest of the last value
+    if (_tplValueSent < _tplValue.length()) {
+      const size_t n = std::min(len - out, _tplValue.length() - _tplValueSent);
+      memcpy(data + out, _tplValue.c_str() + _tplValueSent, n);
+      _tplValueSent += n;
+      out += n;
+      if (_tplValueSent == _tplValue.length()) {
+        _tplValue = String();
+        _tplValueSent = 0;
+      }
+      continue;
+    }
+
+    // 2. the placeholders are known: read the literal runs in place and only the placeholders aside
+    if (_tplIndex) {
+      size_t n = len - out;
+      if (_tplIndexNext < _tplIndex->size()) {
+        const AsyncTemplatePlaceholder &placeholder = (*_tplIndex)[_tplIndexNext];
+        if (placeholder.offset == _tplOffset) {
+          uint8_t buf[TEMPLATE_PLACEHOLDER_MAX_LENGTH];
+          const size_t r = _fillBuffer(buf, placeholder.length);
+          _tplIndexNext++;
+          if (r == placeholder.length && buf[0] == TEMPLATE_PLACEHOLDER && buf[r - 1] == TEMPLATE_PLACEHOLDER) {
+            _tplOffset += r;
+            out += _processTemplate(data + out, buf, r);
+            continue;
+          }
+          // the content does not match its index anymore: process the rest of it as a stream
+          _tplIndex.reset();
+          if (r && r != RESPONSE_TRY_AGAIN) {
+            _reserveTemplateStage(r);
+            memcpy(_tplStage, buf, r);
+            _tplStageStart = 0;
+            _tplStageEnd = r;
+          }
+          continue;
         }
-      } else {  // closing placeholder not found in content data, store found percent symbol as is and advance to the next position
-        ++pTemplateStart;
-      }
-    } else {  // closing placeholder not found in content data, store found percent symbol as is and advance to the next position
-      ++pTemplateStart;
-    }
-    if (paramName.length()) {
-      // call callback and replace with result.
-      // Everything in range [pTemplateStart, pTemplateEnd] can be safely replaced with parameter value.
-      // Data after pTemplateEnd may need to be moved.
-      // The first byte of data after placeholder is located at pTemplateEnd + 1.
-      // It should be located at pTemplateStart + numBytesCopied (to begin right after inserted parameter value).
-      const String paramValue(_callback(paramName));
-      const char *pvstr = paramValue.c_str();
-      const unsigned int pvlen = paramValue.length();
-      const size_t numBytesCopied = std::min(pvlen, static_cast<unsigned int>(&data[originalLen - 1] - pTemplateStart + 1));
-      // make room for param value
-      // 1. move extra data to cache if parameter value is longer than placeholder AND if there is no room to store
-      if ((pTemplateEnd + 1 < pTemplateStart + numBytesCopied) && (originalLen - (pTemplateStart + numBytesCopied - pTemplateEnd - 1) < len)) {
-        _cache.insert(_cache.begin(), &data[originalLen - (pTemplateStart + numBytesCopied - pTemplateEnd - 1)], &data[len]);
-        // 2. parameter value is longer than placeholder text, push the data after placeholder which not saved into cache further to the end
-        memmove(pTemplateStart + numBytesCopied, pTemplateEnd + 1, &data[originalLen] - pTemplateStart - numBytesCopied);
-        len = originalLen;  // fix issue with truncated data, not sure if it has any side effects
-      } else if (pTemplateEnd + 1 != pTemplateStart + numBytesCopied) {
-        // 2. Either parameter value is shorter than placeholder text OR there is enough free space in buffer to fit.
-        //    Move the entire data after the placeholder
-        memmove(pTemplateStart + numBytesCopied, pTemplateEnd + 1, &data[len] - pTemplateEnd - 1);
-      }
-      // 3. replace placeholder with actual value
-      memcpy(pTemplateStart, pvstr, numBytesCopied);
-      // If result is longer than buffer, copy the remainder into cache (this could happen only if placeholder text itself did not fit entirely in buffer)
-      if (numBytesCopied < pvlen) {
-        _cache.insert(_cache.begin(), pvstr + numBytesCopied, pvstr + pvlen);
-      } else if (pTemplateStart + numBytesCopied < pTemplateEnd + 1) {  // result is copied fully; if result is shorter than placeholder text...
-        // there is some free room, fill it from cache
-        const size_t roomFreed = pTemplateEnd + 1 - pTemplateStart - numBytesCopied;
-        const size_t totalFreeRoom = originalLen - len + roomFreed;
-        len += _readDataFromCacheOrContent(&data[len - roomFreed], totalFreeRoom) - roomFreed;
-      } else {  // result is copied fully; it is longer than placeholder text
-        const size_t roomTaken = pTemplateStart + numBytesCopied - pTemplateEnd - 1;
-        len = std::min(len + roomTaken, originalLen);
-      }
-    }
-  }  // while(pTemplateStart)
-  return len;
+        n = std::min(n, placeholder.offset - _tplOffset);
+      }
+      const size_t r = _fillBuffer(data + out, n);
+      if (r == RESPONSE_TRY_AGAIN) {
+        return out ? out : RESPONSE_TRY_AGAIN;
+      }
+      if (!r) {
+        break;
+      }
+      _tplOffset += r;
+      out += r;
+      continue;
+    }
+
+    // 3. nothing read ahead: read the content in place, the data before the first placeholder character stays where it is
+    if (_tplStageStart == _tplStageEnd) {
+      if (_tplEnded) {
+        break;
+      }
+      const size_t r = _fillBuffer(data + out, len - out);
+      if (r == RESPONSE_TRY_AGAIN) {
+        return out ? out : RESPONSE_TRY_AGAIN;
+      }
+      if (!r) {
+        _tplEnded = true;
+        break;
+      }
+      const uint8_t *p = (const uint8_t *)memchr(data + out, TEMPLATE_PLACEHOLDER, r);
+      if (!p) {
+        out += r;
+        continue;
+      }
+      // move aside what follows the placeholder character
+      const size_t tail = data + out + r - p;
+      if (!_reserveTemplateStage(tail)) {
+        async_ws_log_e("Failed to allocate");
+        async_ws_metric_inc(allocFailures);
+        _tplEnded = true;
+        return p - data;
+      }
+      memcpy(_tplStage, p, tail);
+      _tplStageStart = 0;
+      _tplStageEnd = tail;
+      out = p - data;
+      continue;
+    }
+
+    // 4. content read ahead: copy its literal runs and replace its placeholders
+    const uint8_t *start = _tplStage + _tplStageStart;
+    const size_t available = _tplStageEnd - _tplStageStart;
+    if (*start != TEMPLATE_PLACEHOLDER) {
+      const uint8_t *p = (const uint8_t *)memchr(start, TEMPLATE_PLACEHOLDER, available);
+      const size_t n = std::min(len - out, p ? (size_t)(p - start) : available);
+      memcpy(data + out, start, n);
+      _tplStageStart += n;
+      out += n;
+      continue;
+    }
+    const uint8_t *end = (const uint8_t *)memchr(start + 1, TEMPLATE_PLACEHOLDER, std::min(available, TEMPLATE_PLACEHOLDER_MAX_LENGTH) - 1);
+    if (!end && available < TEMPLATE_PLACEHOLDER_MAX_LENGTH && !_tplEnded) {
+      // the closing placeholder character can still come: move the placeholder at the beginning of the stage to complete it
+      memmove(_tplStage, start, available);
+      _tplStageStart = 0;
+      _tplStageEnd = available;
+      const size_t r = _fillBuffer(_tplStage + available, _tplStageSize - available);
+      if (r == RESPONSE_TRY_AGAIN) {
+        return out ? out : RESPONSE_TRY_AGAIN;
+      }
+      if (r) {
+        _tplStageEnd += r;
+      } else {
+        _tplEnded = true;
+      }
+      continue;
+    }
+    if (end) {
+      const size_t placeholderLen = end - start + 1;
+      out += _processTemplate(data + out, start, placeholderLen);
+      _tplStageStart += placeholderLen;
+    } else {
+      // a lone placeholder character
+      data[out++] = TEMPLATE_PLACEHOLDER;
+      _tplStageStart++;
+    }
+  }
+  return out;
 }
 
+namespace {
+
+// Finds the placeholders of a content read block by block
+class TemplateScanner {
+private:
+  static constexpr size_t NONE = SIZE_MAX;
+  AsyncTemplateIndex &_index;
+  size_t _offset = 0;
+  size_t _open = NONE;
+
+public:
+  explicit TemplateScanner(AsyncTemplateIndex &index) : _index(index) {}
+  void scan(const uint8_t *data, size_t len) {
+    const uint8_t *p = data;
+    const uint8_t *end = data + len;
+    while (p < end) {
+      const uint8_t *q = (const uint8_t *)memchr(p, TEMPLATE_PLACEHOLDER, end - p);
+      if (!q) {
+        break;
+      }
+      const size_t offset = _offset + (q - data);
+      if (_open != NONE && offset - _open < TEMPLATE_PLACEHOLDER_MAX_LENGTH) {
+        _index.push_back({_open, (uint8_t)(offset - _open + 1)});
+        _open = NONE;
+      } else {
+        _open = offset;
+      }
+      p = q + 1;
+    }
+    _offset += len;
+  }
+};
+
+// Placeholders of the last scanned templates, most recently used first
+struct TemplateIndexEntry {
+  const void *source;  // PROGMEM content, nullptr for a file
+  String path;
+  time_t lastWrite;
+  size_t size;
+  std::shared_ptr<const AsyncTemplateIndex> index;
+};
+std::list<TemplateIndexEntry> templateIndexes;
+#ifdef ESP32
+std::mutex templateIndexesLock;
+#endif
+
+std::shared_ptr<const AsyncTemplateIndex>
+templateIndex(const void *source, const String &path, time_t lastWrite, size_t size, std::function<size_t(uint8_t *, size_t)> read) {
+#if ASYNCWEBSERVER_TEMPLATE_INDEX_ENTRIES
+  {
+#ifdef ESP32
+    std::lock_guard<std::mutex> lock(templateIndexesLock);
+#endif
+    for (auto it = templateIndexes.begin(); it != templateIndexes.end(); ++it) {
+      if (it->source == source && it->lastWrite == lastWrite && it->size == size && it->path == path) {
+        templateIndexes.splice(templateIndexes.begin(), templateIndexes, it);
+        return it->index;
+      }
+    }
+  }
+
+  std::shared_ptr<AsyncTemplateIndex> index = std::make_shared<AsyncTemplateIndex>();
+  TemplateScanner scanner(*index);
+  uint8_t buf[256];
+  size_t total = 0;
+  while (total < size) {
+    const size_t r = read(buf, std::min(sizeof(buf), size - total));
+    if (!r || r == RESPONSE_TRY_AGAIN) {
+      return nullptr;
+    }
+    scanner.scan(buf, r);
+    total += r;
+  }
+  index->shrink_to_fit();
+
+#ifdef ESP32
+  std::lock_guard<std::mutex> lock(templateIndexesLock);
+#endif
+  templateIndexes.push_front({source, path, lastWrite, size, index});
+  if (templateIndexes.size() > ASYNCWEBSERVER_TEMPLATE_INDEX_ENTRIES) {
+    templateIndexes.pop_back();
+  }
+  return index;
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace
+
 /*
  * File Response
  * */
@@ -614,7 +1120,7 @@ size_t AsyncAbstractResponse::_fillBufferAndProcessTemplates(uint8_t *data, size
  * @param path The file path string from which to extract the extension
  * @note The method modifies the internal _contentType member variable
  */
-void AsyncFileResponse::_setContentTypeFromPath(const String &path) {
+void AsyncAbstractResponse::_setContentTypeFromPath(const String &path) {
 #if HAVE_EXTERN_GET_Content_Type_FUNCTION
 #ifndef ESP8266
   extern const char *getContentType(const String &path);
@@ -677,6 +1183,18 @@ void AsyncFileResponse::_setContentTypeFromPath(const String &path) {
 #endif
 }
 
+const char *asyncsrv::fileEncoding(const char *file, const String &path) {
+  const size_t len = strlen(file);
+  for (const FileEncoding &e : fileEncodings) {
+    const size_t extLen = strlen(e.extension);
+    if (len > extLen && strcmp(file + len - extLen, e.extension) == 0) {
+      // unless the variant itself is requested
+      return path.endsWith(e.extension) ? nullptr : e.encoding;
+    }
+  }
+  return nullptr;
+}
+
 /**
  * @brief Constructor for AsyncFileResponse that handles file serving with compression support
  *
@@ -707,6 +1225,7 @@ AsyncFileResponse::AsyncFileResponse(FS &fs, const String &path, const char *con
     char serverETag[9];
     if (AsyncWebServerRequest::_getEtag(_content, serverETag)) {
       addHeader(T_Content_Encoding, T_gzip, false);
+      addHeader(T_Vary, T_Accept_Encoding, false);
       _callback = nullptr;  // Unable to process zipped templates
       _sendContentLength = true;
       _chunked = false;
@@ -724,6 +1243,9 @@ AsyncFileResponse::AsyncFileResponse(FS &fs, const String &path, const char *con
   }
 
   _contentLength = _content.size();
+  if (_callback) {
+    _path = path;
+  }
 
   if (*contentType == '\0') {
     _setContentTypeFromPath(path);
@@ -753,15 +1275,19 @@ AsyncFileResponse::AsyncFileResponse(File content, const String &path, const cha
   : AsyncAbstractResponse(callback) {
   _code = 200;
 
-  if (String(content.name()).endsWith(T__gz) && !path.endsWith(T__gz)) {
-    addHeader(T_Content_Encoding, T_gzip, false);
-    _callback = nullptr;  // Unable to process gzipped templates
+  const char *encoding = fileEncoding(content.name(), path);
+  if (encoding) {
+    addHeader(T_Content_Encoding, encoding, false);
+    _callback = nullptr;  // Unable to process compressed templates
     _sendContentLength = true;
     _chunked = false;
   }
 
   _content = content;
   _contentLength = _content.size();
+  if (_callback) {
+    _path = path;
+  }
 
   if (*contentType == '\0') {
     _setContentTypeFromPath(path);
@@ -789,6 +1315,19 @@ size_t AsyncFileResponse::_fillBuffer(uint8_t *data, size_t len) {
   return _content.read(data, len);
 }
 
+std::shared_ptr<const AsyncTemplateIndex> AsyncFileResponse::_templateIndex() {
+  // without a modification time, a file cannot be known to be unchanged
+  const time_t lastWrite = _content.getLastWrite();
+  if (!lastWrite || _content.position() != 0) {
+    return nullptr;
+  }
+  std::shared_ptr<const AsyncTemplateIndex> index = templateIndex(nullptr, _path, lastWrite, _contentLength, [this](uint8_t *buf, size_t len) {
+    return _content.read(buf, len);
+  });
+  _content.seek(0);
+  return index;
+}
+
 /*
  * Stream Response
  * */
@@ -826,6 +1365,11 @@ AsyncCallbackResponse::AsyncCallbackResponse(const char *contentType, size_t len
   _filledLength = 0;
 }
 
+bool AsyncCallbackResponse::_seekable() const {
+  const AsyncWebHeader *acceptRanges = getHeader(T_Accept_Ranges);
+  return acceptRanges && acceptRanges->value().equalsIgnoreCase(T_bytes);
+}
+
 size_t AsyncCallbackResponse::_fillBuffer(uint8_t *data, size_t len) {
   size_t ret = _content(data, len, _filledLength);
   if (ret != RESPONSE_TRY_AGAIN) {
@@ -868,18 +1412,152 @@ AsyncProgmemResponse::AsyncProgmemResponse(int code, const char *contentType, co
   _contentType = contentType;
   _contentLength = len;
   _readLength = 0;
+  _size = len;
 }
 
 size_t AsyncProgmemResponse::_fillBuffer(uint8_t *data, size_t len) {
-  size_t left = _contentLength - _readLength;
-  if (left > len) {
-    memcpy_P(data, _content + _readLength, len);
-    _readLength += len;
+  // the ranges are bounded by the caller, only the end of the content is checked here
+  const size_t left = _readLength < _size ? _size - _readLength : 0;
+  if (len > left) {
+    len = left;
+  }
+  memcpy_P(data, _content + _readLength, len);
+  _readLength += len;
+  return len;
+}
+
+std::shared_ptr<const AsyncTemplateIndex> AsyncProgmemResponse::_templateIndex() {
+  size_t offset = 0;
+  return templateIndex(_content, emptyString, 0, _contentLength, [this, &offset](uint8_t *buf, size_t len) {
+    memcpy_P(buf, _content + offset, len);
+    offset += len;
     return len;
+  });
+}
+
+#ifdef ESP32
+// PROGMEM content is in the flash mapped for the constant data of the program, unlike a buffer given by the caller
+const uint8_t *AsyncProgmemResponse::_directContent(size_t len) {
+  if (!esp_ptr_in_drom(_content)) {
+    return nullptr;
+  }
+  const uint8_t *content = _content + _readLength;
+  _readLength += len;
+  return content;
+}
+
+/*
+ * Flash Response
+ * */
+
+const uint8_t *asyncsrv::mapPartition(const esp_partition_t *partition) {
+  struct Mapping {
+    const esp_partition_t *partition;
+    const uint8_t *content;
+  };
+  static std::vector<Mapping> mappings;
+  static std::mutex lock;
+
+  std::lock_guard<std::mutex> guard(lock);
+  for (const Mapping &mapping : mappings) {
+    if (mapping.partition == partition) {
+      return mapping.content;
+    }
+  }
+
+  // a failure is remembered as well, for the next calls
+  const void *content = nullptr;
+  // the flash is decrypted when it is read through the cache, which is only how esp_partition_read() reads encrypted partitions
+  if (partition->encrypted || !esp_flash_encryption_enabled()) {
+#if ESP_IDF_VERSION_MAJOR < 5
+    spi_flash_mmap_handle_t handle;
+    if (esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &content, &handle) != ESP_OK) {
+#else
+    esp_partition_mmap_handle_t handle;
+    if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &content, &handle) != ESP_OK) {
+#endif
+      async_ws_log_w("Unable to map the partition %s", partition->label);
+      content = nullptr;
+    }
+  }
+  mappings.push_back({partition, (const uint8_t *)content});
+  return (const uint8_t *)content;
+}
+
+AsyncFlashResponse::AsyncFlashResponse(const esp_partition_t *partition, const char *contentType, size_t offset, size_t len)
+  : AsyncAbstractResponse(), _partition(partition) {
+  _code = 200;
+  _contentType = contentType;
+  if (!_partition) {
+    return;
+  }
+  _offset = offset < _partition->size ? offset : _partition->size;
+  _contentLength = len < _partition->size - _offset ? len : _partition->size - _offset;
+  _size = _contentLength;
+  _content = asyncsrv::mapPartition(_partition);
+}
+
+AsyncFlashResponse::AsyncFlashResponse(const esp_partition_t *partition, size_t offset, size_t len, const String &path, const char *contentEncoding)
+  : AsyncFlashResponse(partition, asyncsrv::empty, offset, len) {
+  if (contentEncoding) {
+    addHeader(T_Content_Encoding, contentEncoding, false);
+  }
+  _setContentTypeFromPath(path);
+}
+
+const uint8_t *AsyncFlashResponse::_directContent(size_t len) {
+  if (!_content) {
+    return nullptr;
   }
-  memcpy_P(data, _content + _readLength, left);
-  _readLength += left;
-  return left;
+  const uint8_t *content = _content + _offset + _readLength;
+  _readLength += len;
+  return content;
+}
+
+size_t AsyncFlashResponse::_fillBuffer(uint8_t *data, size_t len) {
+  // the ranges are bounded by the caller, only the end of the content is checked here
+  const size_t left = _readLength < _size ? _size - _readLength : 0;
+  if (len > left) {
+    len = left;
+  }
+  if (_content) {
+    memcpy(data, _content + _offset + _readLength, len);
+  } else if (esp_partition_read(_partition, _offset + _readLength, data, len) != ESP_OK) {
+    async_ws_log_e("Unable to read the partition %s", _partition->label);
+    _partition = nullptr;
+    return 0;
+  }
+  _readLength += len;
+  return len;
+}
+#endif
+
+/*
+ * Cached File Response
+ * */
+
+AsyncCachedFileResponse::AsyncCachedFileResponse(
+  std::shared_ptr<uint8_t> content, size_t len, const String &path, const char *contentEncoding, AwsTemplateProcessor callback
+)
+  : AsyncAbstractResponse(callback), _content(content), _readLength(0), _size(len) {
+  _code = 200;
+  _contentLength = len;
+  if (contentEncoding) {
+    addHeader(T_Content_Encoding, contentEncoding, false);
+    _callback = nullptr;  // Unable to process compressed templates
+    _sendContentLength = true;
+    _chunked = false;
+  }
+  _setContentTypeFromPath(path);
+  addHeader(T_Content_Disposition, T_inline, false);
+}
+
+size_t AsyncCachedFileResponse::_fillBuffer(uint8_t *data, size_t len) {
+  // the ranges are bounded by the caller, only the end of the content is checked here
+  const size_t n = _readLength < _size ? std::min(len, _size - _readLength) : 0;
+  memcpy(data, _content.get() + _readLength, n);
+  _readLength += n;
+  return n;
 }
 
 /*
@@ -891,31 +1569,143 @@ AsyncResponseStream::AsyncResponseStream(const char *contentType, size_t bufferS
   _contentLength = 0;
   _contentType = contentType;
   // internal buffer will be null on allocation failure
-  _content = std::unique_ptr<cbuf>(new cbuf(bufferSize));
-  if (bufferSize && _content->size() < bufferSize) {
-    async_ws_log_e("Failed to allocate");
+  if (bufferSize) {
+    _content.reset((uint8_t *)allocateBuffer(AsyncMemoryUse::STREAM, bufferSize));
+    if (!_content) {
+      async_ws_log_e("Failed to allocate");
+      async_ws_metric_inc(allocFailures);
+    } else {
+      _capacity = bufferSize;
+    }
   }
 }
 
+AsyncResponseStream::AsyncResponseStream(const char *contentType, AwsResponseStreamProducer producer, size_t blockSize, size_t blocks, bool chunked)
+  : _blockSize(blockSize ? blockSize : 1), _producer(producer) {
+  _code = 200;
+  _contentLength = 0;
+  _contentType = contentType;
+  _sendContentLength = false;
+  _chunked = chunked;
+  _blocks.resize(blocks ? blocks : 1);
+}
+
+size_t AsyncResponseStream::room() const {
+  if (!_blockSize) {
+    return _capacity - _readPos - _buffered;
+  }
+  size_t room = (_blocks.size() - _used) * _blockSize;
+  if (_used) {
+    // what remains in the last block
+    room += _blockSize - _blocks[(_first + _used - 1) % _blocks.size()].len;
+  }
+  return room;
+}
+
+size_t AsyncResponseStream::_writeBlocks(const uint8_t *data, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    Block *last = _used ? &_blocks[(_first + _used - 1) % _blocks.size()] : nullptr;
+    if (!last || last->len == _blockSize) {
+      if (_used == _blocks.size()) {
+        break;
+      }
+      last = &_blocks[(_first + _used) % _blocks.size()];
+      if (!last->data) {
+        last->data.reset((uint8_t *)allocateBuffer(AsyncMemoryUse::STREAM, _blockSize));
+        if (!last->data) {
+          async_ws_log_e("Failed to allocate");
+          async_ws_metric_inc(allocFailures);
+          break;
+        }
+      }
+      last->len = 0;
+      _used++;
+    }
+    const size_t n = std::min(len - written, _blockSize - last->len);
+    memcpy(last->data.get() + last->len, data + written, n);
+    last->len += n;
+    written += n;
+  }
+  _buffered += written;
+  return written;
+}
+
+size_t AsyncResponseStream::_readBlocks(uint8_t *buf, size_t maxLen) {
+  size_t read = 0;
+  while (read < maxLen && _used) {
+    Block &first = _blocks[_first];
+    const size_t n = std::min(maxLen - read, first.len - _readPos);
+    memcpy(buf + read, first.data.get() + _readPos, n);
+    _readPos += n;
+    read += n;
+    if (_readPos == first.len) {
+      // the block is free again, even if it was not full
+      _first = (_first + 1) % _blocks.size();
+      _used--;
+      _readPos = 0;
+    }
+  }
+  _buffered -= read;
+  return read;
+}
+
 size_t AsyncResponseStream::_fillBuffer(uint8_t *buf, size_t maxLen) {
-  return _content->read((char *)buf, maxLen);
+  if (!_blockSize) {
+    const size_t n = std::min(maxLen, _buffered);
+    if (n) {
+      memcpy(buf, _content.get() + _readPos, n);
+      _readPos += n;
+      _buffered -= n;
+    }
+    return n;
+  }
+  size_t read = _readBlocks(buf, maxLen);
+  // ask the producer for more while there is space left, both in this buffer and in the blocks
+  while (!_ended && read < maxLen && room()) {
+    const size_t buffered = _buffered;
+    if (!_producer || !_producer(*this)) {
+      _ended = true;
+    } else if (_buffered == buffered) {
+      // nothing to write yet
+      break;
+    }
+    read += _readBlocks(buf + read, maxLen - read);
+  }
+  if (!read && !(_ended && !_buffered)) {
+    // only a 0 length ends the content
+    return RESPONSE_TRY_AGAIN;
+  }
+  return read;
 }
 
 size_t AsyncResponseStream::write(const uint8_t *data, size_t len) {
+  if (_blockSize) {
+    // bounded by the free blocks, the rest is refused
+    return _ended ? 0 : _writeBlocks(data, len);
+  }
   if (_started()) {
     return 0;
   }
-  if (len > _content->room()) {
-    size_t needed = len - _content->room();
-    _content->resizeAdd(needed);
-    // log a warning if allocation failed, but do not return: keep writing the bytes we can
-    // with _content->write: if len is more than the available size in the buffer, only
-    // the available size will be written
-    if (len > _content->room()) {
+  if (len > room()) {
+    const size_t capacity = _readPos + _buffered + len;
+    uint8_t *content = (uint8_t *)reallocateBuffer(AsyncMemoryUse::STREAM, _content.get(), capacity);
+    if (content) {
+      _content.release();
+      _content.reset(content);
+      _capacity = capacity;
+    } else {
+      // log a warning if allocation failed, but do not return: keep writing the bytes we can,
+      // if len is more than the available size in the buffer, only the available size will be written
       async_ws_log_e("Failed to allocate");
+      async_ws_metric_inc(allocFailures);
     }
   }
-  size_t written = _content->write((const char *)data, len);
+  const size_t written = std::min(len, room());
+  if (written) {
+    memcpy(_content.get() + _readPos + _buffered, data, written);
+    _buffered += written;
+  }
   _contentLength += written;
   return written;
 }
@@ -923,3 +1713,255 @@ size_t AsyncResponseStream::write(const uint8_t *data, size_t len) {
 size_t AsyncResponseStream::write(uint8_t data) {
   return write(&data, 1);
 }
+
+/*
+ * Proxy Response (the response of an upstream server, relayed while it is received)
+ * */
+
+bool asyncsrv::isHopByHopHeader(const char *name, size_t len) {
+  static const char *const headers[] = {T_Connection, T_keep_alive, T_Proxy_Connection, T_TE, T_Trailer, T_Transfer_Encoding, T_UPGRADE};
+  for (const char *header : headers) {
+    if (strlen(header) == len && strncasecmp(name, header, len) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+AsyncProxyResponse::AsyncProxyResponse(std::vector<uint8_t> &&outgoing, bool headOnly)
+  : _upstream(nullptr), _outgoing(std::move(outgoing)), _headOnly(headOnly) {
+  _code = 502;
+  _contentLength = 0;
+}
+
+AsyncProxyResponse::~AsyncProxyResponse() {
+  if (_upstream) {
+    // from now on, the upstream client only deletes itself once closed
+    _upstream->onConnect(nullptr);
+    _upstream->onAck(nullptr);
+    _upstream->onData(nullptr);
+    _upstream->onDisconnect([](void *, AsyncClient *c) {
+      delete c;
+    });
+    _upstream->close();
+  }
+}
+
+bool AsyncProxyResponse::begin(AsyncWebServerRequest *request, const char *host, uint16_t port, uint32_t timeout) {
+  _upstream = new (std::nothrow) AsyncClient();
+  if (!_upstream) {
+    async_ws_log_e("Failed to allocate");
+    async_ws_metric_inc(allocFailures);
+    return false;
+  }
+  // until the head is received
+  _upstream->setRxTimeout(timeout);
+  _upstream->onConnect(
+    [](void *r, AsyncClient *) {
+      ((AsyncProxyResponse *)r)->_sendOutgoing();
+    },
+    this
+  );
+  _upstream->onAck(
+    [](void *r, AsyncClient *, size_t, uint32_t) {
+      ((AsyncProxyResponse *)r)->_sendOutgoing();
+    },
+    this
+  );
+  _upstream->onData(
+    [](void *r, AsyncClient *c, void *data, size_t len) {
+      // acknowledged once sent to the client
+      c->ackLater();
+      ((AsyncProxyResponse *)r)->_onUpstreamData((uint8_t *)data, len);
+    },
+    this
+  );
+  _upstream->onDisconnect(
+    [](void *r, AsyncClient *c) {
+      AsyncProxyResponse *response = (AsyncProxyResponse *)r;
+      response->_upstream = nullptr;
+      delete c;
+      response->_onUpstreamEnd();
+    },
+    this
+  );
+  if (!_upstream->connect(host, port)) {
+    delete _upstream;
+    _upstream = nullptr;
+    return false;
+  }
+  _requestPtr = request->pause();
+  return true;
+}
+
+void AsyncProxyResponse::_sendOutgoing() {
+  if (_outgoing.empty()) {
+    return;
+  }
+  const size_t len = std::min(_outgoing.size() - _outgoingSent, _upstream->space());
+  if (len) {
+    _outgoingSent += _upstream->write((const char *)_outgoing.data() + _outgoingSent, len);
+  }
+  if (_outgoingSent == _outgoing.size()) {
+    std::vector<uint8_t>().swap(_outgoing);
+  }
+}
+
+void AsyncProxyResponse::_onUpstreamData(uint8_t *data, size_t len) {
+  if (!_headParsed) {
+    // the head is acknowledged right away, only the content is held back
+    size_t i = 0;
+    while (i < len && !_headParsed) {
+      _upstreamHead.concat((char)data[i++]);
+      _headParsed = _upstreamHead.endsWith(T_rnrn);
+    }
+    _upstream->ack(i);
+    if (!_headParsed) {
+      if (_upstreamHead.length() > ASYNCWEBSERVER_PROXY_MAX_HEAD) {
+        async_ws_log_w("Upstream response head too long");
+        // answered with 502 once closed
+        _upstream->close();
+      }
+      return;
+    }
+    if (!_parseUpstreamHead()) {
+      async_ws_log_w("Invalid upstream response");
+      _upstream->close();
+      return;
+    }
+    // the upstream server now waits for the client to read the content: no more timeout
+    _upstream->setRxTimeout(0);
+    data += i;
+    len -= i;
+  }
+
+  if (len) {
+    if (_content->room() < len) {
+      _content->resizeAdd(len - _content->room());
+    }
+    const size_t written = _content->write((const char *)data, len);
+    if (written < len) {
+      async_ws_log_e("Failed to allocate");
+      async_ws_metric_inc(allocFailures);
+      _truncated = true;
+    }
+    _received += len;
+    _unacked += written;
+  }
+
+  if (!_request) {
+    // the head was just parsed: it is time to send the response
+    std::shared_ptr<AsyncWebServerRequest> request = _requestPtr.lock();
+    if (!request || _truncated) {
+      _upstream->close();
+      return;
+    }
+    _request = request.get();
+    _requestPtr.reset();
+    if (_expected == SIZE_MAX) {
+      // the upstream server closes the connection at the end of the content: so does this response for an HTTP/1.0 client
+      _sendContentLength = false;
+      _chunked = _request->version();
+    }
+    _request->send(this);
+    return;
+  }
+  _resume();
+}
+
+bool AsyncProxyResponse::_parseUpstreamHead() {
+  // status line: HTTP/1.x code reason
+  const char *p = _upstreamHead.c_str();
+  if (strncmp(p, T_HTTP_1_0, strlen(T_HTTP_1_0) - 1) != 0) {
+    return false;
+  }
+  const char *code = strchr(p, ' ');
+  if (!code) {
+    return false;
+  }
+  _code = atoi(code + 1);
+  if (_code < 100 || _code > 999) {
+    return false;
+  }
+
+  const char *line = strstr(p, T_rn) + 2;
+  while (strncmp(line, T_rn, 2) != 0) {
+    const char *eol = strstr(line, T_rn);
+    const char *colon = (const char *)memchr(line, ':', eol - line);
+    if (colon && colon > line) {
+      const size_t nameLen = colon - line;
+      const char *start = colon + 1;
+      while (start < eol && (*start == ' ' || *start == '\t')) {
+        start++;
+      }
+      String value;
+      value.concat(start, eol - start);
+      if (nameLen == strlen(T_Content_Length) && strncasecmp(line, T_Content_Length, nameLen) == 0) {
+        _expected = strtoul(value.c_str(), nullptr, 10);
+      } else if (nameLen == strlen(T_Content_Type) && strncasecmp(line, T_Content_Type, nameLen) == 0) {
+        _contentType = value;
+      } else if (!isHopByHopHeader(line, nameLen)) {
+        String name;
+        name.concat(line, nameLen);
+        addHeader(name.c_str(), value.c_str(), false);
+      }
+    }
+    line = eol + 2;
+  }
+  _upstreamHead = String();
+
+  if (_code < 200 || _code == 204 || _code == 304) {
+    _expected = 0;
+  }
+  if (_expected != SIZE_MAX) {
+    _contentLength = _expected;
+    _sendContentLength = true;
+    _chunked = false;
+  }
+  if (_headOnly) {
+    // the length is announced as the upstream server did, but no content follows the head
+    _sendContentLength = _expected != SIZE_MAX;
+    _expected = 0;
+  }
+  _content = std::unique_ptr<cbuf>(new cbuf(RESPONSE_STREAM_BUFFER_SIZE));
+  return true;
+}
+
+void AsyncProxyResponse::_onUpstreamEnd() {
+  _upstreamEnded = true;
+  if (!_request) {
+    // the response was not sent: it only belongs to itself
+    std::shared_ptr<AsyncWebServerRequest> request = _requestPtr.lock();
+    if (request) {
+      request->send(502);
+    }
+    delete this;
+    return;
+  }
+  if (_expected != SIZE_MAX && _received < _expected) {
+    async_ws_log_w("Upstream response truncated");
+    _truncated = true;
+  }
+  _resume();
+}
+
+// the client may be waiting for the content: send it without waiting for the next poll of the connection
+void AsyncProxyResponse::_resume() {
+  if (!_finished() && _request->client()->canSend()) {
+    _ack(_request, 0, 0);
+  }
+}
+
+size_t AsyncProxyResponse::_fillBuffer(uint8_t *buf, size_t maxLen) {
+  const size_t len = _content->read((char *)buf, maxLen);
+  // the upstream server can send as much content again
+  const size_t acked = std::min(len, _unacked);
+  if (acked && _upstream) {
+    _upstream->ack(acked);
+  }
+  _unacked -= acked;
+  if (!len && !_upstreamEnded && _received < _expected) {
+    return RESPONSE_TRY_AGAIN;
+  }
+  return len;
+}
@@ -92,6 +92,7 @@ AsyncWebRewrite &AsyncWebServer::rewrite(const char *from, const char *to) {
 
 AsyncWebHandler &AsyncWebServer::addHandler(AsyncWebHandler *handler) {
   _handlers.emplace_back(handler);
+  _routesChanged = true;
   return *(_handlers.back().get());
 }
 
@@ -99,6 +100,7 @@ bool AsyncWebServer::removeHandler(AsyncWebHandler *handler) {
   for (auto i = _handlers.begin(); i != _handlers.end(); ++i) {
     if (i->get() == handler) {
       _handlers.erase(i);
+      _routesChanged = true;
       return true;
     }
   }
@@ -139,11 +141,91 @@ void AsyncWebServer::_rewriteRequest(AsyncWebServerRequest *request) {
   }
 }
 
-void AsyncWebServer::_attachHandler(AsyncWebServerRequest *request) {
+// FNV-1a
+static inline uint32_t routeHash(uint32_t hash, char c) {
+  return (hash ^ (uint8_t)c) * 16777619u;
+}
+static constexpr uint32_t ROUTE_HASH_INIT = 2166136261u;
+
+void AsyncWebServer::_buildRoutes() {
+  _routes.clear();
+  _genericRoutes.clear();
+  size_t order = 0;
   for (auto &h : _handlers) {
-    if (h->filter(request) && h->canHandle(request)) {
-      request->setHandler(h.get());
-      return;
+    const String &uri = h->routeUri();
+    if (uri.length()) {
+      uint32_t hash = ROUTE_HASH_INIT;
+      for (size_t i = 0; i < uri.length(); i++) {
+        hash = routeHash(hash, uri[i]);
+      }
+      _routes[hash].push_back({h.get(), order});
+    } else {
+      _genericRoutes.push_back({h.get(), order});
+    }
+    order++;
+  }
+  _routesChanged = false;
+}
+
+void AsyncWebServer::_attachHandler(AsyncWebServerRequest *request) {
+  if (_routesChanged) {
+    _buildRoutes();
+  }
+
+  // A route URI matches the url itself and its sub-paths: collect the routes of the url and of each of its parent paths.
+  // Each list is sorted by registration order.
+  const std::vector<Route> *lists[ASYNCWEBSERVER_ROUTE_MAX_DEPTH + 2];
+  size_t positions[ASYNCWEBSERVER_ROUTE_MAX_DEPTH + 2] = {0};
+  size_t count = 0;
+  bool overflow = false;
+  if (!_genericRoutes.empty()) {
+    lists[count++] = &_genericRoutes;
+  }
+  if (!_routes.empty()) {
+    const String &url = request->url();
+    uint32_t hash = ROUTE_HASH_INIT;
+    for (size_t i = 0; i <= url.length() && !overflow; i++) {
+      if (i == url.length() || (i && url[i] == '/')) {
+        auto it = _routes.find(hash);
+        if (it != _routes.end() && std::find(lists, lists + count, &it->second) == lists + count) {
+          if (count == ASYNCWEBSERVER_ROUTE_MAX_DEPTH + 2) {
+            overflow = true;
+          } else {
+            lists[count++] = &it->second;
+          }
+        }
+      }
+      if (i < url.length()) {
+        hash = routeHash(hash, url[i]);
+      }
+    }
+  }
+
+  if (overflow) {
+    // fallback to trying all the handlers
+    for (auto &h : _handlers) {
+      if (h->filter(request) && h->canHandle(request)) {
+        request->setHandler(h.get());
+        return;
+      }
+    }
+  } else {
+    // merge the lists to try the handlers in registration order
+    while (true) {
+      size_t best = count;
+      for (size_t l = 0; l < count; l++) {
+        if (positions[l] < lists[l]->size() && (best == count || (*lists[l])[positions[l]].order < (*lists[best])[positions[best]].order)) {
+          best = l;
+        }
+      }
+      if (best == count) {
+        break;
+      }
+      AsyncWebHandler *h = (*lists[best])[positions[best]++].handler;
+      if (h->filter(request) && h->canHandle(request)) {
+        request->setHandler(h);
+        return;
+      }
     }
   }
   // ESP_LOGD("AsyncWebServer", "No handler found for %s, using _catchAllHandler pointer: %p", request->url().c_str(), _catchAllHandler);
@@ -169,6 +251,14 @@ AsyncStaticWebHandler &AsyncWebServer::serveStatic(const char *uri, fs::FS &fs,
   return *handler;
 }
 
+#ifdef ESP32
+AsyncFlashWebHandler &AsyncWebServer::serveFlash(const char *uri, const char *partitionLabel, const char *cache_control) {
+  AsyncFlashWebHandler *handler = new AsyncFlashWebHandler(uri, partitionLabel, cache_control);
+  addHandler(handler);
+  return *handler;
+}
+#endif
+
 void AsyncWebServer::onNotFound(ArRequestHandlerFunction fn) {
   _catchAllHandler->onRequest(fn);
 }
@@ -188,6 +278,7 @@ AsyncWebHandler &AsyncWebServer::catchAllHandler() const {
 void AsyncWebServer::reset() {
   _rewrites.clear();
   _handlers.clear();
+  _routesChanged = true;
 
   _catchAllHandler->onRequest(NULL);
   _catchAllHandler->onUpload(NULL);
@@ -8,17 +8,24 @@ namespace asyncsrv {
 static constexpr const char *empty = "";
 
 static constexpr const char *T__opaque = "\", opaque=\"";
+static constexpr const char *T__part = ".part";
 static constexpr const char *T_100_CONTINUE = "100-continue";
 static constexpr const char *T_13 = "13";
 static constexpr const char *T_ACCEPT = "Accept";
+static constexpr const char *T_Accept_Encoding = "Accept-Encoding";
 static constexpr const char *T_Accept_Ranges = "Accept-Ranges";
+static constexpr const char *T_Allow = "Allow";
 static constexpr const char *T_attachment = "attachment; filename=\"";
 static constexpr const char *T_AUTH = "Authorization";
 static constexpr const char *T_auth_nonce = "\", qop=\"auth\", nonce=\"";
 static constexpr const char *T_BASIC = "Basic";
 static constexpr const char *T_BASIC_REALM = "Basic realm=\"";
 static constexpr const char *T_BEARER = "Bearer";
+static constexpr const char *T_br = "br";
 static constexpr const char *T_BODY = "body";
+static constexpr const char *T_bytes = "bytes";
+static constexpr const char *T_bytes_ = "bytes ";
+static constexpr const char *T_byteranges = "multipart/byteranges; boundary=";
 static constexpr const char *T_Cache_Control = "Cache-Control";
 static constexpr const char *T_chunked = "chunked";
 static constexpr const char *T_close = "close";
@@ -29,6 +36,7 @@ static constexpr const char *T_Content_Encoding = "Content-Encoding";
 static constexpr const char *T_Content_Length = "Content-Length";
 static constexpr const char *T_Content_Type = "Content-Type";
 static constexpr const char *T_Content_Location = "Content-Location";
+static constexpr const char *T_Content_Range = "Content-Range";
 static constexpr const char *T_Cookie = "Cookie";
 static constexpr const char *T_CORS_ACAC = "Access-Control-Allow-Credentials";
 static constexpr const char *T_CORS_ACAH = "Access-Control-Allow-Headers";
@@ -37,7 +45,11 @@ static constexpr const char *T_CORS_ACAO = "Access-Control-Allow-Origin";
 static constexpr const char *T_CORS_ACMA = "Access-Control-Max-Age";
 static constexpr const char *T_CORS_O = "Origin";
 static constexpr const char *T_data_ = "data: ";
+static constexpr const char *T_DAV = "DAV";
+static constexpr const char *T_deflate = "deflate";
 static constexpr const char *T_Date = "Date";
+static constexpr const char *T_Depth = "Depth";
+static constexpr const char *T_Destination = "Destination";
 static constexpr const char *T_DIGEST = "Digest";
 static constexpr const char *T_DIGEST_ = "Digest ";
 static constexpr const char *T_ETag = "ETag";
@@ -50,6 +62,7 @@ static constexpr const char *T_Host = "host";
 static constexpr const char *T_HTTP_1_0 = "HTTP/1.0";
 static constexpr const char *T_HTTP_100_CONT = "HTTP/1.1 100 Continue\r\n\r\n";
 static constexpr const char *T_id__ = "id: ";
+static constexpr const char *T_If_Range = "If-Range";
 static constexpr const char *T_IMS = "If-Modified-Since";
 static constexpr const char *T_INM = "If-None-Match";
 static constexpr const char *T_inline = "inline";
@@ -65,7 +78,10 @@ static constexpr const char *T_no_cache = "no-cache";
 static constexpr const char *T_nonce = "nonce";
 static constexpr const char *T_none = "none";
 static constexpr const char *T_opaque = "opaque";
+static constexpr const char *T_Overwrite = "Overwrite";
+static constexpr const char *T_Proxy_Connection = "Proxy-Connection";
 static constexpr const char *T_qop = "qop";
+static constexpr const char *T_Range = "Range";
 static constexpr const char *T_realm = "realm";
 static constexpr const char *T_realm__ = "realm=\"";
 static constexpr const char *T_response = "response";
@@ -75,13 +91,19 @@ static constexpr const char *T_nn = "\n\n";
 static constexpr const char *T_rn = "\r\n";
 static constexpr const char *T_rnrn = "\r\n\r\n";
 static constexpr const char *T_Server = "Server";
+static constexpr const char *T_Set_Cookie = "Set-Cookie";
+static constexpr const char *T__session_cookie = "; Path=/; HttpOnly; SameSite=Strict; Max-Age=";
+static constexpr const char *T_TE = "TE";
+static constexpr const char *T_Trailer = "Trailer";
 static constexpr const char *T_Transfer_Encoding = "Transfer-Encoding";
 static constexpr const char *T_TRUE = "true";
 static constexpr const char *T_UPGRADE = "Upgrade";
 static constexpr const char *T_uri = "uri";
 static constexpr const char *T_username = "username";
+static constexpr const char *T_Vary = "Vary";
 static constexpr const char *T_WS = "websocket";
 static constexpr const char *T_WWW_AUTH = "WWW-Authenticate";
+static constexpr const char *T_X_Forwarded_For = "X-Forwarded-For";
 
 // HTTP Methods
 static constexpr const char *T_ANY = "ANY";
@@ -112,6 +134,7 @@ static constexpr const char *T_ERROR = "ERROR";
 
 // extensions & MIME-Types
 static constexpr const char *T__avif = ".avif";    // AVIF: Highly compressed images. Compatible with all modern browsers.
+static constexpr const char *T__br = ".br";        // BR: brotli compressed files
 static constexpr const char *T__csv = ".csv";      // CSV: Data logging and configuration
 static constexpr const char *T__css = ".css";      // CSS: Styling for web interfaces
 static constexpr const char *T__gif = ".gif";      // GIF: Simple animations. Legacy support
@@ -140,6 +163,7 @@ static constexpr const char *T_application_json = "application/json";
 static constexpr const char *T_application_msgpack = "application/msgpack";
 static constexpr const char *T_application_octet_stream = "application/octet-stream";
 static constexpr const char *T_application_pdf = "application/pdf";
+static constexpr const char *T_application_xml = "application/xml; charset=utf-8";
 static constexpr const char *T_app_xform_urlencoded = "application/x-www-form-urlencoded";
 static constexpr const char *T_audio_opus = "audio/opus";
 static constexpr const char *T_font_ttf = "font/ttf";
@@ -158,10 +182,25 @@ static constexpr const char *T_text_event_stream = "text/event-stream";
 static constexpr const char *T_text_html = "text/html";
 static constexpr const char *T_text_javascript = "text/javascript";
 static constexpr const char *T_text_plain = "text/plain";
+static constexpr const char *T_text_plain_prometheus = "text/plain; version=0.0.4";
 static constexpr const char *T_text_xml = "text/xml";
 static constexpr const char *T_video_mp4 = "video/mp4";
 static constexpr const char *T_video_webm = "video/webm";
 
+// WebDAV
+static constexpr const char *T_DAV_allow = "OPTIONS, GET, HEAD, PUT, DELETE, PROPFIND, MKCOL, MOVE, COPY";
+static constexpr const char *T_DAV_multistatus = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<D:multistatus xmlns:D=\"DAV:\">\n";
+static constexpr const char *T_DAV_multistatus_end = "</D:multistatus>\n";
+static constexpr const char *T_DAV_response = "<D:response><D:href>";
+static constexpr const char *T_DAV_propstat = "</D:href><D:propstat><D:prop>";
+static constexpr const char *T_DAV_collection = "<D:resourcetype><D:collection/></D:resourcetype>";
+static constexpr const char *T_DAV_resource = "<D:resourcetype/>";
+static constexpr const char *T_DAV_length = "<D:getcontentlength>";
+static constexpr const char *T_DAV_length_end = "</D:getcontentlength>";
+static constexpr const char *T_DAV_modified = "<D:getlastmodified>";
+static constexpr const char *T_DAV_modified_end = "</D:getlastmodified>";
+static constexpr const char *T_DAV_response_end = "</D:prop><D:status>HTTP/1.1 200 OK</D:status></D:propstat></D:response>\n";
+
 // Response codes
 static constexpr const char *T_HTTP_CODE_100 = "Continue";
 static constexpr const char *T_HTTP_CODE_101 = "Switching Protocols";
@@ -172,6 +211,7 @@ static constexpr const char *T_HTTP_CODE_203 = "Non-Authoritative Information";
 static constexpr const char *T_HTTP_CODE_204 = "No Content";
 static constexpr const char *T_HTTP_CODE_205 = "Reset Content";
 static constexpr const char *T_HTTP_CODE_206 = "Partial Content";
+static constexpr const char *T_HTTP_CODE_207 = "Multi-Status";
 static constexpr const char *T_HTTP_CODE_300 = "Multiple Choices";
 static constexpr const char *T_HTTP_CODE_301 = "Moved Permanently";
 static constexpr const char *T_HTTP_CODE_302 = "Found";
@@ -204,6 +244,7 @@ static constexpr const char *T_HTTP_CODE_502 = "Bad Gateway";
 static constexpr const char *T_HTTP_CODE_503 = "Service Unavailable";
 static constexpr const char *T_HTTP_CODE_504 = "Gateway Time-out";
 static constexpr const char *T_HTTP_CODE_505 = "HTTP Version Not Supported";
+static constexpr const char *T_HTTP_CODE_507 = "Insufficient Storage";
 static constexpr const char *T_HTTP_CODE_ANY = "Unknown code";
 
 static constexpr const char *T_only_once_headers[] = {
@@ -213,4 +254,12 @@ static constexpr const char *T_only_once_headers[] = {
 };
 static constexpr size_t T_only_once_headers_len = sizeof(T_only_once_headers) / sizeof(T_only_once_headers[0]);
 
+// Precompressed variants of a file, stored next to it with an extension added to its name
+struct FileEncoding {
+  const char *encoding;   // Content-Encoding of the variant
+  const char *extension;  // added to the name of the file
+};
+static constexpr FileEncoding fileEncodings[] = {{T_br, T__br}, {T_gzip, T__gz}};
+static constexpr size_t fileEncodingsLen = sizeof(fileEncodings) / sizeof(fileEncodings[0]);
+
 }  // namespace asyncsrv